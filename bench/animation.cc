@@ -0,0 +1,122 @@
+// Animation: refitting the bvh against rebuilding it, and frames/hour with and
+// without frame pipelining.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/animation.cc -pthread -o bench_animation && ./bench_animation 2>/dev/null
+//
+// Refitting keeps the tree of the first frame, so rays slow down as objects
+// drift from where it was built; the table shows how far they can move first.
+// Pipelining only pays off with several cores: it fills the threads that sit
+// idle while the last tiles of a frame finish.
+
+#include "../src/rtweekend.h"
+
+#include "../src/animation.h"
+#include "../src/bvh.h"
+#include "../src/job.h"
+#include "../src/options.h"
+#include "../src/sphere.h"
+#include "../src/thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// Random small spheres scattered through a cube, as in bench/bvh.cc
+hittable_list sphere_cloud(int count, double side) {
+	hittable_list world;
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	for (int i = 0; i < count; ++i)
+		world.add(make_shared<sphere>(vec3::random(-side, side), random_double(0.2, 1.0), mat));
+	return world;
+}
+
+double rays_per_second(const hittable& world, const std::vector<ray>& rays) {
+	hit_record rec;
+	long hits = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& r : rays)
+		hits += world.hit(r, 0.001, infinity, rec);
+	auto end = std::chrono::steady_clock::now();
+	std::printf("%s", hits < 0 ? " " : ""); // keeps the hits
+	return rays.size() / std::chrono::duration<double>(end - start).count();
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void refit_vs_rebuild() {
+	const int count = 100000;
+	const double side = 10.0 * std::cbrt(static_cast<double>(count));
+	seed_thread_rng(1);
+	hittable_list world = sphere_cloud(count, side);
+	std::vector<point3> start;
+	std::vector<vec3> velocity;
+	for (const auto& o : world.objects) {
+		start.push_back(static_cast<sphere&>(*o).center);
+		velocity.push_back(random_unit_vector());
+	}
+	std::vector<ray> rays;
+	for (int i = 0; i < 200000; ++i)
+		rays.emplace_back(vec3::random(-side, side), random_unit_vector());
+
+	bvh refitted(world);
+	std::printf("%d spheres moving in random directions\n", count);
+	std::printf("%12s %12s %12s %16s %16s\n", "distance", "build (ms)", "refit (ms)", "built rays/s", "refit rays/s");
+	for (double distance : { 0.0, 1.0, 4.0, 16.0, 64.0 }) {
+		for (size_t k = 0; k < start.size(); ++k)
+			static_cast<sphere&>(*world.objects[k]).center = start[k] + distance * velocity[k];
+
+		auto t = std::chrono::steady_clock::now();
+		bvh built(world);
+		double build_ms = ms_since(t);
+		t = std::chrono::steady_clock::now();
+		refitted.refit();
+		double refit_ms = ms_since(t);
+
+		std::printf("%12.1f %12.2f %12.2f %16.0f %16.0f\n", distance, build_ms, refit_ms,
+					rays_per_second(built, rays), rays_per_second(refitted, rays));
+	}
+}
+
+void pipelining(thread_pool& pool) {
+	// A fly-around of the random scene with some spheres moving
+	const char* path = "/tmp/bench_animation.json";
+	{
+		std::ofstream out(path);
+		out << "{ \"frames\": 24, \"camera\": [ { \"frame\": 0, \"lookfrom\": [13, 2, 3] },"
+			   " { \"frame\": 12, \"lookfrom\": [3, 2, 13] }, { \"frame\": 23, \"lookfrom\": [-13, 2, 3] } ],"
+			   " \"spheres\": [";
+		for (int k = 1; k <= 40; ++k)
+			out << (k > 1 ? ", " : "") << "{ \"index\": " << 10 * k << ", \"velocity\": [0, 0.02, 0] }";
+		out << "] }\n";
+	}
+
+	std::printf("\n24 frames of the random scene, 320x213 at 8 spp, %d threads\n", pool.size());
+	std::printf("%18s %12s %14s\n", "frames in flight", "seconds", "frames/hour");
+	for (int in_flight : { 1, 2, 3 }) {
+		render_options o;
+		o.scene = "random";
+		o.animation_path = path;
+		o.image_width = 320;
+		o.samples_per_pixel = 8;
+		o.frames_in_flight = in_flight;
+		o.output_path = "/dev/null";
+
+		auto t = std::chrono::steady_clock::now();
+		render_animation(o, pool);
+		double seconds = ms_since(t) / 1e3;
+		std::printf("%18d %12.2f %14.0f\n", in_flight, seconds, 24 * 3600.0 / seconds);
+	}
+}
+
+int main() {
+	refit_vs_rebuild();
+
+	thread_pool pool(std::thread::hardware_concurrency());
+	pipelining(pool);
+	pool.end();
+	return 0;
+}
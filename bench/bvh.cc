@@ -0,0 +1,75 @@
+// Rays/sec of the BVH against a flat hittable_list as the object count grows.
+//
+// Compile & Run: g++ -O2 ./bench/bvh.cc -o bench_bvh && ./bench_bvh
+
+#include "../src/rtweekend.h"
+
+#include "../src/bvh.h"
+#include "../src/hittable_list.h"
+#include "../src/material.h"
+#include "../src/sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Random small spheres scattered through a cube, like random_scene() but denser
+hittable_list sphere_cloud(int count) {
+	hittable_list world;
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	double side = 10.0 * std::cbrt(static_cast<double>(count));
+
+	for (int i = 0; i < count; ++i) {
+		point3 center = vec3::random(-side, side);
+		world.add(make_shared<sphere>(center, random_double(0.2, 1.0), mat));
+	}
+
+	return world;
+}
+
+std::vector<ray> random_rays(int count, double side) {
+	std::vector<ray> rays;
+	rays.reserve(count);
+	for (int i = 0; i < count; ++i)
+		rays.emplace_back(vec3::random(-side, side), random_unit_vector());
+	return rays;
+}
+
+// Returns rays per second; hits is only accumulated so the work is not optimised away
+double trace(const hittable& world, const std::vector<ray>& rays, long& hits) {
+	hit_record rec;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& r : rays)
+		hits += world.hit(r, 0.001, infinity, rec);
+	auto end = std::chrono::steady_clock::now();
+	return rays.size() / std::chrono::duration<double>(end - start).count();
+}
+
+int main() {
+	const int num_rays = 200000;
+
+	std::printf("%10s %12s %14s %14s %10s\n", "objects", "build (ms)", "list rays/s", "bvh rays/s", "speedup");
+
+	for (int count : {10, 100, 1000, 10000, 100000}) {
+		seed_thread_rng(count);
+		auto world = sphere_cloud(count);
+		auto rays = random_rays(num_rays, 10.0 * std::cbrt(static_cast<double>(count)));
+
+		auto build_start = std::chrono::steady_clock::now();
+		bvh tree(world);
+		auto build_end = std::chrono::steady_clock::now();
+		double build_ms = std::chrono::duration<double, std::milli>(build_end - build_start).count();
+
+		long list_hits = 0, bvh_hits = 0;
+
+		// The flat list is too slow to push every ray through at large counts
+		std::vector<ray> list_rays(rays.begin(), rays.begin() + (count > 1000 ? num_rays / 20 : num_rays));
+		double list_rate = trace(world, list_rays, list_hits);
+		double bvh_rate = trace(tree, rays, bvh_hits);
+
+		std::printf("%10d %12.2f %14.0f %14.0f %9.1fx\n",
+			count, build_ms, list_rate, bvh_rate, bvh_rate / list_rate);
+	}
+
+	return 0;
+}
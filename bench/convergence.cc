@@ -0,0 +1,100 @@
+// Image error against samples per pixel for each sampler: RMSE to a high-spp independent
+// reference, and the independent spp that gives the same error.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/convergence.cc -pthread -o bench_convergence && ./bench_convergence
+//
+// Independent sampling's squared error falls as 1/spp, so a sampler with error e at n spp is
+// worth n * (e_independent / e)^2 independent samples. The reference's own noise puts a floor
+// under the error at high spp.
+
+#include "../src/rtweekend.h"
+
+#include "../src/camera.h"
+#include "../src/color.h"
+#include "../src/framebuffer.h"
+#include "../src/integrator.h"
+#include "../src/render.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soa.h"
+#include "../src/thread_pool.h"
+#include "../src/tiles.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+const int image_width = 96;
+const int image_height = 64;
+const int reference_spp = 2048;
+const int max_depth = 10;
+const int spp_steps[] = { 1, 4, 16, 64 };
+
+framebuffer render(sampler_type type, int spp, const hittable& world, const camera& cam, thread_pool& pool) {
+	render_sampler = type;
+	path_integrator integ(3);
+	framebuffer fb(image_width, image_height);
+	// One row per task; every pixel is seeded on its own so the split does not matter
+	pool.parallel_for(0, image_height, [&](int j) {
+		render_tile(tile{ 0, j, image_width, 1 }, fb, image_width, image_height, spp, max_depth, cam, world, integ);
+	});
+	return fb;
+}
+
+// Over the displayed (gamma 2, clamped) values
+double rmse(const framebuffer& a, const framebuffer& b) {
+	auto shown = [](double v) { return sqrt(clamp(v, 0.0, 1.0)); };
+	double sum = 0;
+	for (int j = 0; j < image_height; ++j)
+		for (int i = 0; i < image_width; ++i) {
+			color d = a.get(i, j), e = b.get(i, j);
+			for (int c = 0; c < 3; ++c) {
+				double x = shown(d[c]) - shown(e[c]);
+				sum += x * x;
+			}
+		}
+	return sqrt(sum / (3.0 * image_width * image_height));
+}
+
+void run(const char* name, const hittable& world, const camera& cam, thread_pool& pool) {
+	auto start = std::chrono::steady_clock::now();
+	framebuffer reference = render(sampler_type::independent, reference_spp, world, cam, pool);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("\n%s: reference %d spp in %.1f s\n", name, reference_spp, seconds);
+	std::printf("%-12s", "sampler");
+	for (int spp : spp_steps) std::printf(" %8d spp %8s", spp, "(equiv)");
+	std::printf("\n");
+
+	// Noise of independent sampling per spp, to convert errors into equivalent spp
+	std::vector<double> base;
+	for (int spp : spp_steps) {
+		rng_seed = 1; // a different stream from the reference
+		base.push_back(rmse(render(sampler_type::independent, spp, world, cam, pool), reference));
+	}
+
+	for (auto type : { sampler_type::independent, sampler_type::sobol, sampler_type::halton, sampler_type::blue_noise }) {
+		std::printf("%-12s", sampler_type_name(type));
+		for (size_t k = 0; k < std::size(spp_steps); ++k) {
+			rng_seed = 1;
+			double e = type == sampler_type::independent ? base[k]
+				: rmse(render(type, spp_steps[k], world, cam, pool), reference);
+			std::printf(" %12.5f %8.1f", e, spp_steps[k] * (base[k] / e) * (base[k] / e));
+		}
+		std::printf("\n");
+	}
+	rng_seed = 0;
+}
+
+int main() {
+	const auto aspect_ratio = 3.0 / 2.0;
+	thread_pool pool(std::thread::hardware_concurrency());
+
+	std::printf("%dx%d, max depth %d, RMSE of displayed values and equivalent independent spp\n",
+		image_width, image_height, max_depth);
+
+	run("scene1 (soa)", sphere_soa(scene1()), cam1(aspect_ratio), pool);
+	run("scene3 (soa)", sphere_soa(scene3()), cam3(aspect_ratio), pool);
+
+	pool.end();
+	render_sampler = sampler_type::independent;
+	return 0;
+}
@@ -0,0 +1,97 @@
+// Recursive ray_color against the iterative path integrator, with and without Russian roulette.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/integrator.cc -o bench_integrator && ./bench_integrator
+
+#include "../src/rtweekend.h"
+
+#include "../src/bvh.h"
+#include "../src/camera.h"
+#include "../src/color.h"
+#include "../src/integrator.h"
+#include "../src/render.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+const int image_width = 240;
+const int image_height = 160;
+const int samples_per_pixel = 32;
+const int max_depth = 10;
+
+// Forwards to the world and counts the rays cast into it
+class counting_world : public hittable {
+	public:
+		counting_world(const hittable& w) : world(w) {}
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			++rays;
+			return world.hit(r, t_min, t_max, rec);
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			return world.bounding_box(output_box);
+		}
+
+		const hittable& world;
+		mutable long rays = 0;
+};
+
+struct result {
+	double seconds;
+	long rays;
+	double mean_luminance;
+};
+
+result render(const hittable& world, const camera& cam, const integrator& integ) {
+	counting_world counted(world);
+	double total = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int j = 0; j < image_height; ++j) {
+		for (int i = 0; i < image_width; ++i) {
+			seed_thread_rng(pixel_stream(i, j, image_width));
+			for (int s = 0; s < samples_per_pixel; ++s)
+				total += luminance(trace_sample(i, j, s, image_width, image_height, max_depth, cam, counted, integ));
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double samples = double(image_width) * image_height * samples_per_pixel;
+	return { std::chrono::duration<double>(end - start).count(), counted.rays, total / samples };
+}
+
+void run(const char* name, const hittable& world, const camera& cam) {
+	recursive_integrator recursive;
+	path_integrator iterative(no_roulette);
+	path_integrator roulette(3);
+
+	result base = render(world, cam, recursive);
+	double samples = double(image_width) * image_height * samples_per_pixel;
+
+	for (auto [label, integ] : { std::pair<const char*, const integrator*>{ "recursive", &recursive },
+								 { "iterative", &iterative }, { "roulette from 3", &roulette } }) {
+		result r = integ == &recursive ? base : render(world, cam, *integ);
+		// The mean luminance should only move by noise: roulette is unbiased
+		std::printf("%-20s %-16s %10.2f %12.2f %10.2fx %12.4f %+10.2f%%\n",
+			name, label, r.seconds, r.rays / samples, base.seconds / r.seconds, r.mean_luminance,
+			100 * (r.mean_luminance - base.mean_luminance) / base.mean_luminance);
+	}
+}
+
+int main() {
+	const auto aspect_ratio = 3.0 / 2.0;
+
+	std::printf("%dx%d, %d spp, max depth %d\n", image_width, image_height, samples_per_pixel, max_depth);
+	std::printf("%-20s %-16s %10s %12s %11s %12s %11s\n",
+		"scene", "integrator", "time (s)", "rays/sample", "speedup", "mean lum", "vs recursive");
+
+	run("scene1 (soa)", sphere_soa(scene1()), cam1(aspect_ratio));
+	run("scene2 (soa)", sphere_soa(scene2()), cam2(aspect_ratio));
+	run("scene3 (soa)", sphere_soa(scene3()), cam3(aspect_ratio));
+	run("random_scene (bvh)", bvh(random_scene()), default_cam(aspect_ratio));
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+// Micro-benchmarks of the hot kernels on fixed-seed inputs: ns/op and, where perf_event_open
+// is allowed, cycles, instructions, branch and cache misses per op.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/kernels.cc -o bench_kernels && ./bench_kernels
+
+#include "../src/rtweekend.h"
+
+#include "../src/camera.h"
+#include "../src/color.h"
+#include "../src/framebuffer.h"
+#include "../src/hittable_list.h"
+#include "../src/image_writer.h"
+#include "../src/material.h"
+#include "../src/scenes.h"
+#include "../src/sphere.h"
+#include "microbench.h"
+
+#include <vector>
+
+// Inputs are cycled through with i & mask, so the working set stays in cache
+const long input_count = 4096;
+const long mask = input_count - 1;
+
+int main() {
+	const auto aspect_ratio = 3.0 / 2.0;
+	microbench mb;
+
+	// * INPUTS
+
+	seed_thread_rng(1);
+	hittable_list world = random_scene();
+	camera cam = default_cam(aspect_ratio);
+
+	std::vector<ray> camera_rays, sphere_rays;
+	std::vector<double> s(input_count), t(input_count);
+	for (long k = 0; k < input_count; ++k) {
+		s[k] = random_double();
+		t[k] = random_double();
+		camera_rays.push_back(cam.get_ray(s[k], t[k]));
+		// Aimed near the unit sphere at the origin: about two thirds hit
+		point3 from = 5.0 * random_unit_vector();
+		sphere_rays.emplace_back(from, (random_in_unit_sphere() * 1.2) - from);
+	}
+
+	auto unit_mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	sphere unit(point3(0, 0, 0), 1.0, unit_mat);
+
+	// Hit records for the scatter kernels, from the rays that hit
+	std::vector<ray> incoming;
+	std::vector<hit_record> recs;
+	for (const ray& r : sphere_rays) {
+		hit_record rec;
+		if (unit.hit(r, ray_t_min, infinity, rec)) {
+			incoming.push_back(r);
+			recs.push_back(rec);
+		}
+	}
+	const long rec_count = static_cast<long>(recs.size());
+
+	lambertian diffuse(color(0.5, 0.5, 0.5));
+	metal shiny(color(0.7, 0.6, 0.5), 0.3);
+	dielectric glass(1.5);
+
+	framebuffer fb(input_count, 1);
+	for (long k = 0; k < input_count; ++k)
+		fb.set(static_cast<int>(k), 0, color::random());
+
+	// * KERNELS
+
+	mb.run("sphere::hit", [&](long i) {
+		hit_record rec;
+		do_not_optimize(unit.hit(sphere_rays[i & mask], ray_t_min, infinity, rec));
+		do_not_optimize(rec.t);
+	});
+
+	mb.run("hittable_list::hit (random_scene)", [&](long i) {
+		hit_record rec;
+		do_not_optimize(world.hit(camera_rays[i & mask], ray_t_min, infinity, rec));
+		do_not_optimize(rec.t);
+	});
+
+	seed_thread_rng(2);
+	mb.run("camera::get_ray", [&](long i) {
+		ray r = cam.get_ray(s[i & mask], t[i & mask]);
+		do_not_optimize(r);
+	});
+
+	seed_thread_rng(3);
+	mb.run("random_in_unit_sphere", [&](long) {
+		vec3 v = random_in_unit_sphere();
+		do_not_optimize(v);
+	});
+
+	seed_thread_rng(4);
+	mb.run("random_unit_vector", [&](long) {
+		vec3 v = random_unit_vector();
+		do_not_optimize(v);
+	});
+
+	const material* materials[] = { &diffuse, &shiny, &glass };
+	const char* names[] = { "scatter (lambertian)", "scatter (metal)", "scatter (dielectric)" };
+	for (int m = 0; m < 3; ++m) {
+		seed_thread_rng(5 + m);
+		mb.run(names[m], [&](long i) {
+			long k = i % rec_count;
+			color attenuation;
+			ray scattered;
+			do_not_optimize(materials[m]->scatter(incoming[k], recs[k], attenuation, scattered));
+			do_not_optimize(scattered);
+		});
+	}
+
+	// write_color became quantize() per component plus encode_image() per image
+	mb.run("quantize (per pixel)", [&](long i) {
+		color c = fb.get(static_cast<int>(i & mask), 0);
+		uint8_t rgb[3] = { quantize(c.x()), quantize(c.y()), quantize(c.z()) };
+		do_not_optimize(rgb);
+	});
+
+	std::vector<uint8_t> encoded(encoded_size(fb, image_format::ppm));
+	mb.run("encode_image ppm (per pixel)", [&](long) {
+		encode_image(fb, image_format::ppm, encoded.data());
+		do_not_optimize(encoded.data());
+	}, input_count);
+
+	return 0;
+}
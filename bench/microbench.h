@@ -0,0 +1,182 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+// A small header-only harness for timing single kernels: ns per operation and,
+// where the kernel lets us read them, hardware counters per operation.
+//
+//	microbench mb;
+//	mb.run("sphere::hit", [&](long i) { do_not_optimize(s.hit(rays[i & mask], ...)); });
+//
+// Each benchmark is calibrated to run for about min_seconds per repetition; the
+// median repetition is reported. Counters come from perf_event_open on Linux
+// and are left out when it is unavailable (e.g. perf_event_paranoid > 2 or
+// inside some containers).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+inline void do_not_optimize(T const& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class perf_counters {
+	public:
+		enum { cycles, instructions, branch_misses, cache_misses, count }; // cache_misses: last level
+
+		perf_counters() {
+#if defined(__linux__)
+			const uint64_t configs[count] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+											  PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+			for (int k = 0; k < count; ++k) {
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[k];
+				attr.disabled = 1;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				fds[k] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			}
+#endif
+		}
+
+		~perf_counters() {
+			for (int fd : fds)
+				if (fd >= 0) close(fd);
+		}
+
+		perf_counters(const perf_counters&) = delete;
+		perf_counters& operator=(const perf_counters&) = delete;
+
+		bool available(int k) const { return fds[k] >= 0; }
+
+		void start() {
+#if defined(__linux__)
+			for (int fd : fds)
+				if (fd >= 0) {
+					ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+					ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+#endif
+		}
+
+		// Counts since start(); -1 for a counter that is not available
+		void stop(double out[count]) {
+			for (int k = 0; k < count; ++k) {
+				out[k] = -1;
+#if defined(__linux__)
+				uint64_t v;
+				if (fds[k] >= 0) {
+					ioctl(fds[k], PERF_EVENT_IOC_DISABLE, 0);
+					if (read(fds[k], &v, sizeof(v)) == sizeof(v)) out[k] = static_cast<double>(v);
+				}
+#endif
+			}
+		}
+
+	private:
+		int fds[count] = { -1, -1, -1, -1 };
+};
+
+struct microbench_result {
+	std::string name;
+	double ns_per_op;
+	double per_op[perf_counters::count]; // -1 where unavailable
+};
+
+class microbench {
+	public:
+		double min_seconds = 0.05; // per repetition
+		int repetitions = 5;
+
+		microbench() {
+			std::printf("%-34s %10s %9s %9s %7s %9s %9s\n",
+				"kernel", "ns/op", "cycles", "instr", "IPC", "br-miss", "llc-miss");
+			if (!counters.available(perf_counters::cycles))
+				std::printf("(hardware counters unavailable: check /proc/sys/kernel/perf_event_paranoid)\n");
+		}
+
+		// Times body(i) for i = 0, 1, 2, ...; each call is ops_per_call operations
+		template <typename F>
+		microbench_result run(const std::string& name, F&& body, long ops_per_call = 1) {
+			// Grow the call count until one repetition takes long enough
+			long calls = 1;
+			for (;;) {
+				double s = time_calls(body, calls);
+				if (s >= min_seconds) break;
+				calls = s > 0 ? std::max(calls * 2, static_cast<long>(calls * 1.2 * min_seconds / s)) : calls * 10;
+			}
+
+			std::vector<double> ns;
+			double total[perf_counters::count] = {};
+			for (int r = 0; r < repetitions; ++r) {
+				counters.start();
+				double s = time_calls(body, calls);
+				double c[perf_counters::count];
+				counters.stop(c);
+				ns.push_back(s * 1e9 / (double(calls) * ops_per_call));
+				for (int k = 0; k < perf_counters::count; ++k)
+					total[k] = c[k] < 0 || total[k] < 0 ? -1 : total[k] + c[k];
+			}
+			std::sort(ns.begin(), ns.end());
+
+			microbench_result result;
+			result.name = name;
+			result.ns_per_op = ns[ns.size() / 2];
+			double ops = double(calls) * ops_per_call * repetitions;
+			for (int k = 0; k < perf_counters::count; ++k)
+				result.per_op[k] = total[k] < 0 ? -1 : total[k] / ops;
+
+			print(result);
+			results.push_back(result);
+			return result;
+		}
+
+		std::vector<microbench_result> results;
+
+	private:
+		perf_counters counters;
+
+		template <typename F>
+		static double time_calls(F& body, long calls) {
+			auto start = std::chrono::steady_clock::now();
+			for (long i = 0; i < calls; ++i)
+				body(i);
+			auto end = std::chrono::steady_clock::now();
+			return std::chrono::duration<double>(end - start).count();
+		}
+
+		static void print(const microbench_result& r) {
+			auto counter = [](double v) {
+				if (v < 0) std::printf(" %9s", "-");
+				else std::printf(" %9.2f", v);
+			};
+			std::printf("%-34s %10.2f", r.name.c_str(), r.ns_per_op);
+			counter(r.per_op[perf_counters::cycles]);
+			counter(r.per_op[perf_counters::instructions]);
+			if (r.per_op[perf_counters::cycles] > 0 && r.per_op[perf_counters::instructions] >= 0)
+				std::printf(" %7.2f", r.per_op[perf_counters::instructions] / r.per_op[perf_counters::cycles]);
+			else
+				std::printf(" %7s", "-");
+			counter(r.per_op[perf_counters::branch_misses]);
+			counter(r.per_op[perf_counters::cache_misses]);
+			std::printf("\n");
+		}
+};
+
+#endif
@@ -0,0 +1,94 @@
+// Throughput of the packet/wavefront renderer against the scalar one-path-at-a-time renderer.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/packet.cc -o bench_packet && ./bench_packet
+
+#include "../src/rtweekend.h"
+
+#include "../src/bvh.h"
+#include "../src/camera.h"
+#include "../src/packet.h"
+#include "../src/render.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+const int image_width = 240;
+const int image_height = 160;
+const int samples_per_pixel = 16;
+const int max_depth = 10;
+const int tile_size = 8;
+
+double render_scalar(const hittable& world, const camera& cam, std::vector<color>& image) {
+	auto start = std::chrono::steady_clock::now();
+	for (int j = 0; j < image_height; ++j) {
+		for (int i = 0; i < image_width; ++i) {
+			seed_thread_rng(pixel_stream(i, j, image_width));
+			color pixel_color(0, 0, 0);
+			for (int s = 0; s < samples_per_pixel; ++s) {
+				auto u = (i + random_double()) / (image_width-1);
+				auto v = (j + random_double()) / (image_height-1);
+				pixel_color += ray_color(cam.get_ray(u, v), world, max_depth);
+			}
+			image[j*image_width + i] = pixel_color;
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+double render_packet(const hittable& world, const camera& cam, std::vector<color>& image, long& rays) {
+	packet_tracer tracer(world);
+	std::vector<color> tile;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int y0 = 0; y0 < image_height; y0 += tile_size) {
+		for (int x0 = 0; x0 < image_width; x0 += tile_size) {
+			int w = std::min(tile_size, image_width - x0);
+			int h = std::min(tile_size, image_height - y0);
+			tracer.render_tile(x0, y0, w, h, tile, image_width, image_height, samples_per_pixel, max_depth, cam);
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+					image[(y0 + y)*image_width + x0 + x] = tile[y*w + x];
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	rays = tracer.rays_traced();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+void run(const char* name, const hittable& world, const camera& cam) {
+	std::vector<color> scalar_image(image_width * image_height), packet_image(image_width * image_height);
+	long rays = 0;
+
+	double scalar_time = render_scalar(world, cam, scalar_image);
+	double packet_time = render_packet(world, cam, packet_image, rays);
+
+	double max_diff = 0;
+	for (size_t k = 0; k < scalar_image.size(); ++k)
+		for (int c = 0; c < 3; ++c)
+			max_diff = fmax(max_diff, fabs(scalar_image[k][c] - packet_image[k][c]) / samples_per_pixel);
+
+	// Both renderers follow the same paths, so they trace the same number of rays
+	std::printf("%-22s %12.2f %12.2f %14.0f %14.0f %8.2fx %12.2e\n",
+		name, scalar_time, packet_time, rays / scalar_time, rays / packet_time,
+		scalar_time / packet_time, max_diff);
+}
+
+int main() {
+	const auto aspect_ratio = 3.0 / 2.0;
+
+	std::printf("%dx%d, %d spp, %d lanes\n", image_width, image_height, samples_per_pixel, sphere_soa::lanes);
+	std::printf("%-22s %12s %12s %14s %14s %9s %12s\n",
+		"scene", "scalar (s)", "packet (s)", "scalar rays/s", "packet rays/s", "speedup", "max diff");
+
+	run("scene1 (soa)", sphere_soa(scene1()), cam1(aspect_ratio));
+	run("scene2 (soa)", sphere_soa(scene2()), cam2(aspect_ratio));
+	run("scene3 (soa)", sphere_soa(scene3()), cam3(aspect_ratio));
+	run("random_scene (bvh)", bvh(random_scene()), default_cam(aspect_ratio));
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+// Float against double: sphere intersection speed and agreement, and the difference between two
+// rendered images.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/precision.cc -o bench_precision && ./bench_precision
+//
+// To compare whole renders, build the renderer both ways and pass the two images:
+//   g++ -O3 -march=native ./src/main.cc -pthread -o render_double && ./render_double > double.ppm
+//   g++ -O3 -march=native -DRT_FLOAT ./src/main.cc -pthread -o render_float && ./render_float > float.ppm
+//   ./bench_precision double.ppm float.ppm
+// PFM output (output_path = "render.pfm") gives the diff without 8-bit quantization.
+
+#include "../src/rtweekend.h"
+
+#include "../src/camera.h"
+#include "../src/hittable_list.h"
+#include "../src/scenes.h"
+#include "../src/sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+const int ray_count = 1 << 18;
+
+template <typename T>
+struct sphere_set {
+	std::vector<vec3_t<T>> centers;
+	std::vector<T> radii;
+};
+
+template <typename T>
+sphere_set<T> spheres_of(const hittable_list& world) {
+	sphere_set<T> set;
+	for (const auto& object : world.objects) {
+		if (auto s = std::dynamic_pointer_cast<sphere>(object)) {
+			set.centers.push_back(vec3_t<T>(s->center));
+			set.radii.push_back(T(s->radius));
+		}
+	}
+	return set;
+}
+
+// Nearest hit per ray, -1 for a miss, and the time taken for all of them
+template <typename T>
+double nearest_hits(const sphere_set<T>& set, const std::vector<ray_t<T>>& rays, std::vector<T>& t_hit) {
+	t_hit.assign(rays.size(), T(-1));
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < rays.size(); ++k) {
+		T closest = T(infinity);
+		for (size_t i = 0; i < set.radii.size(); ++i) {
+			T t;
+			if (hit_sphere<T>(set.centers[i], set.radii[i], rays[k], T(ray_t_min), closest, t))
+				closest = t;
+		}
+		if (closest < T(infinity)) t_hit[k] = closest;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double>(end - start).count();
+}
+
+void run(const char* name, const hittable_list& world, const camera& cam) {
+	std::vector<ray_t<double>> rays_d;
+	std::vector<ray_t<float>> rays_f;
+	seed_thread_rng(1);
+	for (int k = 0; k < ray_count; ++k) {
+		ray r = cam.get_ray(random_double(), random_double());
+		rays_d.push_back(ray_t<double>(vec3_t<double>(r.origin()), vec3_t<double>(r.direction())));
+		rays_f.push_back(ray_t<float>(vec3_t<float>(r.origin()), vec3_t<float>(r.direction())));
+	}
+
+	std::vector<double> t_d;
+	std::vector<float> t_f;
+	double time_d = nearest_hits(spheres_of<double>(world), rays_d, t_d);
+	double time_f = nearest_hits(spheres_of<float>(world), rays_f, t_f);
+
+	long disagree = 0;
+	double max_rel = 0;
+	for (size_t k = 0; k < t_d.size(); ++k) {
+		if ((t_d[k] < 0) != (t_f[k] < 0))
+			++disagree;
+		else if (t_d[k] > 0)
+			max_rel = fmax(max_rel, fabs(t_f[k] - t_d[k]) / t_d[k]);
+	}
+
+	std::printf("%-14s %14.0f %14.0f %8.2fx %12ld %14.2e\n",
+		name, ray_count / time_d, ray_count / time_f, time_d / time_f, disagree, max_rel);
+}
+
+// Reads a binary PPM (P6) or a PFM into linear RGB floats, bottom row first
+bool read_image(const std::string& path, int& w, int& h, std::vector<float>& rgb) {
+	std::ifstream in(path, std::ios::binary);
+	std::string magic;
+	double scale;
+	if (!(in >> magic >> w >> h >> scale)) return false;
+	in.get();
+
+	size_t n = static_cast<size_t>(w) * h * 3;
+	rgb.resize(n);
+
+	if (magic == "PF") {
+		in.read(reinterpret_cast<char*>(rgb.data()), n * sizeof(float));
+		return static_cast<bool>(in);
+	}
+	if (magic != "P6") return false;
+
+	std::vector<unsigned char> bytes(n);
+	in.read(reinterpret_cast<char*>(bytes.data()), n);
+	// Undo the gamma 2 of quantize(), to the middle of each 8-bit step; rows top first
+	size_t row = static_cast<size_t>(w) * 3;
+	for (int r = 0; r < h; ++r)
+		for (size_t k = 0; k < row; ++k) {
+			double v = (bytes[r*row + k] + 0.5) / 256;
+			rgb[(h - 1 - r)*row + k] = static_cast<float>(v * v);
+		}
+	return static_cast<bool>(in);
+}
+
+int diff_images(const char* a_path, const char* b_path) {
+	int wa, ha, wb, hb;
+	std::vector<float> a, b;
+	if (!read_image(a_path, wa, ha, a) || !read_image(b_path, wb, hb, b)) {
+		std::fprintf(stderr, "Could not read the images.\n");
+		return 1;
+	}
+	if (wa != wb || ha != hb) {
+		std::fprintf(stderr, "Image sizes differ.\n");
+		return 1;
+	}
+
+	// Compared after the gamma 2 output curve, where 1/255 is one 8-bit step
+	double sq = 0, max_diff = 0;
+	long over_step = 0;
+	for (size_t k = 0; k < a.size(); ++k) {
+		double d = fabs(sqrt(fmax(a[k], 0.0f)) - sqrt(fmax(b[k], 0.0f)));
+		sq += d * d;
+		max_diff = fmax(max_diff, d);
+		if (d > 1.0 / 255) ++over_step;
+	}
+	double rmse = sqrt(sq / a.size());
+
+	std::printf("%dx%d\n", wa, ha);
+	std::printf("RMSE            %.6f (%.3f 8-bit steps)\n", rmse, rmse * 255);
+	std::printf("PSNR            %.2f dB\n", rmse > 0 ? 20 * log10(1 / rmse) : infinity);
+	std::printf("max difference  %.6f (%.1f 8-bit steps)\n", max_diff, max_diff * 255);
+	std::printf("over one step   %.4f%% of channels\n", 100.0 * over_step / a.size());
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc == 3)
+		return diff_images(argv[1], argv[2]);
+
+	const auto aspect_ratio = 3.0 / 2.0;
+
+	std::printf("%d camera rays per scene, nearest hit over every sphere\n", ray_count);
+	std::printf("%-14s %14s %14s %9s %12s %14s\n",
+		"scene", "double rays/s", "float rays/s", "speedup", "hit/miss", "max t rel err");
+
+	run("scene1", scene1(), cam1(aspect_ratio));
+	run("scene2", scene2(), cam2(aspect_ratio));
+	run("scene3", scene3(), cam3(aspect_ratio));
+	run("random_scene", random_scene(), default_cam(aspect_ratio));
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+// The closed-form samplers of vec3.h against the rejection samplers they replaced: random
+// numbers used per sample, time per sample, and chi-square tests that both produce the same
+// distribution.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/sampling.cc -o bench_sampling && ./bench_sampling
+//
+// Each sample is binned into equal-probability cells of the target distribution. The
+// goodness-of-fit test compares each sampler's histogram with the uniform expectation, the
+// two-sample test compares the old and new histograms with each other; p-values well above
+// 0.001 mean no detectable difference.
+
+#include "../src/rtweekend.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+const long sample_count = 2000000;
+const int bins_a = 20, bins_b = 20; // cells per sample: bins_a x bins_b
+
+// random_double() with a call counter
+struct counted_uniform {
+	long calls = 0;
+	double operator()() { ++calls; return random_double(); }
+	double operator()(double min, double max) { ++calls; return random_double(min, max); }
+};
+
+// * THE REJECTION SAMPLERS, AS THEY WERE
+
+vec3 old_disk(counted_uniform& u) {
+	while (true) {
+		vec3 p(u(-1, 1), u(-1, 1), 0);
+		if (p.length_squared() < 1) return p;
+	}
+}
+
+vec3 old_ball(counted_uniform& u) {
+	while (true) {
+		vec3 p(u(-1, 1), u(-1, 1), u(-1, 1));
+		if (p.length_squared() < 1) return p;
+	}
+}
+
+vec3 old_sphere(counted_uniform& u) {
+	return unit_vector(old_ball(u));
+}
+
+// Lambertian scattering around +z, normalized
+vec3 old_cosine(counted_uniform& u) {
+	return unit_vector(vec3(0, 0, 1) + old_sphere(u));
+}
+
+// * THE CLOSED-FORM SAMPLERS
+
+vec3 new_disk(counted_uniform& u) { double a = u(), b = u(); return sample_concentric_disk<real>(a, b); }
+vec3 new_ball(counted_uniform& u) { double a = u(), b = u(), c = u(); return sample_uniform_ball<real>(a, b, c); }
+vec3 new_sphere(counted_uniform& u) { double a = u(), b = u(); return sample_uniform_sphere<real>(a, b); }
+vec3 new_cosine(counted_uniform& u) { double a = u(), b = u(); return sample_cosine_hemisphere<real>(a, b); }
+
+// * CELLS
+// Each maps a sample to two coordinates that are independent and uniform in [0, 1) under the
+// target distribution.
+
+double azimuth(const vec3& p) { return (atan2(p.y(), p.x()) + pi) / (2 * pi); }
+
+void disk_cell(const vec3& p, double& a, double& b) { a = p.x()*p.x() + p.y()*p.y(); b = azimuth(p); }
+void sphere_cell(const vec3& p, double& a, double& b) { a = (p.z() + 1) / 2; b = azimuth(p); }
+// The ball's radius, cubed, is uniform; the direction is tested through the sphere
+void ball_cell(const vec3& p, double& a, double& b) { a = pow(p.length(), 3); b = (p.z() / p.length() + 1) / 2; }
+// Projected onto the disk, a cosine-weighted direction is uniform
+void cosine_cell(const vec3& p, double& a, double& b) { a = 1 - p.z()*p.z(); b = azimuth(p); }
+
+struct histogram {
+	std::vector<long> counts = std::vector<long>(bins_a * bins_b, 0);
+	double rng_per_sample, ns_per_sample;
+};
+
+template <typename Sampler, typename Cell>
+histogram run(Sampler sample, Cell cell) {
+	histogram h;
+	counted_uniform u;
+	std::vector<vec3> samples(sample_count);
+
+	auto start = std::chrono::steady_clock::now();
+	for (long k = 0; k < sample_count; ++k)
+		samples[k] = sample(u);
+	auto end = std::chrono::steady_clock::now();
+
+	for (const vec3& p : samples) {
+		double a, b;
+		cell(p, a, b);
+		int i = std::min(bins_a - 1, std::max(0, static_cast<int>(a * bins_a)));
+		int j = std::min(bins_b - 1, std::max(0, static_cast<int>(b * bins_b)));
+		++h.counts[i * bins_b + j];
+	}
+
+	h.rng_per_sample = double(u.calls) / sample_count;
+	h.ns_per_sample = std::chrono::duration<double, std::nano>(end - start).count() / sample_count;
+	return h;
+}
+
+// Upper tail of the chi-square distribution (Wilson-Hilferty, fine for the large df here)
+double chi_square_p(double chi2, int df) {
+	double k = 2.0 / (9.0 * df);
+	double z = (cbrt(chi2 / df) - (1 - k)) / sqrt(k);
+	return 0.5 * erfc(z / sqrt(2.0));
+}
+
+double goodness_of_fit(const histogram& h) {
+	double expected = double(sample_count) / h.counts.size(), chi2 = 0;
+	for (long c : h.counts) chi2 += (c - expected) * (c - expected) / expected;
+	return chi_square_p(chi2, static_cast<int>(h.counts.size()) - 1);
+}
+
+// Two-sample chi-square for equal sample sizes
+double same_distribution(const histogram& a, const histogram& b) {
+	double chi2 = 0;
+	int cells = 0;
+	for (size_t k = 0; k < a.counts.size(); ++k) {
+		long n = a.counts[k] + b.counts[k];
+		if (n == 0) continue;
+		chi2 += double(a.counts[k] - b.counts[k]) * (a.counts[k] - b.counts[k]) / n;
+		++cells;
+	}
+	return chi_square_p(chi2, cells - 1);
+}
+
+template <typename Old, typename New, typename Cell>
+void compare(const char* name, Old old_sampler, New new_sampler, Cell cell) {
+	seed_thread_rng(1);
+	histogram old_h = run(old_sampler, cell);
+	seed_thread_rng(2);
+	histogram new_h = run(new_sampler, cell);
+
+	std::printf("%-18s %8.3f %8.3f %9.2f %9.2f %10.4f %10.4f %10.4f\n", name,
+		old_h.rng_per_sample, new_h.rng_per_sample, old_h.ns_per_sample, new_h.ns_per_sample,
+		goodness_of_fit(old_h), goodness_of_fit(new_h), same_distribution(old_h, new_h));
+}
+
+int main() {
+	std::printf("%ld samples each, %dx%d equal-probability cells\n", sample_count, bins_a, bins_b);
+	std::printf("%-18s %8s %8s %9s %9s %10s %10s %10s\n", "sampler", "rng old", "rng new",
+		"ns old", "ns new", "p fit old", "p fit new", "p same");
+
+	compare("unit disk", old_disk, new_disk, disk_cell);
+	compare("unit sphere", old_sphere, new_sphere, sphere_cell);
+	compare("unit ball", old_ball, new_ball, ball_cell);
+	compare("cosine hemisphere", old_cosine, new_cosine, cosine_cell);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+// Thread scaling of every scene in scenes.h under several scheduling strategies: wall time,
+// rays/sec, speedup and parallel efficiency over repeated trials, with 95% confidence intervals.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/scaling.cc -pthread -o bench_scaling && ./bench_scaling
+//
+// Arguments: [max threads] [trials] [output prefix]. Thread counts go 1, 2, 4, ... up to max
+// threads (default: hardware threads); results are also written to <prefix>.csv and <prefix>.json
+// (default prefix "scaling").
+
+#include "../src/rtweekend.h"
+
+#include "../src/bvh.h"
+#include "../src/camera.h"
+#include "../src/framebuffer.h"
+#include "../src/integrator.h"
+#include "../src/json.h"
+#include "../src/render.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soa.h"
+#include "../src/thread_pool.h"
+#include "../src/tiles.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int image_width = 240;
+const int image_height = 160;
+const int samples_per_pixel = 16;
+const int max_depth = 10;
+
+// Forwards to the world and counts the rays cast into it
+class counting_world : public hittable {
+	public:
+		counting_world(const hittable& w) : world(w) {}
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			++rays;
+			return world.hit(r, t_min, t_max, rec);
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			return world.bounding_box(output_box);
+		}
+
+		const hittable& world;
+		mutable long rays = 0;
+};
+
+// How the image is cut into tasks for the pool
+enum class strategy {
+	rows,        // one task per row, as the renderer first did
+	static_rows, // one band of rows per thread, no balancing
+	tiles,       // 32x32 tiles in Hilbert order
+	split_tiles  // tiles, with the ones a pilot pass finds expensive split
+};
+
+const strategy strategies[] = { strategy::rows, strategy::static_rows, strategy::tiles, strategy::split_tiles };
+
+const char* strategy_name(strategy s) {
+	switch (s) {
+		case strategy::rows:        return "rows";
+		case strategy::static_rows: return "static_rows";
+		case strategy::tiles:       return "tiles";
+		case strategy::split_tiles: return "split_tiles";
+	}
+	return "?";
+}
+
+struct scene_case {
+	const char* name;
+	std::unique_ptr<hittable> world;
+	camera cam;
+};
+
+struct trial {
+	double seconds;
+	long rays;
+};
+
+trial render(const scene_case& sc, strategy s, int threads, thread_pool& p, const integrator& integ) {
+	std::atomic<long> rays{0};
+	framebuffer fb(image_width, image_height);
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<tile> tiles;
+	switch (s) {
+		case strategy::rows:
+			tiles = make_tiles(image_width, image_height, image_width, 1, tile_order::scanline);
+			break;
+		case strategy::static_rows:
+			tiles = make_tiles(image_width, image_height, image_width,
+							   (image_height + threads - 1) / threads, tile_order::scanline);
+			break;
+		case strategy::tiles:
+		case strategy::split_tiles:
+			tiles = make_tiles(image_width, image_height, 32, 32, tile_order::hilbert);
+			break;
+	}
+
+	if (s == strategy::split_tiles) {
+		std::vector<double> cost(tiles.size());
+		p.parallel_for(0, static_cast<int>(tiles.size()), [&](int k) {
+			cost[k] = estimate_tile_cost(tiles[k], image_width, image_height, max_depth, sc.cam, *sc.world, integ);
+		});
+		tiles = split_expensive_tiles(tiles, cost, 4.0, 8);
+	}
+
+	for (size_t k = 0; k < tiles.size(); ++k) {
+		p.add([&, k] {
+			counting_world counted(*sc.world);
+			render_tile(tiles[k], fb, image_width, image_height, samples_per_pixel, max_depth,
+						sc.cam, counted, integ);
+			rays += counted.rays;
+		});
+	}
+	p.wait();
+
+	auto end = std::chrono::steady_clock::now();
+	return { std::chrono::duration<double>(end - start).count(), rays.load() };
+}
+
+// Two-sided 95% Student t quantile for n - 1 degrees of freedom
+double t95(int n) {
+	static const double table[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+									2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093 };
+	int df = n - 1;
+	if (df < 1) return 0;
+	return df < 20 ? table[df] : 1.96;
+}
+
+struct stats {
+	double mean, stddev, ci95; // ci95: half-width of the interval around the mean
+};
+
+stats summarize(const std::vector<double>& xs) {
+	double mean = 0, sq = 0;
+	for (double x : xs) mean += x;
+	mean /= xs.size();
+	for (double x : xs) sq += (x - mean) * (x - mean);
+	double stddev = xs.size() > 1 ? sqrt(sq / (xs.size() - 1)) : 0;
+	return { mean, stddev, t95(static_cast<int>(xs.size())) * stddev / sqrt(double(xs.size())) };
+}
+
+struct row {
+	std::string scene, strategy;
+	int threads;
+	stats time;
+	double rays_per_sec, speedup, speedup_ci95, efficiency;
+};
+
+void write_csv(const std::string& path, const std::vector<row>& rows, int trials) {
+	std::ofstream out(path);
+	out << "scene,strategy,threads,trials,mean_s,stddev_s,ci95_s,rays_per_s,speedup,speedup_ci95,efficiency\n";
+	for (const row& r : rows)
+		out << r.scene << ',' << r.strategy << ',' << r.threads << ',' << trials << ','
+			<< r.time.mean << ',' << r.time.stddev << ',' << r.time.ci95 << ',' << r.rays_per_sec << ','
+			<< r.speedup << ',' << r.speedup_ci95 << ',' << r.efficiency << '\n';
+}
+
+void write_json(const std::string& path, const std::vector<row>& rows, int trials) {
+	std::ofstream out(path);
+	out << "{\n\t\"width\": " << image_width << ", \"height\": " << image_height
+		<< ", \"spp\": " << samples_per_pixel << ", \"max_depth\": " << max_depth
+		<< ", \"trials\": " << trials << ",\n\t\"results\": [\n";
+	for (size_t k = 0; k < rows.size(); ++k) {
+		const row& r = rows[k];
+		out << "\t\t{ \"scene\": " << json_quote(r.scene) << ", \"strategy\": " << json_quote(r.strategy)
+			<< ", \"threads\": " << r.threads
+			<< ", \"mean_s\": " << json_number(r.time.mean) << ", \"stddev_s\": " << json_number(r.time.stddev)
+			<< ", \"ci95_s\": " << json_number(r.time.ci95) << ", \"rays_per_s\": " << json_number(r.rays_per_sec)
+			<< ", \"speedup\": " << json_number(r.speedup) << ", \"speedup_ci95\": " << json_number(r.speedup_ci95)
+			<< ", \"efficiency\": " << json_number(r.efficiency) << (k + 1 < rows.size() ? " },\n" : " }\n");
+	}
+	out << "\t]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+	const int max_threads = argc > 1 ? std::atoi(argv[1])
+									 : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	const int trials = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+	const std::string prefix = argc > 3 ? argv[3] : "scaling";
+	const auto aspect_ratio = double(image_width) / image_height;
+
+	std::vector<int> thread_counts;
+	for (int n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+	thread_counts.push_back(max_threads);
+
+	std::vector<scene_case> scenes;
+	scenes.push_back({ "random_scene", std::make_unique<bvh>(random_scene()), default_cam(aspect_ratio) });
+	scenes.push_back({ "scene1", std::make_unique<sphere_soa>(scene1()), cam1(aspect_ratio) });
+	scenes.push_back({ "scene2", std::make_unique<sphere_soa>(scene2()), cam2(aspect_ratio) });
+	scenes.push_back({ "scene3", std::make_unique<sphere_soa>(scene3()), cam3(aspect_ratio) });
+
+	path_integrator integ;
+	std::vector<row> rows;
+
+	std::printf("%dx%d, %d spp, %d trials, 95%% confidence intervals\n",
+		image_width, image_height, samples_per_pixel, trials);
+	std::printf("%-14s %-12s %7s %20s %12s %18s %10s\n",
+		"scene", "strategy", "threads", "time (s)", "Mrays/s", "speedup", "efficiency");
+
+	for (const scene_case& sc : scenes) {
+		for (strategy s : strategies) {
+			stats base{};
+			for (int threads : thread_counts) {
+				thread_pool p(threads);
+				std::vector<double> seconds;
+				long rays = 0;
+
+				// One untimed run warms the caches and the pool
+				render(sc, s, threads, p, integ);
+				for (int t = 0; t < trials; ++t) {
+					trial r = render(sc, s, threads, p, integ);
+					seconds.push_back(r.seconds);
+					rays = r.rays;
+				}
+				p.end();
+
+				row r;
+				r.scene = sc.name;
+				r.strategy = strategy_name(s);
+				r.threads = threads;
+				r.time = summarize(seconds);
+				if (threads == 1) base = r.time;
+				r.rays_per_sec = rays / r.time.mean;
+				r.speedup = base.mean / r.time.mean;
+				// Relative errors of the two means add in quadrature
+				r.speedup_ci95 = r.speedup * sqrt(pow(base.ci95 / base.mean, 2) + pow(r.time.ci95 / r.time.mean, 2));
+				r.efficiency = r.speedup / threads;
+				rows.push_back(r);
+
+				std::printf("%-14s %-12s %7d %9.4f +- %7.4f %12.2f %8.2fx +- %5.2f %9.1f%%\n",
+					r.scene.c_str(), r.strategy.c_str(), threads, r.time.mean, r.time.ci95,
+					r.rays_per_sec / 1e6, r.speedup, r.speedup_ci95, 100 * r.efficiency);
+			}
+		}
+	}
+
+	write_csv(prefix + ".csv", rows, trials);
+	write_json(prefix + ".json", rows, trials);
+	std::printf("Wrote %s.csv and %s.json\n", prefix.c_str(), prefix.c_str());
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+// Loading a scene file: parsing the JSON text against mapping the binary cache, and building
+// the sphere_soa world from the loaded arrays.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/scene_load.cc -o bench_scene_load && ./bench_scene_load
+
+#include "../src/rtweekend.h"
+
+#include "../src/scene_file.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+const int repeats = 5;
+
+// n small random spheres over a few hundred materials, as a large scene file would hold
+scene_data random_spheres(size_t n) {
+	scene_data scene;
+	seed_thread_rng(7);
+	for (int m = 0; m < 256; ++m) {
+		double choose = random_double();
+		if (choose < 0.8) scene.materials.push_back(lambertian(color::random() * color::random()));
+		else if (choose < 0.95) scene.materials.push_back(metal(color::random(0.5, 1), random_double(0, 0.5)));
+		else scene.materials.push_back(dielectric(1.5));
+	}
+	for (size_t i = 0; i < n; ++i)
+		scene.add_sphere(point3(random_double(-500, 500), 0.2, random_double(-500, 500)), 0.2,
+						 static_cast<uint32_t>(random_double() * 256));
+	return scene;
+}
+
+template <typename F>
+double best_seconds(F f) {
+	double best = infinity;
+	for (int k = 0; k < repeats; ++k) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		auto end = std::chrono::steady_clock::now();
+		best = fmin(best, std::chrono::duration<double>(end - start).count());
+	}
+	return best;
+}
+
+bool same_scene(const scene_data& a, const scene_data& b) {
+	return a.size() == b.size() && a.materials.size() == b.materials.size()
+		&& a.cx == b.cx && a.cy == b.cy && a.cz == b.cz && a.radius == b.radius && a.mat == b.mat;
+}
+
+void run(size_t n) {
+	const std::string text_path = "bench_scene.json";
+	const std::string cache_path = text_path + ".cache";
+
+	scene_data scene = random_spheres(n);
+	{
+		std::ofstream out(text_path);
+		write_scene(out, scene);
+	}
+	std::remove(cache_path.c_str());
+
+	scene_data parsed, cached;
+	std::string error;
+
+	double parse = best_seconds([&] {
+		std::ifstream in(text_path, std::ios::binary);
+		std::stringstream text;
+		text << in.rdbuf();
+		if (!parse_scene(text.str(), parsed, error))
+			std::fprintf(stderr, "parse failed: %s\n", error.c_str());
+	});
+
+	write_scene_cache(cache_path, parsed, file_stamp(text_path));
+	double cache = best_seconds([&] {
+		if (!read_scene_cache(cache_path, file_stamp(text_path), cached))
+			std::fprintf(stderr, "cache read failed\n");
+	});
+
+	sphere_soa world;
+	double build = best_seconds([&] { build_world(cached, world); });
+
+	std::ifstream text_size(text_path, std::ios::binary | std::ios::ate);
+	std::ifstream cache_size(cache_path, std::ios::binary | std::ios::ate);
+
+	std::printf("%10zu %10.1f %10.1f %12.2f %12.2f %9.1fx %10.2f %6s\n",
+		n, text_size.tellg() / 1e6, cache_size.tellg() / 1e6, parse * 1e3, cache * 1e3,
+		parse / cache, build * 1e3, same_scene(parsed, cached) ? "yes" : "NO");
+
+	std::remove(text_path.c_str());
+	std::remove(cache_path.c_str());
+}
+
+int main() {
+	std::printf("best of %d loads\n", repeats);
+	std::printf("%10s %10s %10s %12s %12s %10s %10s %6s\n",
+		"spheres", "text MB", "cache MB", "parse ms", "cache ms", "speedup", "build ms", "same");
+
+	for (size_t n : { 1000, 10000, 100000, 1000000 })
+		run(n);
+
+	return 0;
+}
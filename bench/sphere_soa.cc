@@ -0,0 +1,61 @@
+// Rays/sec of the SIMD sphere_soa against hittable_list and bvh on the built-in scenes.
+//
+// Compile & Run: g++ -O3 -march=native ./bench/sphere_soa.cc -o bench_soa && ./bench_soa
+
+#include "../src/rtweekend.h"
+
+#include "../src/bvh.h"
+#include "../src/camera.h"
+#include "../src/hittable_list.h"
+#include "../src/scenes.h"
+#include "../src/sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+double trace(const hittable& world, const std::vector<ray>& rays, long& hits) {
+	hit_record rec;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& r : rays)
+		hits += world.hit(r, 0.001, infinity, rec);
+	auto end = std::chrono::steady_clock::now();
+	return rays.size() / std::chrono::duration<double>(end - start).count();
+}
+
+void run(const char* name, const hittable_list& world, const camera& cam) {
+	const int num_rays = 500000;
+
+	std::vector<ray> rays;
+	rays.reserve(num_rays);
+	for (int i = 0; i < num_rays; ++i)
+		rays.push_back(cam.get_ray(random_double(), random_double()));
+
+	bvh tree(world);
+	sphere_soa soa(world);
+
+	long list_hits = 0, bvh_hits = 0, soa_hits = 0;
+	double list_rate = trace(world, rays, list_hits);
+	double bvh_rate = trace(tree, rays, bvh_hits);
+	double soa_rate = trace(soa, rays, soa_hits);
+
+	std::printf("%-14s %8zu %14.0f %14.0f %14.0f %9.1fx %s\n",
+		name, world.objects.size(), list_rate, bvh_rate, soa_rate, soa_rate / list_rate,
+		(list_hits == bvh_hits && list_hits == soa_hits) ? "" : "(hit counts differ!)");
+}
+
+int main() {
+	const auto aspect_ratio = 3.0 / 2.0;
+
+	std::printf("SIMD lanes: %d\n", sphere_soa::lanes);
+	std::printf("%-14s %8s %14s %14s %14s %10s\n",
+		"scene", "objects", "list rays/s", "bvh rays/s", "soa rays/s", "soa/list");
+
+	seed_thread_rng(0);
+	run("random_scene", random_scene(), default_cam(aspect_ratio));
+	run("scene1", scene1(), cam1(aspect_ratio));
+	run("scene2", scene2(), cam2(aspect_ratio));
+	run("scene3", scene3(), cam3(aspect_ratio));
+
+	return 0;
+}
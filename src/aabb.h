@@ -0,0 +1,85 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <utility>
+
+class aabb {
+	public:
+		// Default box is empty, so expanding it by anything yields that thing
+		aabb()
+			: minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity)
+		{}
+
+		aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+		point3 min() const { return minimum; }
+		point3 max() const { return maximum; }
+
+		point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+		bool empty() const {
+			return minimum.x() > maximum.x()
+				|| minimum.y() > maximum.y()
+				|| minimum.z() > maximum.z();
+		}
+
+		void expand(const point3& p) {
+			for (int a = 0; a < 3; ++a) {
+				minimum[a] = fmin(minimum[a], p[a]);
+				maximum[a] = fmax(maximum[a], p[a]);
+			}
+		}
+
+		void expand(const aabb& box) {
+			for (int a = 0; a < 3; ++a) {
+				minimum[a] = fmin(minimum[a], box.minimum[a]);
+				maximum[a] = fmax(maximum[a], box.maximum[a]);
+			}
+		}
+
+		double surface_area() const {
+			if (empty()) return 0;
+			vec3 d = maximum - minimum;
+			return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+		}
+
+		int longest_axis() const {
+			vec3 d = maximum - minimum;
+			if (d.x() > d.y() && d.x() > d.z()) return 0;
+			return d.y() > d.z() ? 1 : 2;
+		}
+
+		bool hit(const ray& r, double t_min, double t_max) const {
+			vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+			return hit(r.origin(), inv_dir, t_min, t_max);
+		}
+
+		// Slab test with the reciprocal direction precomputed by the caller
+		bool hit(const point3& origin, const vec3& inv_dir, double t_min, double t_max) const {
+			for (int a = 0; a < 3; ++a) {
+				auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+				auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+				if (inv_dir[a] < 0.0)
+					std::swap(t0, t1);
+				t_min = t0 > t_min ? t0 : t_min;
+				t_max = t1 < t_max ? t1 : t_max;
+				if (t_max < t_min)
+					return false;
+			}
+			return true;
+		}
+
+	public:
+		point3 minimum;
+		point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+	aabb box = box0;
+	box.expand(box1);
+	return box;
+}
+
+#endif
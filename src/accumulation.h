@@ -0,0 +1,177 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include "color.h"
+#include "framebuffer.h"
+#include "rtweekend.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// Running per-pixel sums for progressive rendering.
+//
+// Every pass adds its samples to the sums; the image at any point is the sum
+// divided by the number of samples taken so far. The buffer can be saved
+// after a pass and loaded again to resume a killed render where it stopped.
+class accumulation_buffer {
+	public:
+		accumulation_buffer(int width, int height)
+			: w(width), h(height), pass_count(0),
+			  sum(static_cast<size_t>(width) * height * 3, 0.0),
+			  lum_sq(static_cast<size_t>(width) * height, 0.0),
+			  count(static_cast<size_t>(width) * height, 0)
+		{}
+
+		int width() const { return w; }
+		int height() const { return h; }
+
+		// Passes completed so far
+		int passes() const { return pass_count; }
+		void finish_pass() { ++pass_count; }
+
+		size_t index(int i, int j) const { return static_cast<size_t>(j) * w + i; }
+
+		// Called by the tile that owns pixel (i, j); tiles never share pixels.
+		// lum_sq_sum is the sum of the squared luminance of each sample, for
+		// variance estimates; callers that do not need those may leave it out.
+		void add(int i, int j, const color& sample_sum, uint32_t samples, double lum_sq_sum = 0) {
+			size_t k = index(i, j);
+			sum[3*k]     += sample_sum.x();
+			sum[3*k + 1] += sample_sum.y();
+			sum[3*k + 2] += sample_sum.z();
+			lum_sq[k] += lum_sq_sum;
+			count[k] += samples;
+		}
+
+		uint32_t samples(int i, int j) const { return count[index(i, j)]; }
+
+		uint64_t total_samples() const {
+			uint64_t total = 0;
+			for (uint32_t c : count) total += c;
+			return total;
+		}
+
+		// Unbiased sample variance of the luminance of pixel (i, j)
+		double luminance_variance(int i, int j) const {
+			size_t k = index(i, j);
+			if (count[k] < 2) return infinity;
+			double n = count[k];
+			double mean_lum = luminance(color(sum[3*k], sum[3*k + 1], sum[3*k + 2])) / n;
+			double var = (lum_sq[k] / n - mean_lum * mean_lum) * n / (n - 1);
+			return var > 0 ? var : 0;
+		}
+
+		color mean(int i, int j) const {
+			size_t k = index(i, j);
+			if (count[k] == 0) return color(0, 0, 0);
+			return color(sum[3*k], sum[3*k + 1], sum[3*k + 2]) / count[k];
+		}
+
+		void resolve(framebuffer& fb) const {
+			for (int j = 0; j < h; ++j)
+				for (int i = 0; i < w; ++i)
+					fb.set(i, j, mean(i, j));
+		}
+
+		// The fingerprint identifies the settings the sums were made with (seed,
+		// depth, scene, ...) so a file from a different render is never resumed.
+		bool save(const std::string& path, uint64_t fingerprint) const {
+			// Write a temporary file and rename it, so a kill mid-save keeps the old file
+			std::string tmp = path + ".tmp";
+			std::FILE* f = std::fopen(tmp.c_str(), "wb");
+			if (!f) return false;
+
+			file_header hdr;
+			std::memcpy(hdr.magic, file_magic, sizeof(hdr.magic));
+			hdr.width = w;
+			hdr.height = h;
+			hdr.passes = pass_count;
+			hdr.reserved = 0;
+			hdr.fingerprint = fingerprint;
+
+			bool ok = std::fwrite(&hdr, sizeof(hdr), 1, f) == 1
+				&& std::fwrite(sum.data(), sizeof(double), sum.size(), f) == sum.size()
+				&& std::fwrite(lum_sq.data(), sizeof(double), lum_sq.size(), f) == lum_sq.size()
+				&& std::fwrite(count.data(), sizeof(uint32_t), count.size(), f) == count.size();
+			ok = (std::fclose(f) == 0) && ok;
+
+			return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+		}
+
+		// Resumes from the file at path. No file leaves the buffer empty and
+		// returns true; a file that cannot be resumed returns false, with the
+		// reason in error, leaving the buffer untouched.
+		bool load(const std::string& path, uint64_t fingerprint, std::string& error) {
+			std::FILE* f = std::fopen(path.c_str(), "rb");
+			if (!f) {
+				if (errno == ENOENT) return true;
+				error = std::strerror(errno);
+				return false;
+			}
+
+			file_header hdr;
+			bool ok = std::fread(&hdr, sizeof(hdr), 1, f) == 1
+				&& std::memcmp(hdr.magic, file_magic, sizeof(hdr.magic)) == 0;
+			if (!ok) error = "not an accumulation file of this version";
+			else if (hdr.width != w || hdr.height != h)
+				error = "it is " + std::to_string(hdr.width) + "x" + std::to_string(hdr.height) + ", not "
+					+ std::to_string(w) + "x" + std::to_string(h);
+			else if (hdr.fingerprint != fingerprint)
+				error = "it was rendered with other settings";
+			ok = error.empty();
+
+			std::vector<double> new_sum(sum.size());
+			std::vector<double> new_lum_sq(lum_sq.size());
+			std::vector<uint32_t> new_count(count.size());
+			if (ok && !(std::fread(new_sum.data(), sizeof(double), new_sum.size(), f) == new_sum.size()
+					   && std::fread(new_lum_sq.data(), sizeof(double), new_lum_sq.size(), f) == new_lum_sq.size()
+					   && std::fread(new_count.data(), sizeof(uint32_t), new_count.size(), f) == new_count.size())) {
+				error = "the file is cut short";
+				ok = false;
+			}
+			std::fclose(f);
+
+			if (!ok) return false;
+
+			sum.swap(new_sum);
+			lum_sq.swap(new_lum_sq);
+			count.swap(new_count);
+			pass_count = hdr.passes;
+			return true;
+		}
+
+	private:
+		struct file_header {
+			char magic[8];
+			int32_t width, height;
+			int32_t passes;
+			int32_t reserved;
+			uint64_t fingerprint;
+		};
+
+		static constexpr char file_magic[8] = { 'R', 'T', 'A', 'C', 'C', 0, 0, 2 };
+
+		int w, h;
+		int pass_count;
+		std::vector<double> sum;
+		std::vector<double> lum_sq;
+		std::vector<uint32_t> count;
+};
+
+// Mixes render settings into a fingerprint for accumulation_buffer::save/load
+inline uint64_t settings_fingerprint(std::initializer_list<uint64_t> values) {
+	uint64_t x = 0;
+	uint64_t fp = 0;
+	for (uint64_t v : values) {
+		x ^= v;
+		fp ^= splitmix64(x);
+	}
+	return fp;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "rtweekend.h"
+
+#include "accumulation.h"
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "render.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Adaptive sampling on top of the accumulation buffer.
+//
+// Every pixel first gets min_spp samples. After that each pass only samples
+// pixels whose estimated error is still above the threshold, batch samples at
+// a time, up to max_spp. The error is the standard error of the pixel's mean
+// luminance as it shows up after the gamma 2 output curve, so dark pixels,
+// where the curve is steep, need relatively less noise than bright ones.
+
+struct adaptive_settings {
+	int min_spp;      // samples every pixel gets before it may stop
+	int max_spp;      // no pixel gets more than this
+	int batch;        // samples added per pass to a pixel that is still noisy
+	double threshold; // target error, in output units (1/255 is one 8-bit step)
+};
+
+// Estimated error of the displayed value of pixel (i, j)
+inline double pixel_error(const accumulation_buffer& acc, int i, int j) {
+	uint32_t n = acc.samples(i, j);
+	if (n < 2) return infinity;
+
+	double std_error = sqrt(acc.luminance_variance(i, j) / n);
+	double mean_lum = std::max(luminance(acc.mean(i, j)), 1e-4);
+
+	// d sqrt(x) = dx / (2 sqrt(x))
+	return std_error / (2 * sqrt(mean_lum));
+}
+
+// Samples pixel (i, j) gets in the next pass, 0 once it has converged
+inline int adaptive_samples(const accumulation_buffer& acc, int i, int j, const adaptive_settings& s) {
+	int n = static_cast<int>(acc.samples(i, j));
+	if (n < s.min_spp) return s.min_spp - n;
+	if (n >= s.max_spp) return 0;
+	if (pixel_error(acc, i, j) <= s.threshold) return 0;
+	return std::min(s.batch, s.max_spp - n);
+}
+
+// Fills in the samples each pixel of a tile wants in the next pass, in plan
+// (row-major over the image), and returns their sum, 0 meaning every pixel in
+// the tile has converged.
+inline uint64_t plan_tile_adaptive(const tile& t, const accumulation_buffer& acc, const adaptive_settings& s,
+								   std::vector<int>& plan) {
+	uint64_t wanted = 0;
+	for (int j = t.y0; j < t.y0 + t.h; ++j)
+		for (int i = t.x0; i < t.x0 + t.w; ++i) {
+			int n = adaptive_samples(acc, i, j, s);
+			plan[size_t(j) * acc.width() + i] = n;
+			wanted += n;
+		}
+	return wanted;
+}
+
+// Cuts a pass's plan down to budget samples, giving them to the noisiest
+// pixels first; pixels short of min_spp come before all others.
+inline void trim_adaptive_plan(const accumulation_buffer& acc, const adaptive_settings& s, uint64_t budget,
+							   std::vector<int>& plan) {
+	std::vector<std::pair<double, size_t>> order;
+	for (size_t k = 0; k < plan.size(); ++k) {
+		if (plan[k] == 0) continue;
+		int i = static_cast<int>(k % acc.width()), j = static_cast<int>(k / acc.width());
+		double e = acc.samples(i, j) < uint32_t(s.min_spp) ? infinity : pixel_error(acc, i, j);
+		order.emplace_back(-e, k);
+	}
+	std::sort(order.begin(), order.end());
+
+	for (const auto& o : order) {
+		int n = static_cast<int>(std::min<uint64_t>(plan[o.second], budget));
+		plan[o.second] = n;
+		budget -= n;
+	}
+}
+
+// Samples a tile's pixels as planned and returns the number of samples taken
+inline uint64_t render_tile_adaptive(const tile& t, int pass, accumulation_buffer& acc,
+									 const std::vector<int>& plan, int image_width, int image_height,
+									 int max_depth, const camera& cam, const hittable& world,
+									 const integrator& integ) {
+	uint64_t taken = 0;
+
+	for (int j = t.y0; j < t.y0 + t.h; ++j) {
+		for (int i = t.x0; i < t.x0 + t.w; ++i) {
+			int n = plan[size_t(j) * image_width + i];
+			if (n == 0) continue;
+
+			seed_thread_rng(pixel_stream(i, j, image_width, image_height, pass));
+			uint32_t first = acc.samples(i, j);
+			color sum(0, 0, 0);
+			double lum_sq = 0;
+			for (int k = 0; k < n; ++k) {
+				color c = trace_sample(i, j, first + k, image_width, image_height, max_depth, cam, world, integ);
+				double l = luminance(c);
+				sum += c;
+				lum_sq += l * l;
+			}
+			end_sample();
+			acc.add(i, j, sum, n, lum_sq);
+			taken += n;
+		}
+	}
+
+	return taken;
+}
+
+// Colours every pixel by the number of samples it took: blue for few,
+// through green and yellow, to red for max_spp
+inline void sample_heatmap(const accumulation_buffer& acc, int max_spp, framebuffer& fb) {
+	static const color ramp[] = {
+		color(0, 0, 0.5), color(0, 0.5, 1), color(0, 0.8, 0.2), color(1, 0.9, 0), color(1, 0, 0)
+	};
+	const int stops = sizeof(ramp) / sizeof(ramp[0]);
+
+	for (int j = 0; j < acc.height(); ++j) {
+		for (int i = 0; i < acc.width(); ++i) {
+			double x = clamp(double(acc.samples(i, j)) / max_spp, 0.0, 1.0) * (stops - 1);
+			int k = std::min(static_cast<int>(x), stops - 2);
+			double f = x - k;
+			color c = (1 - f) * ramp[k] + f * ramp[k + 1];
+			// The writers apply gamma 2, so store the square to get the ramp colours out
+			fb.set(i, j, c * c);
+		}
+	}
+}
+
+#endif
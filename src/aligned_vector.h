@@ -0,0 +1,35 @@
+#ifndef ALIGNED_VECTOR_H
+#define ALIGNED_VECTOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Minimal allocator so the SoA arrays start on a SIMD register boundary
+template <typename T, size_t Alignment = 64>
+struct aligned_allocator {
+	using value_type = T;
+
+	template <typename U> struct rebind { using other = aligned_allocator<U, Alignment>; };
+
+	aligned_allocator() = default;
+	template <typename U> aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+	T* allocate(size_t n) {
+		size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+		void* p = std::aligned_alloc(Alignment, bytes);
+		if (!p) throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, size_t) { std::free(p); }
+
+	template <typename U> bool operator==(const aligned_allocator<U, Alignment>&) const { return true; }
+	template <typename U> bool operator!=(const aligned_allocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "json.h"
+#include "scene_cache.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "sphere_soa.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Animation files: a camera path and moving spheres, for rendering a sequence
+// of frames of one scene.
+//
+//	{
+//		"frames": 96,
+//		"camera": [
+//			{ "frame": 0,  "lookfrom": [13, 2, 3], "lookat": [0, 0, 0] },
+//			{ "frame": 48, "lookfrom": [3, 2, 13] },
+//			{ "frame": 95, "lookfrom": [-13, 4, 3], "vfov": 30 }
+//		],
+//		"spheres": [ { "index": 3, "velocity": [0, 0.05, 0] } ]
+//	}
+//
+// A camera key sets only the fields it names; the others carry over from the
+// key before it, and the first key's from the scene. Between keys the camera
+// follows a Catmull-Rom spline through them, and it holds still before the
+// first key and after the last. Spheres are numbered in the scene's order
+// from 0, and velocities are in scene units per frame.
+
+struct camera_key {
+	int frame;
+	camera_settings cam;
+};
+
+struct sphere_motion {
+	uint32_t index;
+	vec3 velocity;
+};
+
+struct animation {
+	int frames = 0;
+	std::vector<camera_key> keys;       // by frame
+	std::vector<sphere_motion> moving;
+
+	// The camera at frame; the scene's if there are no keys
+	camera_settings camera_at(int frame, const camera_settings& scene_cam) const {
+		if (keys.empty()) return scene_cam;
+		if (frame <= keys.front().frame) return keys.front().cam;
+		if (frame >= keys.back().frame) return keys.back().cam;
+
+		size_t k = 1;
+		while (keys[k].frame < frame) ++k;
+		const camera_settings& p0 = keys[k > 1 ? k - 2 : 0].cam;
+		const camera_settings& p1 = keys[k - 1].cam;
+		const camera_settings& p2 = keys[k].cam;
+		const camera_settings& p3 = keys[std::min(k + 1, keys.size() - 1)].cam;
+		double u = double(frame - keys[k - 1].frame) / (keys[k].frame - keys[k - 1].frame);
+
+		auto spline = [u](auto a, auto b, auto c, auto d) {
+			return 0.5 * ((2 * b) + (c - a) * u + (2 * a - 5 * b + 4 * c - d) * (u * u)
+						  + (3 * b - a - 3 * c + d) * (u * u * u));
+		};
+		camera_settings cam;
+		cam.lookfrom = spline(p0.lookfrom, p1.lookfrom, p2.lookfrom, p3.lookfrom);
+		cam.lookat = spline(p0.lookat, p1.lookat, p2.lookat, p3.lookat);
+		cam.vup = spline(p0.vup, p1.vup, p2.vup, p3.vup);
+		cam.vfov = spline(p0.vfov, p1.vfov, p2.vfov, p3.vfov);
+		cam.aperture = std::max(0.0, spline(p0.aperture, p1.aperture, p2.aperture, p3.aperture));
+		cam.focus_dist = std::max(0.0, spline(p0.focus_dist, p1.focus_dist, p2.focus_dist, p3.focus_dist));
+		return cam;
+	}
+};
+
+// Parses an animation file for a scene with scene_cam and spheres spheres
+inline bool parse_animation(const std::string& text, const camera_settings& scene_cam, size_t spheres,
+							animation& a, std::string& error) {
+	using namespace scene_detail;
+
+	a = animation();
+	json_reader r(text);
+	std::string key, field;
+	camera_settings last = scene_cam;
+
+	if (r.begin_object()) {
+		while (r.next_key(key)) {
+			if (key == "frames") {
+				a.frames = static_cast<int>(r.number());
+			} else if (key == "camera") {
+				if (!r.begin_array()) break;
+				while (r.next_item()) {
+					camera_key k = { -1, last };
+					if (!r.begin_object()) break;
+					while (r.next_key(field)) {
+						if (field == "frame") k.frame = static_cast<int>(r.number());
+						else if (!read_camera_field(r, field, k.cam)) r.skip();
+					}
+					if (r.ok() && (k.frame < 0 || (!a.keys.empty() && k.frame <= a.keys.back().frame)))
+						r.fail("camera keys need increasing frame numbers");
+					a.keys.push_back(k);
+					last = k.cam;
+				}
+			} else if (key == "spheres") {
+				if (!r.begin_array()) break;
+				while (r.next_item()) {
+					double index = -1;
+					vec3 velocity;
+					if (!r.begin_object()) break;
+					while (r.next_key(field)) {
+						if (field == "index") index = r.number();
+						else if (field == "velocity") read_vec3(r, velocity);
+						else r.skip();
+					}
+					if (r.ok() && (index < 0 || index >= spheres))
+						r.fail("no sphere " + json_number(index) + " in the scene");
+					a.moving.push_back({ static_cast<uint32_t>(index), velocity });
+				}
+			} else {
+				r.skip();
+			}
+		}
+		if (r.ok() && !r.at_end()) r.fail("text after the animation");
+	}
+
+	error = r.error();
+	return r.ok();
+}
+
+inline bool load_animation(const std::string& path, const camera_settings& scene_cam, size_t spheres,
+						   animation& a, std::string& error) {
+	std::ifstream in(path, std::ios::binary);
+	std::stringstream text;
+	text << in.rdbuf();
+	if (!in) {
+		error = "cannot open " + path;
+		return false;
+	}
+	if (!parse_animation(text.str(), scene_cam, spheres, a, error)) {
+		error = path + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+// One copy of a scene's world that can be put at any frame of an animation.
+// It is built once, the same way scene_cache builds it; moving it only sets
+// the moved spheres' centres and refits the bvh.
+class animated_world {
+	public:
+		animated_world(const std::string& name, const scene_data& scene) {
+			if (scene_cache::wants_bvh(name, scene)) {
+				objects = scene_objects(scene);
+				tree = std::make_unique<bvh>(objects);
+			} else {
+				soa = std::make_unique<sphere_soa>();
+				build_world(scene, *soa);
+			}
+		}
+
+		const hittable& world() const {
+			if (tree) return *tree;
+			return *soa;
+		}
+
+		void move_to(const scene_data& scene, const animation& a, int frame) {
+			for (const sphere_motion& m : a.moving) {
+				size_t k = m.index;
+				point3 center = point3(scene.cx[k], scene.cy[k], scene.cz[k]) + double(frame) * m.velocity;
+				if (soa) soa->move_sphere(k, center);
+				else static_cast<sphere&>(*objects.objects[k]).center = center;
+			}
+			if (tree) tree->refit();
+		}
+
+	private:
+		hittable_list objects; // the bvh's spheres, in scene order
+		std::unique_ptr<bvh> tree;
+		std::unique_ptr<sphere_soa> soa;
+};
+
+// The output path of frame: {frame} in pattern becomes its four-digit number,
+// or without one the number goes before the extension. Standard output stays
+// standard output, with the frames one after another.
+inline std::string frame_path(const std::string& pattern, int frame) {
+	if (pattern.empty()) return pattern;
+	char number[16];
+	std::snprintf(number, sizeof(number), "%04d", frame);
+
+	std::string path = pattern;
+	auto at = path.find("{frame}");
+	if (at != std::string::npos) return path.replace(at, 7, number);
+
+	auto dot = path.rfind('.');
+	auto slash = path.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+	return path.insert(dot, std::string("_") + number);
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "rtweekend.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the objects of a hittable_list.
+//
+// The tree is built top-down with the binned surface area heuristic and then
+// stored depth-first in one flat array: an interior node's first child is the
+// next node, and it stores the index of its second child. Traversal uses a
+// small explicit stack instead of recursion.
+class bvh : public hittable {
+	public:
+		bvh() {}
+		bvh(const hittable_list& list) { build(list); }
+
+		void build(const hittable_list& list);
+
+		// Recomputes the boxes after the objects moved, keeping the tree. Far
+		// cheaper than build(), but traversal slows down the further objects
+		// move from where the tree was built.
+		void refit();
+
+		virtual bool hit(
+			const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+		virtual bool bounding_box(aabb& output_box) const override;
+
+		size_t node_count() const { return nodes.size(); }
+
+	private:
+		struct node {
+			aabb box;
+			uint32_t offset; // first primitive for leaves, second child for interior nodes
+			uint16_t count;  // number of primitives, zero for interior nodes
+			uint16_t axis;   // split axis, used to visit the nearer child first
+		};
+
+		struct build_prim {
+			aabb box;
+			point3 centroid;
+			uint32_t index;
+		};
+
+		static const int num_bins = 12;
+		static const int max_leaf_size = 4;
+		static const int max_depth = 64;
+		static const int max_sah_depth = 32; // median splits below this keep depth <= max_depth
+
+		std::vector<node> nodes;
+		std::vector<const hittable*> prims;        // in leaf order
+		std::vector<const hittable*> unbounded;    // tested linearly alongside the tree
+		std::vector<shared_ptr<hittable>> owned;   // keeps the objects alive
+
+		uint32_t build_recursive(
+			std::vector<build_prim>& bp, uint32_t begin, uint32_t end, int depth);
+		void make_leaf(node& n, std::vector<build_prim>& bp, uint32_t begin, uint32_t end);
+};
+
+void bvh::build(const hittable_list& list) {
+	nodes.clear();
+	prims.clear();
+	unbounded.clear();
+	owned = list.objects;
+
+	std::vector<build_prim> bp;
+	bp.reserve(owned.size());
+
+	for (uint32_t i = 0; i < owned.size(); ++i) {
+		aabb box;
+		if (owned[i]->bounding_box(box))
+			bp.push_back({box, box.centroid(), i});
+		else
+			unbounded.push_back(owned[i].get());
+	}
+
+	if (bp.empty()) return;
+
+	nodes.reserve(2 * bp.size());
+	prims.reserve(bp.size());
+	build_recursive(bp, 0, static_cast<uint32_t>(bp.size()), 0);
+}
+
+void bvh::make_leaf(node& n, std::vector<build_prim>& bp, uint32_t begin, uint32_t end) {
+	n.offset = static_cast<uint32_t>(prims.size());
+	n.count = static_cast<uint16_t>(end - begin);
+	n.axis = 0;
+	for (uint32_t i = begin; i < end; ++i)
+		prims.push_back(owned[bp[i].index].get());
+}
+
+uint32_t bvh::build_recursive(
+	std::vector<build_prim>& bp, uint32_t begin, uint32_t end, int depth) {
+	uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	aabb bounds, centroid_bounds;
+	for (uint32_t i = begin; i < end; ++i) {
+		bounds.expand(bp[i].box);
+		centroid_bounds.expand(bp[i].centroid);
+	}
+	nodes[index].box = bounds;
+
+	uint32_t n = end - begin;
+	int axis = centroid_bounds.longest_axis();
+	double extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+
+	if (n == 1 || (extent <= 0 && n <= UINT16_MAX)) {
+		make_leaf(nodes[index], bp, begin, end);
+		return index;
+	}
+
+	uint32_t mid = begin + n / 2;
+
+	if (extent > 0 && depth < max_sah_depth) {
+		// Find the cheapest binned split over all three axes
+		int best_axis = -1;
+		int best_bin = 0;
+		double best_cost = infinity;
+
+		for (int a = 0; a < 3; ++a) {
+			double lo = centroid_bounds.min()[a];
+			double width = centroid_bounds.max()[a] - lo;
+			if (width <= 0) continue;
+
+			aabb bin_box[num_bins];
+			uint32_t bin_count[num_bins] = {};
+			double scale = num_bins / width;
+
+			for (uint32_t i = begin; i < end; ++i) {
+				int b = std::min(num_bins - 1, static_cast<int>((bp[i].centroid[a] - lo) * scale));
+				bin_count[b]++;
+				bin_box[b].expand(bp[i].box);
+			}
+
+			// Sweep from the right to get the area and count of every right side
+			double right_area[num_bins - 1];
+			uint32_t right_count[num_bins - 1];
+			aabb acc;
+			uint32_t count = 0;
+			for (int b = num_bins - 1; b > 0; --b) {
+				acc.expand(bin_box[b]);
+				count += bin_count[b];
+				right_area[b - 1] = acc.surface_area();
+				right_count[b - 1] = count;
+			}
+
+			acc = aabb();
+			count = 0;
+			for (int b = 0; b < num_bins - 1; ++b) {
+				acc.expand(bin_box[b]);
+				count += bin_count[b];
+				if (count == 0 || right_count[b] == 0) continue;
+				double cost = acc.surface_area() * count + right_area[b] * right_count[b];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = a;
+					best_bin = b;
+				}
+			}
+		}
+
+		// Traversal cost relative to one intersection test is taken as 1
+		double split_cost = 1.0 + best_cost / bounds.surface_area();
+		if (n <= max_leaf_size && split_cost >= n) {
+			make_leaf(nodes[index], bp, begin, end);
+			return index;
+		}
+
+		double lo = centroid_bounds.min()[best_axis];
+		double scale = num_bins / (centroid_bounds.max()[best_axis] - lo);
+		auto it = std::partition(bp.begin() + begin, bp.begin() + end,
+			[=](const build_prim& p) {
+				int b = std::min(num_bins - 1, static_cast<int>((p.centroid[best_axis] - lo) * scale));
+				return b <= best_bin;
+			});
+		mid = static_cast<uint32_t>(it - bp.begin());
+		axis = best_axis;
+	} else if (extent > 0) {
+		// Too deep for the traversal stack, fall back to median splits
+		std::nth_element(bp.begin() + begin, bp.begin() + mid, bp.begin() + end,
+			[=](const build_prim& a, const build_prim& b) {
+				return a.centroid[axis] < b.centroid[axis];
+			});
+	}
+
+	build_recursive(bp, begin, mid, depth + 1);
+	uint32_t second = build_recursive(bp, mid, end, depth + 1);
+
+	nodes[index].offset = second;
+	nodes[index].count = 0;
+	nodes[index].axis = static_cast<uint16_t>(axis);
+
+	return index;
+}
+
+void bvh::refit() {
+	// Children come after their parent in the array, so one backwards sweep does it
+	for (size_t i = nodes.size(); i-- > 0;) {
+		node& n = nodes[i];
+		aabb box;
+		if (n.count > 0) {
+			for (uint32_t k = n.offset; k < n.offset + n.count; ++k) {
+				aabb b;
+				prims[k]->bounding_box(b);
+				box.expand(b);
+			}
+		} else {
+			box = nodes[i + 1].box;
+			box.expand(nodes[n.offset].box);
+		}
+		n.box = box;
+	}
+}
+
+bool bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	hit_record temp_rec;
+	bool hit_anything = false;
+	auto closest_so_far = t_max;
+
+	for (const auto object : unbounded) {
+		if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+			hit_anything = true;
+			closest_so_far = temp_rec.t;
+			rec = temp_rec;
+		}
+	}
+
+	if (nodes.empty()) return hit_anything;
+
+	const point3 origin = r.origin();
+	const vec3 dir = r.direction();
+	const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+	const bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+	uint32_t stack[max_depth];
+	int stack_size = 0;
+	uint32_t current = 0;
+
+	while (true) {
+		const node& n = nodes[current];
+		if (stats_enabled) thread_stats().box_tests += 1;
+
+		if (n.box.hit(origin, inv_dir, t_min, closest_so_far)) {
+			if (n.count > 0) {
+				for (uint32_t i = n.offset; i < n.offset + n.count; ++i) {
+					if (prims[i]->hit(r, t_min, closest_so_far, temp_rec)) {
+						hit_anything = true;
+						closest_so_far = temp_rec.t;
+						rec = temp_rec;
+					}
+				}
+				if (stack_size == 0) break;
+				current = stack[--stack_size];
+			} else if (dir_neg[n.axis]) {
+				stack[stack_size++] = current + 1;
+				current = n.offset;
+			} else {
+				stack[stack_size++] = n.offset;
+				current = current + 1;
+			}
+		} else {
+			if (stack_size == 0) break;
+			current = stack[--stack_size];
+		}
+	}
+
+	return hit_anything;
+}
+
+bool bvh::bounding_box(aabb& output_box) const {
+	if (nodes.empty() || !unbounded.empty()) return false;
+	output_box = nodes[0].box;
+	return true;
+}
+
+#endif
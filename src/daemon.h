@@ -0,0 +1,357 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "integrator.h"
+#include "net.h"
+#include "options.h"
+#include "packet.h"
+#include "render.h"
+#include "scene_cache.h"
+#include "thread_pool.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A long-running render service on a Unix socket.
+//
+// ./program --serve SOCKET keeps one thread pool and one scene cache alive;
+// ./program --submit SOCKET [options] sends its jobs there instead of
+// rendering them, and writes the images the daemon sends back. A client pays
+// neither for starting threads nor for building a scene the daemon has seen
+// before, so a small preview of a cached scene takes milliseconds.
+//
+// Jobs from any number of clients render at the same time, tile by tile: the
+// highest priority first, and jobs of equal priority in turn by samples
+// handed out. Each tile renders with its own job's seed and sampler, so an
+// image is the same as a one-shot render of the job on its own.
+
+enum class daemon_message : uint32_t {
+	job = 1, // client: daemon_settings() text
+	image,   // daemon: daemon_image, then width * height * 3 floats, top row first
+	failed   // daemon: error text
+};
+
+struct daemon_image {
+	int32_t width, height;
+	double queued_seconds, render_seconds;
+};
+
+// The options of o that the daemon renders with, as job_settings() lines
+inline std::string daemon_settings(const render_options& o) {
+	return job_settings(o)
+		+ "tile=" + std::to_string(o.tile_width) + "x" + std::to_string(o.tile_height) + "\n"
+		+ "order=" + tile_order_name(o.order) + "\n"
+		+ "priority=" + std::to_string(o.priority) + "\n";
+}
+
+// A job inside the daemon, from submission until its last tile is done
+struct daemon_job {
+	daemon_job(const render_options& options, std::shared_ptr<const loaded_scene> s, const camera& c)
+		: o(options), scene(std::move(s)), cam(c), integ(options.roulette_start),
+		  tiles(make_tiles(o.image_width, o.height(), o.tile_width, o.tile_height, o.order)),
+		  fb(o.image_width, o.height()), remaining(tiles.size()) {}
+
+	render_options o;
+	std::shared_ptr<const loaded_scene> scene;
+	camera cam;
+	path_integrator integ;
+	std::vector<tile> tiles;
+	framebuffer fb;
+
+	// Guarded by the scheduler's lock
+	size_t next = 0;      // next tile to hand out
+	size_t remaining;     // tiles not finished
+	uint64_t served = 0;  // samples handed out, for the fair share
+	std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now(), started;
+};
+
+// Feeds the tiles of every running job to one pool. Only a couple of tiles per
+// thread are queued in the pool at a time, so a new job starts within about a
+// tile's time however much work is ahead of it.
+class job_scheduler {
+	public:
+		explicit job_scheduler(thread_pool& p) : pool(p), limit(2 * p.size()) {}
+
+		// Renders job and returns once all of its tiles are done
+		void run(daemon_job& job) {
+			// Nothing to hand out; dispatch() must never see a job without tiles
+			if (job.tiles.empty()) {
+				job.started = std::chrono::steady_clock::now();
+				return;
+			}
+
+			std::unique_lock<std::mutex> l(lock);
+			// Level with the jobs it competes with, rather than owed their past
+			for (daemon_job* j : jobs)
+				if (j->o.priority == job.o.priority && (job.served == 0 || j->served < job.served))
+					job.served = j->served;
+			jobs.push_back(&job);
+			dispatch(l);
+			finished.wait(l, [&] { return job.remaining == 0; });
+		}
+
+	private:
+		thread_pool& pool;
+		const int limit;
+		int in_flight = 0;
+		std::vector<daemon_job*> jobs;
+		std::mutex lock;
+		std::condition_variable finished;
+
+		// The highest priority, then the least served, then the oldest
+		daemon_job* pick() const {
+			daemon_job* best = nullptr;
+			for (daemon_job* j : jobs)
+				if (!best || j->o.priority > best->o.priority
+					|| (j->o.priority == best->o.priority && j->served < best->served))
+					best = j;
+			return best;
+		}
+
+		// Tops the pool up to limit tiles. Called with the lock held; the tiles
+		// are added after releasing it, as add() may run one right away.
+		void dispatch(std::unique_lock<std::mutex>& l) {
+			std::vector<std::pair<daemon_job*, size_t>> ready;
+			for (; in_flight < limit; ++in_flight) {
+				daemon_job* j = pick();
+				if (!j) break;
+				size_t k = j->next++;
+				if (k == 0) j->started = std::chrono::steady_clock::now();
+				j->served += static_cast<uint64_t>(j->tiles[k].w) * j->tiles[k].h * j->o.samples_per_pixel;
+				if (j->next == j->tiles.size())
+					jobs.erase(std::find(jobs.begin(), jobs.end(), j));
+				ready.emplace_back(j, k);
+			}
+
+			l.unlock();
+			for (auto [j, k] : ready)
+				pool.add([this, j = j, k = k] { render(*j, k); });
+			l.lock();
+		}
+
+		void render(daemon_job& j, size_t k) {
+			job_rng_seed = j.o.seed;
+			job_sampler = j.o.sampler;
+			const render_options& o = j.o;
+			if (o.packet_mode)
+				render_tile_packet(j.tiles[k], j.fb, o.packet_size, o.image_width, o.height(),
+								   o.samples_per_pixel, o.max_depth, j.cam, *j.scene->world, j.integ);
+			else
+				render_tile(j.tiles[k], j.fb, o.image_width, o.height(),
+							o.samples_per_pixel, o.max_depth, j.cam, *j.scene->world, j.integ);
+			job_rng_seed.reset();
+			job_sampler.reset();
+
+			// j may be gone as soon as the lock is released after its last tile
+			std::unique_lock<std::mutex> l(lock);
+			--in_flight;
+			if (--j.remaining == 0) finished.notify_all();
+			dispatch(l);
+		}
+};
+
+namespace daemon_detail {
+
+	inline volatile std::sig_atomic_t stop_requested = 0;
+
+	inline void request_stop(int) { stop_requested = 1; }
+
+	inline double seconds(std::chrono::steady_clock::duration d) {
+		return std::chrono::duration<double>(d).count();
+	}
+
+	// Renders the jobs one client sends until it disconnects
+	inline void serve_client(int fd, scene_cache& scenes, job_scheduler& scheduler, std::atomic<uint64_t>& jobs_served) {
+		net_message m;
+		while (read_message(fd, m) && m.type == static_cast<uint32_t>(daemon_message::job)) {
+			auto failed = [&](const std::string& error) {
+				std::cerr << "Job failed: " << error << "\n";
+				return send_message(fd, static_cast<uint32_t>(daemon_message::failed), error);
+			};
+
+			render_options o;
+			std::string error;
+			if (!apply_job_settings(std::string(m.payload.begin(), m.payload.end()), o, error)) {
+				if (!failed(error)) return;
+				continue;
+			}
+			if (o.height() < 1) {
+				if (!failed("the image is less than one pixel high")) return;
+				continue;
+			}
+			auto scene = scenes.get(o.scene, error);
+			if (!scene) {
+				if (!failed("could not load the scene: " + error)) return;
+				continue;
+			}
+
+			camera_settings cs = scene->cam;
+			o.camera.apply(cs);
+			daemon_job job(o, std::move(scene), cs.make(o.aspect()));
+			scheduler.run(job);
+			auto end = std::chrono::steady_clock::now();
+
+			daemon_image head = { o.image_width, o.height(),
+								  seconds(job.started - job.submitted), seconds(end - job.started) };
+			std::cerr << "Job " << ++jobs_served << ": " << o.scene << " " << head.width << "x" << head.height
+					  << " at " << o.samples_per_pixel << " spp, priority " << o.priority << ", queued "
+					  << head.queued_seconds * 1e3 << " ms, rendered in " << head.render_seconds * 1e3 << " ms\n";
+
+			std::vector<uint8_t> reply(sizeof(head) + 3 * sizeof(float) * static_cast<size_t>(head.width) * head.height);
+			std::memcpy(reply.data(), &head, sizeof(head));
+			std::memcpy(reply.data() + sizeof(head), job.fb.data(), reply.size() - sizeof(head));
+			if (!send_message(fd, static_cast<uint32_t>(daemon_message::image), reply.data(), reply.size()))
+				return;
+		}
+	}
+
+} // namespace daemon_detail
+
+// Runs the render daemon on the Unix socket at path until SIGINT or SIGTERM.
+// Clients still connected then get the jobs they sent before it stops.
+inline int run_daemon(const std::string& path, int threads) {
+	using namespace daemon_detail;
+
+	std::string error;
+	int listen_fd = listen_unix(path, error);
+	if (listen_fd < 0) {
+		std::cerr << "Could not start the daemon: " << error << "\n";
+		return 1;
+	}
+
+	// Without SA_RESTART, so that accept() returns to check the flag
+	struct sigaction sa = {};
+	sa.sa_handler = request_stop;
+	::sigaction(SIGINT, &sa, nullptr);
+	::sigaction(SIGTERM, &sa, nullptr);
+
+	std::cerr << "Render daemon on " << path << " with " << threads << " threads.\n";
+	thread_pool p(threads);
+	scene_cache scenes;
+	job_scheduler scheduler(p);
+	std::atomic<uint64_t> jobs_served(0);
+
+	std::mutex clients_lock;
+	std::condition_variable clients_done;
+	std::set<int> clients;
+
+	while (!stop_requested) {
+		int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			std::cerr << "Could not accept a client: " << std::strerror(errno) << "\n";
+			break;
+		}
+		{
+			std::lock_guard<std::mutex> l(clients_lock);
+			clients.insert(fd);
+		}
+		std::thread([&, fd] {
+			serve_client(fd, scenes, scheduler, jobs_served);
+			std::lock_guard<std::mutex> l(clients_lock);
+			::close(fd);
+			clients.erase(fd);
+			clients_done.notify_all();
+		}).detach();
+	}
+
+	::close(listen_fd);
+	::unlink(path.c_str());
+
+	// No more jobs: a client waiting to send one sees the end of the stream
+	std::unique_lock<std::mutex> l(clients_lock);
+	for (int fd : clients) ::shutdown(fd, SHUT_RD);
+	clients_done.wait(l, [&] { return clients.empty(); });
+	l.unlock();
+
+	p.end();
+	std::cerr << "Rendered " << jobs_served << " jobs.\n";
+	return 0;
+}
+
+// Renders jobs on the daemon at path and writes their images. Returns the
+// number of jobs that failed.
+inline size_t submit_jobs(const std::string& path, std::vector<render_options> jobs) {
+	std::string error;
+	int fd = connect_unix(path, error);
+	if (fd < 0) {
+		std::cerr << "Could not reach the daemon: " << error << "\n";
+		return jobs.size();
+	}
+
+	// Scene files are opened by the daemon, which may run somewhere else
+	char cwd[4096];
+	std::string dir = ::getcwd(cwd, sizeof(cwd)) ? cwd : "";
+
+	size_t failed = 0;
+	net_message m;
+	for (size_t k = 0; k < jobs.size(); ++k) {
+		render_options& o = jobs[k];
+		if (jobs.size() > 1)
+			std::cerr << "Job " << k + 1 << " of " << jobs.size() << ": " << o.scene << " to "
+					  << (o.output_path.empty() ? "standard output" : o.output_path) << "\n";
+		if (o.progressive || o.adaptive || o.stream || !o.tiled_path.empty() || o.animated()) {
+			std::cerr << "The daemon renders one-shot images only, not progressive, adaptive, streamed, tiled or animated.\n";
+			++failed;
+			continue;
+		}
+		if (!scene_cache::builtin(o.scene) && o.scene[0] != '/' && !dir.empty())
+			o.scene = dir + "/" + o.scene;
+
+		if (!send_message(fd, static_cast<uint32_t>(daemon_message::job), daemon_settings(o))
+			|| !read_message(fd, m)) {
+			std::cerr << "Lost the connection to the daemon.\n";
+			::close(fd);
+			return failed + jobs.size() - k;
+		}
+
+		if (m.type != static_cast<uint32_t>(daemon_message::image) || m.payload.size() < sizeof(daemon_image)) {
+			std::cerr << "The daemon could not render the job: " << std::string(m.payload.begin(), m.payload.end()) << "\n";
+			++failed;
+			continue;
+		}
+
+		daemon_image head;
+		std::memcpy(&head, m.payload.data(), sizeof(head));
+		framebuffer fb(head.width, head.height);
+		size_t bytes = 3 * sizeof(float) * static_cast<size_t>(head.width) * head.height;
+		if (m.payload.size() != sizeof(head) + bytes) {
+			std::cerr << "The daemon sent a damaged image.\n";
+			++failed;
+			continue;
+		}
+		std::memcpy(fb.data(), m.payload.data() + sizeof(head), bytes);
+
+		std::cerr << "Rendered by the daemon in " << head.render_seconds * 1e3 << " ms after "
+				  << head.queued_seconds * 1e3 << " ms in the queue.\n";
+		if (!write_image(fb, o.output_format, o.output_path)) {
+			std::cerr << "Could not write " << (o.output_path.empty() ? "image" : o.output_path) << ".\n";
+			++failed;
+		}
+	}
+
+	::close(fd);
+	return failed;
+}
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "net.h"
+#include "options.h"
+#include "packet.h"
+#include "render.h"
+#include "scene_cache.h"
+#include "thread_pool.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Rendering one image across several processes.
+//
+// The coordinator, the process asked for the image, cuts it into the usual
+// tiles and hands them to worker processes: local ones it starts itself over
+// Unix socket pairs (--workers N), and others that connect over TCP
+// (--listen on the coordinator, --worker HOST:PORT on each worker). Workers
+// load the scene themselves, render each tile with their own thread pool and
+// send back its float pixels, which the coordinator puts into the
+// framebuffer.
+//
+// Every pixel is seeded from its own position, so which process renders a
+// tile does not change it, and the merged image is byte-identical to a
+// single-process render. That also keeps recovery simple: when a worker's
+// connection drops, its unfinished tiles go back into the queue for the
+// others, and once no worker is left the coordinator renders the rest itself.
+//
+// Requests, results and pixels go over the wire in the sender's byte order, so
+// a worker must share the coordinator's; it says which it has when it is ready.
+
+enum class farm_message : uint32_t {
+	job = 1, // coordinator: job_settings() text
+	ready,   // worker: the scene is loaded; int32 threads, uint32 byte_order_mark
+	failed,  // worker: cannot render this job; error text
+	tile,    // coordinator: tile_request
+	result,  // worker: tile_result, then w * h * 3 floats, rows from y0 up
+	quit     // coordinator: no more jobs
+};
+
+// Reads back as itself only on a machine of the same byte order
+const uint32_t byte_order_mark = 0x01020304;
+
+struct tile_request {
+	int32_t id, x0, y0, w, h;
+};
+
+struct tile_result {
+	tile_request tile;
+	int32_t reserved;
+	double seconds;
+};
+
+// Serves the coordinator on fd until it quits or the connection drops
+inline int serve_coordinator(int fd, int threads) {
+	thread_pool p(threads);
+	scene_cache scenes;
+	std::mutex send_lock;
+
+	render_options o;
+	std::shared_ptr<const loaded_scene> scene;
+	std::unique_ptr<camera> cam;
+	path_integrator integ;
+
+	auto send = [&](farm_message type, const void* data, size_t len) {
+		std::lock_guard<std::mutex> l(send_lock);
+		return send_message(fd, static_cast<uint32_t>(type), data, len);
+	};
+
+	auto render = [&](tile_request req) {
+		tile t = { req.x0, req.y0, req.w, req.h };
+		std::vector<uint8_t> out(sizeof(tile_result) + 3 * sizeof(float) * static_cast<size_t>(t.w) * t.h);
+		float* pixels = reinterpret_cast<float*>(out.data() + sizeof(tile_result));
+
+		auto start = std::chrono::steady_clock::now();
+		auto sink = [&](int i, int j, const color& sum) {
+			color c = sum / o.samples_per_pixel;
+			float* px = pixels + 3 * (static_cast<size_t>(j - t.y0) * t.w + (i - t.x0));
+			px[0] = static_cast<float>(c.x());
+			px[1] = static_cast<float>(c.y());
+			px[2] = static_cast<float>(c.z());
+		};
+		if (o.packet_mode)
+			render_tile_packet_samples(t, 0, 0, o.packet_size, o.image_width, o.height(),
+									   o.samples_per_pixel, o.max_depth, *cam, *scene->world, integ, sink);
+		else
+			render_tile_samples(t, 0, 0, o.image_width, o.height(),
+								o.samples_per_pixel, o.max_depth, *cam, *scene->world, integ, sink);
+
+		tile_result head = { req, 0, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+		std::memcpy(out.data(), &head, sizeof(head));
+		send(farm_message::result, out.data(), out.size());
+	};
+
+	net_message m;
+	while (read_message(fd, m)) {
+		auto type = static_cast<farm_message>(m.type);
+
+		if (type == farm_message::job) {
+			p.wait(); // tiles of the last job still use its settings
+			o = render_options();
+			std::string error;
+			scene = nullptr;
+			if (apply_job_settings(std::string(m.payload.begin(), m.payload.end()), o, error))
+				scene = scenes.get(o.scene, error);
+			if (!scene) {
+				send(farm_message::failed, error.data(), error.size());
+				continue;
+			}
+
+			camera_settings cs = scene->cam;
+			o.camera.apply(cs);
+			cam = std::make_unique<camera>(cs.make(o.aspect()));
+			rng_seed = o.seed;
+			render_sampler = o.sampler;
+			integ = path_integrator(o.roulette_start);
+
+			int32_t ready[2] = { threads, static_cast<int32_t>(byte_order_mark) };
+			send(farm_message::ready, ready, sizeof(ready));
+		} else if (type == farm_message::tile && scene && m.payload.size() == sizeof(tile_request)) {
+			tile_request req;
+			std::memcpy(&req, m.payload.data(), sizeof(req));
+			p.add([&render, req] { render(req); });
+		} else if (type == farm_message::quit) {
+			break;
+		}
+	}
+
+	p.wait();
+	p.end();
+	::close(fd);
+	return 0;
+}
+
+// Runs this process as a worker for the coordinator at address: HOST:PORT,
+// or fd:N for a socket inherited from a coordinator that started us
+inline int run_worker(const std::string& address, int threads) {
+	int fd;
+	if (address.compare(0, 3, "fd:") == 0) {
+		fd = std::atoi(address.c_str() + 3);
+	} else {
+		std::string error;
+		fd = connect_tcp(address, error);
+		if (fd < 0) {
+			std::cerr << "Could not reach the coordinator: " << error << "\n";
+			return 1;
+		}
+		std::cerr << "Rendering tiles for " << address << " with " << threads << " threads.\n";
+	}
+	return serve_coordinator(fd, threads);
+}
+
+// The coordinator's side: the workers, and handing them the tiles of a job
+class render_farm {
+	public:
+		render_farm() {}
+
+		~render_farm() {
+			for (auto& w : workers) {
+				send_message(w.fd, static_cast<uint32_t>(farm_message::quit), nullptr, 0);
+				close_worker(w);
+			}
+			if (listen_fd >= 0) ::close(listen_fd);
+		}
+
+		render_farm(const render_farm&) = delete;
+		render_farm& operator=(const render_farm&) = delete;
+
+		// Starts n worker processes of this program with threads threads each.
+		// This forks, so call it before the process starts any threads.
+		bool spawn(int n, int threads, std::string& error) {
+			for (int k = 0; k < n; ++k) {
+				int sv[2];
+				if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+					error = std::string("cannot create a socket pair: ") + std::strerror(errno);
+					return false;
+				}
+
+				pid_t pid = ::fork();
+				if (pid == 0) {
+					// The child keeps its end open across exec by duplicating it without CLOEXEC
+					int fd = ::dup(sv[1]);
+					std::string address = "fd:" + std::to_string(fd), t = std::to_string(threads);
+					::execl("/proc/self/exe", "worker", "--worker", address.c_str(), "--threads", t.c_str(),
+							static_cast<char*>(nullptr));
+					::_exit(127);
+				}
+				::close(sv[1]);
+				if (pid < 0) {
+					::close(sv[0]);
+					error = std::string("cannot start a worker: ") + std::strerror(errno);
+					return false;
+				}
+				workers.emplace_back(sv[0], pid, "worker " + std::to_string(k + 1));
+			}
+			return true;
+		}
+
+		// Accepts workers on address from now on
+		bool listen(const std::string& address, std::string& error) {
+			listen_fd = listen_tcp(address, error);
+			listen_address = address;
+			return listen_fd >= 0;
+		}
+
+		bool active() const { return !workers.empty() || listen_fd >= 0; }
+
+		// Renders tiles into fb on the workers and returns the indices of the
+		// tiles they did not finish: none, unless every worker was lost or
+		// could not load the scene, in which case the caller renders the rest.
+		std::vector<size_t> render(const render_options& o, const std::vector<tile>& tiles,
+								   framebuffer& fb, std::vector<tile_timing>& timings) {
+			std::deque<size_t> queue;
+			for (size_t k = 0; k < tiles.size(); ++k) queue.push_back(k);
+			std::vector<uint8_t> done(tiles.size(), 0);
+			size_t remaining = tiles.size();
+
+			settings = job_settings(o);
+			for (auto& w : workers) start_job(w);
+			bool joined = !workers.empty(); // some worker took part in this job
+
+			if (workers.empty() && listen_fd >= 0)
+				std::cerr << "Waiting for workers on " << listen_address << ".\n";
+
+			std::vector<pollfd> fds;
+			net_message m;
+
+			while (remaining > 0) {
+				remove_lost(queue);
+				bool usable = std::any_of(workers.begin(), workers.end(), [](const worker& w) { return !w.failed; });
+				if (!usable && (joined || listen_fd < 0)) break;
+
+				fds.clear();
+				for (auto& w : workers) fds.push_back({ w.fd, POLLIN, 0 });
+				if (listen_fd >= 0) fds.push_back({ listen_fd, POLLIN, 0 });
+				if (::poll(fds.data(), fds.size(), -1) < 0) {
+					if (errno == EINTR) continue;
+					break;
+				}
+
+				// Only the workers that were polled; one accepted below waits for the next poll
+				const size_t polled = workers.size();
+				for (size_t k = 0; k < polled; ++k) {
+					if (!fds[k].revents) continue;
+					worker& w = workers[k];
+					if (!read_message(w.fd, m)) {
+						lost(w, queue, "its connection closed");
+						continue;
+					}
+
+					auto type = static_cast<farm_message>(m.type);
+					if (type == farm_message::ready && m.payload.size() == 2 * sizeof(int32_t)) {
+						int32_t threads;
+						uint32_t mark;
+						std::memcpy(&threads, m.payload.data(), sizeof(threads));
+						std::memcpy(&mark, m.payload.data() + sizeof(threads), sizeof(mark));
+						if (mark != byte_order_mark) {
+							lost(w, queue, "it has another byte order");
+							continue;
+						}
+						w.ready = true;
+						w.capacity = 2 * std::max(1, threads); // keep every thread busy while results travel
+					} else if (type == farm_message::failed) {
+						std::cerr << w.name << " cannot render this job: "
+								  << std::string(m.payload.begin(), m.payload.end()) << "\n";
+						w.failed = true;
+						requeue(w, queue);
+					} else if (type == farm_message::result && m.payload.size() >= sizeof(tile_result)) {
+						tile_result head;
+						std::memcpy(&head, m.payload.data(), sizeof(head));
+						size_t id = static_cast<size_t>(head.tile.id);
+						w.outstanding.erase(std::remove(w.outstanding.begin(), w.outstanding.end(), id),
+											w.outstanding.end());
+						if (id >= tiles.size() || done[id] || !store(tiles[id], m.payload, fb)) continue;
+						timings[id] = { tiles[id], head.seconds };
+						done[id] = 1;
+						--remaining;
+					}
+				}
+
+				if (listen_fd >= 0 && (fds.back().revents & POLLIN)) {
+					accept_worker();
+					joined = true;
+				}
+
+				// Top every ready worker up to its capacity
+				for (auto& w : workers) {
+					while (w.ready && !w.failed && !w.lost && w.outstanding.size() < size_t(w.capacity) && !queue.empty()) {
+						size_t id = queue.front();
+						queue.pop_front();
+						if (done[id]) continue;
+						const tile& t = tiles[id];
+						tile_request req = { static_cast<int32_t>(id), t.x0, t.y0, t.w, t.h };
+						w.outstanding.push_back(id);
+						if (!send_message(w.fd, static_cast<uint32_t>(farm_message::tile), &req, sizeof(req)))
+							lost(w, queue, "a request could not be sent");
+					}
+				}
+			}
+			remove_lost(queue);
+
+			std::vector<size_t> left;
+			for (size_t k = 0; k < tiles.size(); ++k)
+				if (!done[k]) left.push_back(k);
+			return left;
+		}
+
+	private:
+		struct worker {
+			worker(int fd, pid_t pid, std::string name) : fd(fd), pid(pid), name(std::move(name)) {}
+
+			int fd;
+			pid_t pid; // -1 for a worker that connected by itself
+			std::string name;
+			bool ready = false;   // has loaded the current job
+			bool failed = false;  // cannot render the current job
+			bool lost = false;
+			int capacity = 0;     // tiles it may have in flight
+			std::vector<size_t> outstanding;
+		};
+
+		std::vector<worker> workers;
+		int listen_fd = -1;
+		std::string listen_address;
+		std::string settings; // of the current job
+		int connected = 0;
+
+		void start_job(worker& w) {
+			w.ready = w.failed = false;
+			w.outstanding.clear();
+			if (!send_message(w.fd, static_cast<uint32_t>(farm_message::job), settings))
+				w.lost = true;
+		}
+
+		void accept_worker() {
+			int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd < 0) return;
+			set_no_delay(fd);
+			workers.emplace_back(fd, -1, "remote worker " + std::to_string(++connected));
+			std::cerr << workers.back().name << " connected.\n";
+			start_job(workers.back());
+		}
+
+		// Its tiles go to the front of the queue, to be handed out next
+		void requeue(worker& w, std::deque<size_t>& queue) {
+			for (auto it = w.outstanding.rbegin(); it != w.outstanding.rend(); ++it)
+				queue.push_front(*it);
+			w.outstanding.clear();
+		}
+
+		void lost(worker& w, std::deque<size_t>& queue, const char* why) {
+			if (w.lost) return;
+			if (!w.outstanding.empty())
+				std::cerr << "Lost " << w.name << " (" << why << "); " << w.outstanding.size()
+						  << " of its tiles go back in the queue.\n";
+			else
+				std::cerr << "Lost " << w.name << " (" << why << ").\n";
+			requeue(w, queue);
+			w.lost = true;
+		}
+
+		void remove_lost(std::deque<size_t>& queue) {
+			for (auto& w : workers)
+				if (w.lost) {
+					requeue(w, queue);
+					close_worker(w);
+				}
+			workers.erase(std::remove_if(workers.begin(), workers.end(), [](const worker& w) { return w.lost; }),
+						  workers.end());
+		}
+
+		static void close_worker(worker& w) {
+			::close(w.fd);
+			if (w.pid > 0) {
+				// Our own child: make sure it is gone before reaping it
+				if (w.lost) ::kill(w.pid, SIGKILL);
+				::waitpid(w.pid, nullptr, 0);
+			}
+		}
+
+		static bool store(const tile& t, const std::vector<uint8_t>& payload, framebuffer& fb) {
+			size_t floats = 3 * static_cast<size_t>(t.w) * t.h;
+			if (payload.size() != sizeof(tile_result) + floats * sizeof(float)) return false;
+			const float* px = reinterpret_cast<const float*>(payload.data() + sizeof(tile_result));
+			for (int j = t.y0; j < t.y0 + t.h; ++j)
+				for (int i = t.x0; i < t.x0 + t.w; ++i, px += 3)
+					fb.set(i, j, color(px[0], px[1], px[2]));
+			return true;
+		}
+};
+
+#endif
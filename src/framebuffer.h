@@ -0,0 +1,62 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+#include "rtweekend.h"
+
+#include <cstdint>
+#include <vector>
+
+// Linear RGB image in 32-bit floats, written directly by the render workers.
+//
+// Pixels are addressed like the camera, with j counting up from the bottom
+// row, but stored top row first since that is what every output format but
+// PFM wants.
+class framebuffer {
+	public:
+		framebuffer() : w(0), h(0) {}
+		framebuffer(int width, int height) { resize(width, height); }
+
+		void resize(int width, int height) {
+			w = width;
+			h = height;
+			rgb.assign(static_cast<size_t>(w) * h * 3, 0.0f);
+		}
+
+		int width() const { return w; }
+		int height() const { return h; }
+
+		size_t index(int i, int j) const {
+			return (static_cast<size_t>(h - 1 - j) * w + i) * 3;
+		}
+
+		void set(int i, int j, const color& c) {
+			float* p = &rgb[index(i, j)];
+			p[0] = static_cast<float>(c.x());
+			p[1] = static_cast<float>(c.y());
+			p[2] = static_cast<float>(c.z());
+		}
+
+		color get(int i, int j) const {
+			const float* p = &rgb[index(i, j)];
+			return color(p[0], p[1], p[2]);
+		}
+
+		// Rows in storage order (top first), 3 floats per pixel
+		const float* row(int r) const { return &rgb[static_cast<size_t>(r) * w * 3]; }
+		const float* data() const { return rgb.data(); }
+		float* data() { return rgb.data(); }
+
+		// Tone-maps and quantises the whole image to 8-bit RGB, top row first
+		void quantize_to(std::vector<uint8_t>& out) const {
+			out.resize(rgb.size());
+			for (size_t k = 0; k < rgb.size(); ++k)
+				out[k] = quantize(rgb[k]);
+		}
+
+	private:
+		int w, h;
+		std::vector<float> rgb;
+};
+
+#endif
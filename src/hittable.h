@@ -1,26 +1,56 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "rtweekend.h"
 
+#include <limits>
+
 class material;
 
-struct hit_record {
-	point3 p;
-	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
+template <typename T>
+struct hit_record_t {
+	vec3_t<T> p;
+	vec3_t<T> normal;
+	const material* mat_ptr; // non-owning, the world keeps materials alive
+	T t;
+	T error;                 // bound on the rounding error of p, see spawn_ray
 	bool front_face;
 
-	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
+	inline void set_face_normal(const ray_t<T>& r, const vec3_t<T>& outward_normal) {
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
 	}
 };
 
+using hit_record = hit_record_t<real>;
+
+// Hits closer than this to a ray's origin are ignored, at scene scale
+const double ray_t_min = 0.001;
+
+// Rounding error bound for a hit point computed from coordinates of the given
+// magnitude: a few ulps, generously rounded up
+template <typename T>
+inline T hit_error(T magnitude) {
+	return 64 * std::numeric_limits<T>::epsilon() * magnitude;
+}
+
+// Ray leaving a hit in direction dir. Its origin is the hit point pushed off
+// the surface, to the side dir points to, by the point's error bound, so the
+// ray cannot hit the surface it starts on however coarse the precision. In
+// double the push is far below ray_t_min, which also guards against that.
+template <typename T>
+inline ray_t<T> spawn_ray(const hit_record_t<T>& rec, const vec3_t<T>& dir) {
+	vec3_t<T> push = rec.error * rec.normal;
+	return ray_t<T>(dot(dir, rec.normal) > 0 ? rec.p + push : rec.p - push, dir);
+}
+
 class hittable {
 	public:
 		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+
+		// Returns false for unbounded objects
+		virtual bool bounding_box(aabb& output_box) const = 0;
 };
 
 #endif
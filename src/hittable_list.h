@@ -18,6 +18,8 @@ class hittable_list : public hittable {
 		virtual bool hit(
 			const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+		virtual bool bounding_box(aabb& output_box) const override;
+
 	public:
 		std::vector<shared_ptr<hittable>> objects;
 };
@@ -38,4 +40,17 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 	return hit_anything;
 }
 
+bool hittable_list::bounding_box(aabb& output_box) const {
+	if (objects.empty()) return false;
+
+	aabb box;
+	output_box = aabb();
+	for (const auto& object : objects) {
+		if (!object->bounding_box(box)) return false;
+		output_box.expand(box);
+	}
+
+	return true;
+}
+
 #endif
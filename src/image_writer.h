@@ -0,0 +1,358 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Encodes a framebuffer as binary PPM (P6), PFM (linear float) or PNG.
+//
+// The encoded size is known up front, so a file is written by sizing it,
+// mapping it and encoding straight into the mapping. Standard output gets the
+// same bytes through one in-memory buffer and a single write loop.
+// image_stream writes the same formats a row at a time instead.
+
+enum class image_format { ppm, pfm, png };
+
+inline const char* image_format_name(image_format f) {
+	switch (f) {
+		case image_format::ppm: return "ppm";
+		case image_format::pfm: return "pfm";
+		case image_format::png: return "png";
+	}
+	return "?";
+}
+
+inline bool parse_image_format(const std::string& name, image_format& f) {
+	for (auto o : { image_format::ppm, image_format::pfm, image_format::png }) {
+		if (name == image_format_name(o)) {
+			f = o;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Picks the format from the file extension, keeping f if there is none
+inline void format_from_path(const std::string& path, image_format& f) {
+	auto dot = path.rfind('.');
+	if (dot != std::string::npos)
+		parse_image_format(path.substr(dot + 1), f);
+}
+
+namespace image_detail {
+
+	inline uint32_t crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+		static const auto table = [] {
+			std::array<uint32_t, 256> t;
+			for (uint32_t n = 0; n < 256; ++n) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < len; ++i)
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	inline uint8_t* put_be32(uint8_t* p, uint32_t v) {
+		p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+		return p + 4;
+	}
+
+	inline std::string header(int width, int height, image_format f) {
+		char buf[64];
+		if (f == image_format::ppm)
+			std::snprintf(buf, sizeof(buf), "P6\n%d %d\n255\n", width, height);
+		else if (f == image_format::pfm)
+			std::snprintf(buf, sizeof(buf), "PF\n%d %d\n-1.0\n", width, height);
+		else
+			buf[0] = '\0';
+		return buf;
+	}
+
+	const size_t max_stored_block = 65535;
+
+	inline size_t png_raw_size(int width, int height) {
+		return static_cast<size_t>(height) * (1 + 3 * static_cast<size_t>(width));
+	}
+
+	inline size_t png_zlib_size(int width, int height) {
+		size_t raw = png_raw_size(width, height);
+		size_t blocks = raw == 0 ? 1 : (raw + max_stored_block - 1) / max_stored_block;
+		return 2 + raw + 5 * blocks + 4;
+	}
+
+	// PNG with uncompressed (stored) deflate blocks: no dependencies, still a
+	// valid PNG. Every size is known from the dimensions, so it is written
+	// front to back one row at a time, top row first.
+	class png_encoder {
+		public:
+			static constexpr size_t head_size = 8 + 25 + 8 + 2;
+			static constexpr size_t tail_size = 4 + 4 + 12;
+
+			png_encoder(int width, int height)
+				: w(width), h(height), row_bytes(1 + 3 * static_cast<size_t>(width)),
+				  raw_left(png_raw_size(width, height)) {}
+
+			// Most bytes row() writes: the row and the stored block headers inside it
+			size_t max_row_size() const { return row_bytes + 5 * (row_bytes / max_stored_block + 2); }
+
+			// Signature, IHDR and the start of the one IDAT chunk
+			uint8_t* begin(uint8_t* p) {
+				static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+				std::memcpy(p, signature, 8);
+				p += 8;
+
+				// IHDR: 8-bit RGB, no interlacing
+				uint8_t* chunk = p;
+				p = put_be32(p, 13);
+				std::memcpy(p, "IHDR", 4); p += 4;
+				p = put_be32(p, w);
+				p = put_be32(p, h);
+				*p++ = 8; *p++ = 2; *p++ = 0; *p++ = 0; *p++ = 0;
+				p = put_be32(p, crc32(chunk + 4, 17));
+
+				// IDAT: zlib stream of stored blocks over the filtered rows
+				chunk = p;
+				p = put_be32(p, static_cast<uint32_t>(png_zlib_size(w, h)));
+				std::memcpy(p, "IDAT", 4); p += 4;
+				*p++ = 0x78; *p++ = 0x01;
+				if (raw_left == 0) p = block_header(p);
+				crc = crc32(chunk + 4, static_cast<size_t>(p - (chunk + 4)));
+				return p;
+			}
+
+			// One row of 3 floats per pixel, with filter type none
+			uint8_t* row(const float* rgb, uint8_t* p) {
+				uint8_t* start = p;
+				for (size_t col = 0; col < row_bytes; ++col) {
+					if (block_left == 0) p = block_header(p);
+					uint8_t v = col == 0 ? 0 : quantize(rgb[col - 1]);
+					*p++ = v;
+					a = (a + v) % 65521;
+					b = (b + a) % 65521;
+					--block_left;
+				}
+				crc = crc32(start, static_cast<size_t>(p - start), crc);
+				return p;
+			}
+
+			// Adler-32, the IDAT checksum and IEND, after the last row
+			uint8_t* end(uint8_t* p) {
+				uint8_t* start = p;
+				p = put_be32(p, (b << 16) | a);
+				crc = crc32(start, 4, crc);
+				p = put_be32(p, crc);
+
+				uint8_t* chunk = p;
+				p = put_be32(p, 0);
+				std::memcpy(p, "IEND", 4); p += 4;
+				return put_be32(p, crc32(chunk + 4, 4));
+			}
+
+		private:
+			int w, h;
+			size_t row_bytes;
+			size_t raw_left;        // filtered bytes not yet in a block
+			size_t block_left = 0;  // bytes left in the current stored block
+			uint32_t a = 1, b = 0;  // Adler-32
+			uint32_t crc = 0;       // of the IDAT chunk so far
+
+			uint8_t* block_header(uint8_t* p) {
+				size_t len = raw_left < max_stored_block ? raw_left : max_stored_block;
+				raw_left -= len;
+				block_left = len;
+				*p++ = raw_left == 0 ? 1 : 0;
+				*p++ = len & 0xff; *p++ = len >> 8;
+				*p++ = ~len & 0xff; *p++ = (~len >> 8) & 0xff;
+				return p;
+			}
+	};
+
+	inline void encode_png(const framebuffer& fb, uint8_t* out) {
+		png_encoder png(fb.width(), fb.height());
+		out = png.begin(out);
+		for (int r = 0; r < fb.height(); ++r)
+			out = png.row(fb.row(r), out);
+		png.end(out);
+	}
+
+} // namespace image_detail
+
+inline size_t encoded_size(const framebuffer& fb, image_format f) {
+	size_t pixels = static_cast<size_t>(fb.width()) * fb.height();
+	switch (f) {
+		case image_format::ppm: return image_detail::header(fb.width(), fb.height(), f).size() + 3 * pixels;
+		case image_format::pfm: return image_detail::header(fb.width(), fb.height(), f).size() + 3 * pixels * sizeof(float);
+		case image_format::png: return 8 + 25 + 12 + image_detail::png_zlib_size(fb.width(), fb.height()) + 12;
+	}
+	return 0;
+}
+
+// Encodes into out, which must hold encoded_size() bytes
+inline void encode_image(const framebuffer& fb, image_format f, uint8_t* out) {
+	if (f == image_format::png) {
+		image_detail::encode_png(fb, out);
+		return;
+	}
+
+	std::string head = image_detail::header(fb.width(), fb.height(), f);
+	std::memcpy(out, head.data(), head.size());
+	out += head.size();
+
+	size_t row_floats = 3 * static_cast<size_t>(fb.width());
+
+	if (f == image_format::ppm) {
+		for (int r = 0; r < fb.height(); ++r) {
+			const float* src = fb.row(r);
+			for (size_t k = 0; k < row_floats; ++k)
+				*out++ = quantize(src[k]);
+		}
+	} else {
+		// PFM stores the bottom row first, little-endian like every machine we run on
+		for (int r = fb.height() - 1; r >= 0; --r) {
+			std::memcpy(out, fb.row(r), row_floats * sizeof(float));
+			out += row_floats * sizeof(float);
+		}
+	}
+}
+
+inline bool write_all(int fd, const uint8_t* data, size_t len) {
+	while (len > 0) {
+		ssize_t n = ::write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += n;
+		len -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+// Writes the image to path, or to standard output if path is empty or "-"
+inline bool write_image(const framebuffer& fb, image_format f, const std::string& path) {
+	size_t size = encoded_size(fb, f);
+
+	if (path.empty() || path == "-") {
+		std::vector<uint8_t> bytes(size);
+		encode_image(fb, f, bytes.data());
+		std::fflush(stdout);
+		return write_all(STDOUT_FILENO, bytes.data(), size);
+	}
+
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	bool ok = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+	if (ok && size > 0) {
+		void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			// Some filesystems cannot be mapped, fall back to a buffered write
+			std::vector<uint8_t> bytes(size);
+			encode_image(fb, f, bytes.data());
+			ok = write_all(fd, bytes.data(), size);
+		} else {
+			encode_image(fb, f, static_cast<uint8_t*>(map));
+			ok = ::munmap(map, size) == 0;
+		}
+	}
+
+	return ::close(fd) == 0 && ok;
+}
+
+// Writes an image a row at a time, so finished rows can leave the process
+// while the rest is still rendering. Rows come in file order: top row first,
+// or bottom row first for PFM (bottom_up()).
+class image_stream {
+	public:
+		image_stream() : png(0, 0) {}
+		~image_stream() { if (fd > STDOUT_FILENO) ::close(fd); }
+
+		image_stream(const image_stream&) = delete;
+		image_stream& operator=(const image_stream&) = delete;
+
+		// Writes the header to path, or to standard output if path is empty or "-"
+		bool open(int width, int height, image_format format, const std::string& path) {
+			w = width;
+			f = format;
+			if (path.empty() || path == "-") {
+				std::fflush(stdout);
+				fd = STDOUT_FILENO;
+			} else {
+				fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0) return ok = false;
+			}
+
+			if (f == image_format::png) {
+				png = image_detail::png_encoder(width, height);
+				buf.resize(std::max(image_detail::png_encoder::head_size, png.max_row_size()));
+				return put(buf.data(), png.begin(buf.data()));
+			}
+			std::string head = image_detail::header(width, height, f);
+			return ok = write_all(fd, reinterpret_cast<const uint8_t*>(head.data()), head.size());
+		}
+
+		bool bottom_up() const { return f == image_format::pfm; }
+
+		// The next row in file order, 3 floats per pixel
+		bool write_row(const float* rgb) {
+			if (!ok) return false;
+			size_t floats = 3 * static_cast<size_t>(w);
+			switch (f) {
+				case image_format::ppm:
+					buf.resize(floats);
+					for (size_t k = 0; k < floats; ++k)
+						buf[k] = quantize(rgb[k]);
+					return ok = write_all(fd, buf.data(), floats);
+				case image_format::pfm:
+					return ok = write_all(fd, reinterpret_cast<const uint8_t*>(rgb), floats * sizeof(float));
+				case image_format::png:
+					return put(buf.data(), png.row(rgb, buf.data()));
+			}
+			return ok = false;
+		}
+
+		// Finishes the file after the last row
+		bool close() {
+			if (ok && f == image_format::png) {
+				uint8_t tail[image_detail::png_encoder::tail_size];
+				put(tail, png.end(tail));
+			}
+			if (fd > STDOUT_FILENO && ::close(fd) != 0) ok = false;
+			fd = -1;
+			return ok;
+		}
+
+	private:
+		int fd = -1;
+		int w = 0;
+		image_format f = image_format::ppm;
+		image_detail::png_encoder png;
+		std::vector<uint8_t> buf;
+		bool ok = true;
+
+		bool put(const uint8_t* begin, const uint8_t* end) {
+			return ok = ok && write_all(fd, begin, static_cast<size_t>(end - begin));
+		}
+};
+
+#endif
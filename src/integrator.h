@@ -0,0 +1,121 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "stats.h"
+
+#include <limits>
+
+// Integrators turn a camera ray into the light arriving along it. The render
+// loops only see this interface, so another integrator can be swapped in
+// without touching them.
+class integrator {
+	public:
+		virtual ~integrator() = default;
+
+		virtual color radiance(const ray& r, const hittable& world, int max_depth) const = 0;
+};
+
+// Sky gradient seen by rays that escape the scene
+inline color background(const ray& r) {
+	vec3 unit_direction = unit_vector(r.direction());
+	auto t = 0.5*(unit_direction.y() + 1.0);
+	return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+}
+
+color ray_color(const ray& r, const hittable& world, int depth) {
+	hit_record rec;
+
+	// If we've exceeded the ray bounce limit, no more light is gathered
+	if (depth <= 0)
+		return color(0,0,0);
+
+	if (stats_enabled) thread_stats().rays += 1;
+	if (world.hit(r, ray_t_min, infinity, rec)) {
+		ray scattered;
+		color attenuation;
+		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+			return attenuation * ray_color(scattered, world, depth-1);
+		return color(0,0,0);
+	}
+
+	return background(r);
+}
+
+// The original recursive tracer, kept as a reference
+class recursive_integrator : public integrator {
+	public:
+		virtual color radiance(const ray& r, const hittable& world, int max_depth) const override {
+			return ray_color(r, world, max_depth);
+		}
+};
+
+const int no_roulette = std::numeric_limits<int>::max();
+
+// Russian roulette: from bounce roulette_start on, a path continues with
+// probability equal to its largest throughput component and is divided by that
+// probability when it does, so the estimate stays unbiased. Returns false if
+// the path is terminated.
+inline bool roulette_survives(color& throughput, int bounce, int roulette_start) {
+	if (bounce < roulette_start) return true;
+
+	double p = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+	if (p >= 1) return true;
+	if (random_double() >= p) return false;
+
+	throughput /= p;
+	return true;
+}
+
+// Iterative path tracer: carries the path throughput in a loop instead of
+// recursing, and ends dim paths early with Russian roulette
+class path_integrator : public integrator {
+	public:
+		path_integrator(int start = 3) : roulette_start(start) {}
+
+		virtual color radiance(const ray& r_in, const hittable& world, int max_depth) const override {
+			color throughput(1, 1, 1);
+			ray r = r_in;
+			hit_record rec;
+
+			for (int bounce = 0; bounce < max_depth; ++bounce) {
+				use_sample_dimension(bounce_dimension(bounce) + roulette_dimension);
+				if (!roulette_survives(throughput, bounce, roulette_start)) {
+					if (stats_enabled) { thread_stats().roulette += 1; thread_stats().end_path(bounce); }
+					return color(0, 0, 0);
+				}
+
+				if (stats_enabled) thread_stats().rays += 1;
+				if (!world.hit(r, ray_t_min, infinity, rec)) {
+					if (stats_enabled) { thread_stats().escaped += 1; thread_stats().end_path(bounce); }
+					return throughput * background(r);
+				}
+
+				ray scattered;
+				color attenuation;
+				use_sample_dimension(bounce_dimension(bounce));
+				if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+					if (stats_enabled) {
+						thread_stats().absorbed[static_cast<int>(rec.mat_ptr->type)] += 1;
+						thread_stats().end_path(bounce);
+					}
+					return color(0, 0, 0);
+				}
+
+				throughput = throughput * attenuation;
+				r = scattered;
+			}
+
+			// Out of bounces: no light gathered
+			if (stats_enabled) { thread_stats().depth_limited += 1; thread_stats().end_path(max_depth); }
+			return color(0, 0, 0);
+		}
+
+	public:
+		int roulette_start; // first bounce that may be terminated, no_roulette to disable
+};
+
+#endif
@@ -0,0 +1,506 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "rtweekend.h"
+
+#include "accumulation.h"
+#include "adaptive.h"
+#include "animation.h"
+#include "camera.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "integrator.h"
+#include "options.h"
+#include "packet.h"
+#include "render.h"
+#include "reorder_buffer.h"
+#include "scene_cache.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "tiled_framebuffer.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Rendering one job.
+
+// The one-shot render with streamed output. Tiles must come in file order;
+// each is queued once its rows have entered the reorder window, and the
+// calling thread writes every row as soon as it and all rows before it are
+// done, so only the window is ever held in memory.
+inline bool render_streamed(const render_options& o, const std::vector<tile>& tiles,
+							std::vector<tile_timing>& timings, const camera& cam, const hittable& world,
+							const path_integrator& integ, thread_pool& p) {
+	const int image_width = o.image_width;
+	const int image_height = o.height();
+
+	image_stream out;
+	if (!out.open(image_width, image_height, o.output_format, o.output_path)) return false;
+	auto file_row = [&](int j) { return out.bottom_up() ? j : image_height - 1 - j; };
+
+	int capacity = o.stream_rows;
+	for (const tile& t : tiles) capacity = std::max(capacity, t.h);
+	row_reorder_buffer rows(image_width, image_height, std::min(capacity, image_height));
+
+	auto render_one = [&](size_t k) {
+		const tile& t = tiles[k];
+		trace_span span("tile", t.x0, t.y0, t.w, t.h);
+		auto tile_start = std::chrono::steady_clock::now();
+		auto sink = [&](int i, int j, const color& sum) {
+			color c = sum / o.samples_per_pixel;
+			float* px = rows.row(file_row(j)) + 3 * static_cast<size_t>(i);
+			px[0] = static_cast<float>(c.x());
+			px[1] = static_cast<float>(c.y());
+			px[2] = static_cast<float>(c.z());
+		};
+		if (o.packet_mode)
+			render_tile_packet_samples(t, 0, 0, o.packet_size, image_width, image_height,
+									   o.samples_per_pixel, o.max_depth, cam, world, integ, sink);
+		else
+			render_tile_samples(t, 0, 0, image_width, image_height,
+								o.samples_per_pixel, o.max_depth, cam, world, integ, sink);
+		auto tile_end = std::chrono::steady_clock::now();
+		timings[k] = { t, std::chrono::duration<double>(tile_end - tile_start).count() };
+		for (int j = t.y0; j < t.y0 + t.h; ++j)
+			rows.finish(file_row(j), t.w);
+	};
+
+	bool ok = true;
+	size_t queued = 0;
+	while (!rows.finished()) {
+		for (; queued < tiles.size(); ++queued) {
+			const tile& t = tiles[queued];
+			if (!rows.in_window(std::max(file_row(t.y0), file_row(t.y0 + t.h - 1)))) break;
+			p.add([&render_one, k = queued] { render_one(k); });
+		}
+		// A failed write stops the output, not the tiles already queued
+		ok = out.write_row(rows.wait_next()) && ok;
+		rows.pop();
+	}
+	p.wait();
+
+	return out.close() && ok;
+}
+
+// The one-shot render out of core: tiles go straight into a tiled file and
+// leave memory as they finish, and the image is written from the file at the
+// end. Tiles that a killed render with the same settings already finished are
+// not rendered again. Runs only the tiles still to do, with their timings.
+inline bool render_tiled(const render_options& o, std::vector<tile>& tiles,
+						 std::vector<tile_timing>& timings, const camera& cam, const hittable& world,
+						 const path_integrator& integ, thread_pool& p) {
+	const int image_width = o.image_width;
+	const int image_height = o.height();
+
+	// The scene is not part of the fingerprint: delete the file after changing it
+	const uint64_t fingerprint = settings_fingerprint(
+		{ rng_seed, uint64_t(o.sampler), uint64_t(image_width), uint64_t(image_height),
+		  uint64_t(o.samples_per_pixel), uint64_t(o.max_depth), uint64_t(o.roulette_start),
+		  uint64_t(o.packet_mode) });
+
+	tiled_framebuffer fb;
+	bool resumed;
+	if (!fb.open(o.tiled_path, image_width, image_height, o.tile_width, o.tile_height, fingerprint, resumed)) {
+		std::cerr << "Could not open " << o.tiled_path << ".\n";
+		return false;
+	}
+	if (resumed)
+		std::cerr << "Resuming from " << o.tiled_path << " with " << fb.tiles_done() << " of "
+				  << fb.tile_count() << " tiles done.\n";
+
+	tiles.erase(std::remove_if(tiles.begin(), tiles.end(),
+							   [&](const tile& t) { return fb.tile_done(fb.tile_index(t)); }), tiles.end());
+	timings.assign(tiles.size(), tile_timing());
+
+	auto render_one = [&](size_t k) {
+		const tile& t = tiles[k];
+		trace_span span("tile", t.x0, t.y0, t.w, t.h);
+		auto tile_start = std::chrono::steady_clock::now();
+		auto sink = [&](int i, int j, const color& sum) { fb.set(i, j, sum / o.samples_per_pixel); };
+		if (o.packet_mode)
+			render_tile_packet_samples(t, 0, 0, o.packet_size, image_width, image_height,
+									   o.samples_per_pixel, o.max_depth, cam, world, integ, sink);
+		else
+			render_tile_samples(t, 0, 0, image_width, image_height,
+								o.samples_per_pixel, o.max_depth, cam, world, integ, sink);
+		fb.finish_tile(fb.tile_index(t));
+		auto tile_end = std::chrono::steady_clock::now();
+		timings[k] = { t, std::chrono::duration<double>(tile_end - tile_start).count() };
+	};
+
+	for (size_t k = 0; k < tiles.size(); ++k)
+		p.add([&render_one, k] { render_one(k); });
+	p.wait();
+
+	image_stream out;
+	bool ok = out.open(image_width, image_height, o.output_format, o.output_path) && fb.write(out);
+	ok = out.close() && ok;
+	return fb.close() && ok;
+}
+
+// Renders one image with the pool's threads, or with farm's workers when it
+// has any, and writes it out. The pool is left running for the next job.
+inline bool render_job(const render_options& o, const hittable& world, const camera& cam, thread_pool& p,
+					   render_farm* farm = nullptr) {
+	const int image_width = o.image_width;
+	const int image_height = o.height();
+	const int samples_per_pixel = o.samples_per_pixel;
+	const int max_depth = o.max_depth;
+	const int pass_samples = o.pass_samples;
+	const bool packet_mode = o.packet_mode;
+	const bool adaptive = o.adaptive;
+	const adaptive_settings& adaptive_config = o.adaptive_config;
+
+	rng_seed = o.seed;
+	render_sampler = o.sampler;
+	path_integrator integ(o.roulette_start);
+
+	if (stats_enabled) {
+		reset_stats();
+		enable_tracing(!o.trace_path.empty());
+	}
+
+	std::cerr << "Rendering " << image_width << "x" << image_height << " at " << samples_per_pixel << " spp"
+			  << (o.sampler != sampler_type::independent ? std::string(" (") + sampler_type_name(o.sampler) + ")" : "")
+			  << (adaptive ? " with adaptive sampling.\n" : packet_mode ? " in packet mode.\n" : ".\n");
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto tiles = make_tiles(image_width, image_height, o.tile_width, o.tile_height, o.order);
+
+	// The tiled file keeps the plain grid, so its tiles are never split
+	if (o.adaptive_split && o.tiled_path.empty()) {
+		std::vector<double> cost(tiles.size());
+		p.parallel_for(0, static_cast<int>(tiles.size()), [&](int k) {
+			trace_span span("estimate", tiles[k].x0, tiles[k].y0, tiles[k].w, tiles[k].h);
+			cost[k] = estimate_tile_cost(tiles[k], image_width, image_height, max_depth, cam, world, integ);
+		});
+		tiles = split_expensive_tiles(tiles, cost, o.split_factor, o.min_tile_size);
+	}
+
+	if (o.stream) {
+		// File order, so that rows finish roughly in the order they are written
+		bool bottom_up = o.output_format == image_format::pfm;
+		std::stable_sort(tiles.begin(), tiles.end(), [&](const tile& a, const tile& b) {
+			int ra = bottom_up ? a.y0 : -(a.y0 + a.h), rb = bottom_up ? b.y0 : -(b.y0 + b.h);
+			return ra != rb ? ra < rb : a.x0 < b.x0;
+		});
+		std::cerr << "Rendering " << tiles.size() << " tiles in file order, streaming the output.\n";
+	} else {
+		std::cerr << "Rendering " << tiles.size() << " tiles in " << tile_order_name(o.order) << " order.\n";
+	}
+
+	framebuffer fb;
+	std::vector<tile_timing> timings(tiles.size());
+	bool written = false;
+
+	if (o.stream) {
+		written = render_streamed(o, tiles, timings, cam, world, integ, p);
+	} else if (!o.tiled_path.empty()) {
+		written = render_tiled(o, tiles, timings, cam, world, integ, p);
+	} else if (!o.progressive && !adaptive) {
+		auto render_one = [&](size_t k) {
+			trace_span span("tile", tiles[k].x0, tiles[k].y0, tiles[k].w, tiles[k].h);
+			auto tile_start = std::chrono::steady_clock::now();
+			if (packet_mode)
+				render_tile_packet(tiles[k], fb, o.packet_size, image_width, image_height,
+								   samples_per_pixel, max_depth, cam, world, integ);
+			else
+				render_tile(tiles[k], fb, image_width, image_height,
+							samples_per_pixel, max_depth, cam, world, integ);
+			auto tile_end = std::chrono::steady_clock::now();
+			timings[k] = { tiles[k], std::chrono::duration<double>(tile_end - tile_start).count() };
+		};
+
+		fb.resize(image_width, image_height);
+		if (farm && farm->active()) {
+			// Whatever the workers could not finish is rendered here
+			std::vector<size_t> left = farm->render(o, tiles, fb, timings);
+			if (!left.empty())
+				std::cerr << "No workers left; rendering the last " << left.size() << " tiles here.\n";
+			for (size_t k : left)
+				p.add([&render_one, k] { render_one(k); });
+		} else {
+			for (size_t k = 0; k < tiles.size(); ++k)
+				p.add([&render_one, k] { render_one(k); });
+		}
+
+		p.wait();
+	} else {
+		const int total_passes = adaptive
+			? 1 + (adaptive_config.max_spp - adaptive_config.min_spp + adaptive_config.batch - 1) / adaptive_config.batch
+			: (samples_per_pixel + pass_samples - 1) / pass_samples;
+		// The last pass takes only the samples left, to stop at samples_per_pixel
+		auto samples_in_pass = [&](int pass) { return std::min(pass_samples, samples_per_pixel - pass * pass_samples); };
+		const uint64_t sample_budget = uint64_t(samples_per_pixel) * image_width * image_height;
+
+		// The scene is not part of the fingerprint: delete the file after changing it
+		const uint64_t fingerprint = settings_fingerprint(
+			{ rng_seed, uint64_t(o.sampler), uint64_t(image_width), uint64_t(image_height), uint64_t(max_depth),
+			  uint64_t(o.roulette_start), uint64_t(pass_samples), uint64_t(packet_mode && !adaptive),
+			  uint64_t(adaptive), uint64_t(adaptive_config.min_spp), uint64_t(adaptive_config.max_spp),
+			  uint64_t(adaptive_config.batch), uint64_t(adaptive_config.threshold * 1e9) });
+
+		fb.resize(image_width, image_height);
+		accumulation_buffer acc(image_width, image_height);
+		std::string error;
+		if (!acc.load(o.accumulation_path, fingerprint, error)) {
+			// Never replace the state of another render
+			std::cerr << "Cannot resume from " << o.accumulation_path << ": " << error
+					  << ". Delete it or pass another --state to start over.\n";
+			return false;
+		}
+		if (acc.passes() > 0)
+			std::cerr << "Resuming from " << o.accumulation_path << " after "
+					  << acc.passes() << " passes.\n";
+
+		image_format preview_format = o.output_format;
+		format_from_path(o.preview_path, preview_format);
+
+		for (auto& tt : timings) tt.seconds = 0;
+		auto last_preview = std::chrono::steady_clock::now();
+		int passes_since_preview = 0;
+
+		// Adaptive passes skip tiles that have fully converged
+		std::vector<uint64_t> tile_samples(tiles.size(), 1);
+		std::vector<int> plan(adaptive ? size_t(image_width) * image_height : 0);
+		uint64_t samples_taken = acc.total_samples();
+
+		for (int pass = acc.passes(); pass < total_passes; ++pass) {
+			// An adaptive pass is planned first, and cut down to the samples left in the budget
+			if (adaptive) {
+				for (size_t k = 0; k < tiles.size(); ++k)
+					if (tile_samples[k] != 0)
+						p.add([&, k] { tile_samples[k] = plan_tile_adaptive(tiles[k], acc, adaptive_config, plan); });
+				p.wait();
+
+				uint64_t wanted = 0, left = sample_budget - std::min(samples_taken, sample_budget);
+				for (uint64_t n : tile_samples) wanted += n;
+				if (wanted > left) trim_adaptive_plan(acc, adaptive_config, left, plan);
+			}
+
+			for (size_t k = 0; k < tiles.size(); ++k) {
+				if (tile_samples[k] == 0) continue;
+
+				p.add([&, k, pass] {
+					trace_span span("tile", tiles[k].x0, tiles[k].y0, tiles[k].w, tiles[k].h);
+					auto tile_start = std::chrono::steady_clock::now();
+					const int samples = adaptive ? 0 : samples_in_pass(pass);
+					auto sink = [&](int i, int j, const color& sum) { acc.add(i, j, sum, samples); };
+					if (adaptive)
+						tile_samples[k] = render_tile_adaptive(tiles[k], pass, acc, plan,
+															   image_width, image_height, max_depth, cam, world, integ);
+					else if (packet_mode)
+						render_tile_packet_samples(tiles[k], pass, pass * pass_samples, o.packet_size, image_width,
+												   image_height, samples, max_depth, cam, world, integ, sink);
+					else
+						render_tile_samples(tiles[k], pass, pass * pass_samples, image_width, image_height,
+											samples, max_depth, cam, world, integ, sink);
+					auto tile_end = std::chrono::steady_clock::now();
+					timings[k].t = tiles[k];
+					timings[k].seconds += std::chrono::duration<double>(tile_end - tile_start).count();
+				});
+			}
+
+			p.wait();
+			acc.finish_pass();
+
+			uint64_t pass_taken = 0;
+			if (adaptive)
+				for (uint64_t n : tile_samples) pass_taken += n;
+			samples_taken += adaptive ? pass_taken : uint64_t(samples_in_pass(pass)) * image_width * image_height;
+
+			auto now = std::chrono::steady_clock::now();
+			bool last = pass + 1 == total_passes
+				|| (adaptive && (pass_taken == 0 || samples_taken >= sample_budget));
+			if (++passes_since_preview >= o.preview_every_passes || last
+				|| std::chrono::duration<double>(now - last_preview).count() >= o.preview_every_seconds) {
+
+				acc.resolve(fb);
+				if (!last && !write_image(fb, preview_format, o.preview_path))
+					std::cerr << "Could not write " << o.preview_path << ".\n";
+				if (!acc.save(o.accumulation_path, fingerprint))
+					std::cerr << "Could not save " << o.accumulation_path << ".\n";
+
+				std::cerr << "Pass " << pass + 1 << " of at most " << total_passes << " ("
+						  << double(samples_taken) / (image_width * image_height) << " spp on average)\n";
+				last_preview = now;
+				passes_since_preview = 0;
+			}
+
+			if (last) break;
+		}
+
+		if (adaptive && !o.heatmap_path.empty()) {
+			framebuffer heatmap(image_width, image_height);
+			sample_heatmap(acc, adaptive_config.max_spp, heatmap);
+			image_format heatmap_format = o.output_format;
+			format_from_path(o.heatmap_path, heatmap_format);
+			if (!write_image(heatmap, heatmap_format, o.heatmap_path))
+				std::cerr << "Could not write " << o.heatmap_path << ".\n";
+		}
+
+		acc.resolve(fb);
+	}
+
+	if (!o.stream && o.tiled_path.empty())
+		written = write_image(fb, o.output_format, o.output_path);
+	if (!written)
+		std::cerr << "Could not write " << (o.output_path.empty() ? "image" : o.output_path) << ".\n";
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	std::cerr << "\nDone.\n";
+	std::cerr << "Took "
+			  << std::chrono::duration_cast<std::chrono::seconds>(end - start).count()
+			  << " seconds to render.\n";
+
+	report_tile_timings(std::cerr, timings);
+	if (!o.tile_report.empty()) {
+		std::ofstream csv(o.tile_report);
+		write_tile_timings_csv(csv, timings);
+	}
+
+	if (o.stats)
+		report_stats(std::cerr, collect_stats());
+	if (!o.trace_path.empty()) {
+		std::ofstream trace(o.trace_path);
+		write_chrome_trace(trace);
+		if (!trace)
+			std::cerr << "Could not write " << o.trace_path << ".\n";
+	}
+
+	return written;
+}
+
+// Renders the frames of an animation with the pool's threads. The world is
+// built once and moved from frame to frame. Up to frames_in_flight frames
+// render at once, each with its own copy of the world if anything moves:
+// a frame's tiles are queued behind the previous frame's, so threads the
+// previous frame can no longer use start on it, and each frame is written
+// out while the ones after it render. Frame f uses seed + f.
+inline bool render_animation(const render_options& o, thread_pool& p) {
+	const int image_width = o.image_width;
+	const int image_height = o.height();
+
+	scene_data scene;
+	animation anim;
+	std::string error;
+	if (!scene_cache::load_data(o.scene, scene, error)
+		|| (!o.animation_path.empty() && !load_animation(o.animation_path, scene.cam, scene.size(), anim, error))) {
+		std::cerr << "Could not load the animation: " << error << "\n";
+		return false;
+	}
+	const int frames = o.frames > 0 ? o.frames : anim.frames;
+	if (frames <= 0) {
+		std::cerr << "The animation has no frames; give --frames.\n";
+		return false;
+	}
+
+	const int in_flight = std::min(o.frames_in_flight, frames);
+	const bool moving = !anim.moving.empty();
+	std::cerr << "Rendering " << frames << " frames of " << image_width << "x" << image_height << " at "
+			  << o.samples_per_pixel << " spp, " << in_flight << " at a time"
+			  << (moving ? ", " + std::to_string(anim.moving.size()) + " spheres moving" : "") << ".\n";
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::unique_ptr<animated_world>> worlds;
+	for (int k = 0; k < (moving ? in_flight : 1); ++k)
+		worlds.push_back(std::make_unique<animated_world>(o.scene, scene));
+
+	struct frame_slot {
+		int frame = -1;
+		framebuffer fb;
+		std::unique_ptr<camera> cam;
+		const hittable* world = nullptr;
+		size_t remaining = 0; // tiles not finished
+		std::chrono::steady_clock::time_point queued;
+	};
+	std::vector<frame_slot> slots(in_flight);
+	std::mutex lock;
+	std::condition_variable frame_done;
+
+	const auto tiles = make_tiles(image_width, image_height, o.tile_width, o.tile_height, o.order);
+	const path_integrator integ(o.roulette_start);
+	double refit_seconds = 0;
+	size_t failed = 0;
+
+	auto render_one = [&](frame_slot& s, size_t k, uint64_t seed) {
+		trace_span span("tile", tiles[k].x0, tiles[k].y0, tiles[k].w, tiles[k].h);
+		job_rng_seed = seed;
+		job_sampler = o.sampler;
+		if (o.packet_mode)
+			render_tile_packet(tiles[k], s.fb, o.packet_size, image_width, image_height,
+							   o.samples_per_pixel, o.max_depth, *s.cam, *s.world, integ);
+		else
+			render_tile(tiles[k], s.fb, image_width, image_height,
+						o.samples_per_pixel, o.max_depth, *s.cam, *s.world, integ);
+		job_rng_seed.reset();
+		job_sampler.reset();
+
+		std::lock_guard<std::mutex> l(lock);
+		if (--s.remaining == 0) frame_done.notify_all();
+	};
+
+	// Waits for the slot's frame and writes it
+	auto finish = [&](frame_slot& s) {
+		{
+			std::unique_lock<std::mutex> l(lock);
+			frame_done.wait(l, [&] { return s.remaining == 0; });
+		}
+		std::string path = frame_path(o.output_path, s.frame);
+		if (!write_image(s.fb, o.output_format, path)) {
+			std::cerr << "Could not write " << (path.empty() ? "frame " + std::to_string(s.frame) : path) << ".\n";
+			++failed;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - s.queued).count();
+		std::cerr << "Frame " << s.frame + 1 << " of " << frames << " (" << seconds << " s since queued)\n";
+	};
+
+	for (int f = 0; f < frames; ++f) {
+		frame_slot& s = slots[f % in_flight];
+		if (s.frame >= 0) finish(s);
+
+		// The slot's frame is done, so its world is free to move
+		animated_world& w = *worlds[moving ? f % in_flight : 0];
+		if (moving) {
+			auto refit_start = std::chrono::steady_clock::now();
+			w.move_to(scene, anim, f);
+			refit_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - refit_start).count();
+		}
+
+		camera_settings cs = anim.camera_at(f, scene.cam);
+		o.camera.apply(cs);
+		s.cam = std::make_unique<camera>(cs.make(o.aspect()));
+		s.world = &w.world();
+		s.frame = f;
+		s.fb.resize(image_width, image_height);
+		s.remaining = tiles.size();
+		s.queued = std::chrono::steady_clock::now();
+
+		const uint64_t seed = o.seed + static_cast<uint64_t>(f);
+		for (size_t k = 0; k < tiles.size(); ++k)
+			p.add([&render_one, &s, k, seed] { render_one(s, k, seed); });
+	}
+	for (int f = std::max(0, frames - in_flight); f < frames; ++f)
+		finish(slots[f % in_flight]);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "\nRendered " << frames << " frames in " << seconds << " seconds ("
+			  << frames * 3600.0 / seconds << " frames/hour";
+	if (moving) std::cerr << ", " << refit_seconds * 1e3 / frames << " ms per frame moving the world";
+	std::cerr << ").\n";
+
+	return failed == 0;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Pull reader for JSON text.
+//
+// Nothing is built in memory: the caller walks the document in the order it
+// expects, which keeps million-object scene files cheap to read.
+//
+//	if (r.begin_object())
+//		while (r.next_key(key))
+//			if (key == "radius") radius = r.number(); else r.skip();
+//
+// The first error is kept, with its line number, and every later call then
+// returns a false or empty value, so loops end without extra checks. The text
+// must be followed by a NUL, as a std::string's is, for number parsing.
+class json_reader {
+	public:
+		json_reader(const char* begin, const char* end) : p(begin), end(end), line(1) {}
+		json_reader(const std::string& text) : json_reader(text.data(), text.data() + text.size()) {}
+
+		bool ok() const { return err.empty(); }
+		const std::string& error() const { return err; }
+
+		// Records an error at the current line and stops reading
+		void fail(const std::string& message) {
+			if (err.empty())
+				err = "line " + std::to_string(line) + ": " + message;
+			p = end;
+		}
+
+		// Type of the next value: '{', '[', '"', 'n' (number), 't'/'f' (boolean), 'z' (null) or 0
+		char peek() {
+			skip_space();
+			if (p == end) return 0;
+			char c = *p;
+			if (c == '{' || c == '[' || c == '"') return c;
+			if (c == 't' || c == 'f') return c;
+			if (c == 'n') return 'z';
+			if (c == '-' || (c >= '0' && c <= '9')) return 'n';
+			return 0;
+		}
+
+		bool begin_object() { return open('{'); }
+		bool begin_array() { return open('['); }
+
+		// Moves to the next member of the current object, or past its '}'
+		bool next_key(std::string& key) {
+			if (!next('}')) return false;
+			key = string();
+			skip_space();
+			if (p == end || *p != ':') {
+				fail("expected ':'");
+				return false;
+			}
+			++p;
+			return ok();
+		}
+
+		// Moves to the next element of the current array, or past its ']'
+		bool next_item() { return next(']'); }
+
+		double number() {
+			skip_space();
+			char* stop;
+			double v = std::strtod(p, &stop);
+			if (stop == p || stop > end) {
+				fail("expected a number");
+				return 0;
+			}
+			p = stop;
+			return v;
+		}
+
+		std::string string() {
+			skip_space();
+			if (p == end || *p != '"') {
+				fail("expected a string");
+				return "";
+			}
+			std::string s;
+			for (++p; p < end && *p != '"'; ++p) {
+				if (*p == '\n') ++line;
+				if (*p != '\\') {
+					s += *p;
+					continue;
+				}
+				if (++p == end) break;
+				switch (*p) {
+					case 'n': s += '\n'; break;
+					case 't': s += '\t'; break;
+					case 'r': s += '\r'; break;
+					case 'b': s += '\b'; break;
+					case 'f': s += '\f'; break;
+					case 'u': {
+						// Only the basic multilingual plane, encoded as UTF-8
+						if (end - p < 5) { fail("bad escape"); return ""; }
+						unsigned c = std::strtoul(std::string(p + 1, p + 5).c_str(), nullptr, 16);
+						if (c < 0x80) s += char(c);
+						else if (c < 0x800) { s += char(0xc0 | (c >> 6)); s += char(0x80 | (c & 0x3f)); }
+						else { s += char(0xe0 | (c >> 12)); s += char(0x80 | ((c >> 6) & 0x3f)); s += char(0x80 | (c & 0x3f)); }
+						p += 4;
+						break;
+					}
+					default: s += *p;
+				}
+			}
+			if (p == end) {
+				fail("unterminated string");
+				return "";
+			}
+			++p;
+			return s;
+		}
+
+		bool boolean() {
+			skip_space();
+			if (literal("true")) return true;
+			if (literal("false")) return false;
+			fail("expected true or false");
+			return false;
+		}
+
+		// Fills v from an array of exactly n numbers
+		bool numbers(double* v, int n) {
+			if (!begin_array()) return false;
+			int k = 0;
+			while (next_item()) {
+				if (k == n) { fail("too many numbers"); return false; }
+				v[k++] = number();
+			}
+			if (ok() && k != n) fail("expected " + std::to_string(n) + " numbers");
+			return ok();
+		}
+
+		// Skips over the next value, whatever it is
+		void skip() {
+			std::string key;
+			switch (peek()) {
+				case '{': begin_object(); while (next_key(key)) skip(); break;
+				case '[': begin_array(); while (next_item()) skip(); break;
+				case '"': string(); break;
+				case 'n': number(); break;
+				case 't': case 'f': boolean(); break;
+				case 'z': if (!literal("null")) fail("unexpected value"); break;
+				default: fail("unexpected value");
+			}
+		}
+
+		// True if only whitespace is left
+		bool at_end() {
+			skip_space();
+			return p == end;
+		}
+
+	private:
+		const char* p;
+		const char* end;
+		int line;
+		std::string err;
+		std::vector<bool> first; // per open container: no element read yet
+
+		void skip_space() {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+				if (*p == '\n') ++line;
+				++p;
+			}
+		}
+
+		bool literal(const char* word) {
+			const char* q = p;
+			for (const char* w = word; *w; ++w, ++q)
+				if (q == end || *q != *w) return false;
+			p = q;
+			return true;
+		}
+
+		bool open(char c) {
+			skip_space();
+			if (p == end || *p != c) {
+				fail(std::string("expected '") + c + "'");
+				return false;
+			}
+			++p;
+			first.push_back(true);
+			return true;
+		}
+
+		bool next(char close) {
+			if (!ok() || first.empty()) return false;
+			skip_space();
+			if (p < end && *p == close) {
+				++p;
+				first.pop_back();
+				return false;
+			}
+			if (!first.back()) {
+				if (p == end || *p != ',') {
+					fail(std::string("expected ',' or '") + close + "'");
+					return false;
+				}
+				++p;
+			}
+			first.back() = false;
+			return true;
+		}
+};
+
+// Quotes and escapes s as a JSON string
+inline std::string json_quote(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		switch (c) {
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\t': out += "\\t"; break;
+			case '\r': out += "\\r"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buf[8];
+					std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				} else {
+					out += c;
+				}
+		}
+	}
+	return out + "\"";
+}
+
+// Shortest of %.15g and %.17g that reads back as exactly v
+inline std::string json_number(double v) {
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.15g", v);
+	if (std::strtod(buf, nullptr) != v)
+		std::snprintf(buf, sizeof(buf), "%.17g", v);
+	return buf;
+}
+
+#endif
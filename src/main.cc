@@ -1,196 +1,108 @@
 #include "rtweekend.h"
-	
-#include "camera.h"
-#include "color.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "scenes.h"
+
+#include "daemon.h"
+#include "distributed.h"
+#include "job.h"
+#include "options.h"
+#include "scene_file.h"
 #include "thread_pool.h"
 
-#include <chrono>
-#include <functional>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
-#include <memory>
 #include <sstream>
-#include <thread>
-
-const int num_threads = std::thread::hardware_concurrency();
-
-color ray_color(const ray& r, const hittable& world, int depth) {
-	hit_record rec;
-
-	// If we've exceeded the ray bounce limit, no more light is gathered
-	if (depth <= 0)
-		return color(0,0,0);
-
-	if (world.hit(r, 0.001, infinity, rec)) {
-		ray scattered;
-		color attenuation;
-		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-			return attenuation * ray_color(scattered, world, depth-1);
-		return color(0,0,0);
+#include <string>
+#include <vector>
+
+// Renders the scene the command line describes, or every job of a batch file,
+// here or on a render daemon.
+// ./program --help lists the options; the defaults are in options.h.
+int main(int argc, char* argv[]) {
+
+	render_options options;
+	command_line cl;
+	std::string error;
+
+	if (!parse_command_line(argc, argv, options, cl, error)) {
+		std::cerr << error << "\n\n";
+		print_usage(std::cerr, argv[0]);
+		return 1;
 	}
-
-	vec3 unit_direction = unit_vector(r.direction());
-	auto t = 0.5*(unit_direction.y() + 1.0);
-	return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
-}
-
-hittable_list random_scene() {
-	hittable_list world;
-
-	auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-	for (int a = -11; a < 11; a++) {
-		for (int b = -11; b < 11; b++) {
-			auto choose_mat = random_double();
-			point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-			if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<material> sphere_material;
-
-				if (choose_mat < 0.8) {
-					// diffuse
-					auto albedo = color::random() * color::random();
-					sphere_material = make_shared<lambertian>(albedo);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				} else if (choose_mat < 0.95) {
-					// metal
-					auto albedo = color::random(0.5, 1);
-					auto fuzz = random_double(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, fuzz);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				} else {
-					// glass
-					sphere_material = make_shared<dielectric>(1.5);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-			}
+	if (cl.help) {
+		print_usage(std::cout, argv[0]);
+		return 0;
+	}
+	if (!cl.worker_address.empty())
+		return run_worker(cl.worker_address, options.threads);
+	if (!cl.serve_path.empty())
+		return run_daemon(cl.serve_path, options.threads);
+
+	std::vector<render_options> jobs = { options };
+	if (!cl.batch_path.empty()) {
+		std::ifstream in(cl.batch_path, std::ios::binary);
+		std::stringstream text;
+		text << in.rdbuf();
+		if (!in || !parse_batch(text.str(), options, jobs, error)) {
+			std::cerr << "Could not read " << cl.batch_path << (in ? ": " + error : "") << "\n";
+			return 1;
 		}
 	}
 
-	auto material1 = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+	if (!cl.submit_path.empty())
+		return submit_jobs(cl.submit_path, jobs) ? 1 : 0;
 
-	auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-	auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-	return world;
-}
+	// Set at the top level of a batch, so the same for every job
+	const render_options& shared = jobs.front();
 
-camera default_cam(double aspect_ratio) {
-
-	point3 lookfrom(13,2,3);
-	point3 lookat(0,0,0);
-	vec3 vup(0,1,0);
-	auto vfov = 20;
-	auto dist_to_focus = 10.0;
-	auto aperture = 0.1;
-	
-	camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
-	return cam;
-}
-
-void render(int start, int end, std::stringstream & out, int image_width, int image_height,
-			int samples_per_pixel, int max_depth, camera & cam, hittable_list & world) {
-
-	for (int j = start; j >= end; --j) {
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color(0, 0, 0);
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (image_width-1);
-				auto v = (j + random_double()) / (image_height-1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, world, max_depth);
-			}
-		write_color(out, pixel_color, samples_per_pixel);
-		}
+	// Workers first: starting them forks, which has to happen before the pool's threads exist
+	render_farm farm;
+	if (shared.workers > 0
+		&& !farm.spawn(shared.workers, std::max(1, shared.threads / shared.workers), error)) {
+		std::cerr << "Could not start the workers: " << error << "\n";
+		return 1;
+	}
+	if (!shared.listen.empty() && !farm.listen(shared.listen, error)) {
+		std::cerr << "Could not accept workers: " << error << "\n";
+		return 1;
 	}
 
-	std::cerr << "Block done.\n";
-}
-
-void renderScanline(int line, std::shared_ptr<std::stringstream> & out, int image_width,
-					int image_height, int samples_per_pixel, int max_depth, camera & cam,
-					hittable_list & world) {
-
-	for (int i = 0; i < image_width; ++i) {
-		color pixel_color(0, 0, 0);
-		for (int s = 0; s < samples_per_pixel; ++s) {
-			auto u = (i + random_double()) / (image_width-1);
-			auto v = (line + random_double()) / (image_height-1);
-			ray r = cam.get_ray(u, v);
-			pixel_color += ray_color(r, world, max_depth);
+	// One pool and one copy of each scene for all the jobs
+	std::cerr << "Rendering with " << shared.threads << " threads"
+			  << (shared.workers == 1 ? " in a worker process"
+				  : shared.workers > 1 ? " in " + std::to_string(shared.workers) + " worker processes" : "")
+			  << ".\n";
+	thread_pool p(shared.threads);
+	scene_cache scenes;
+	size_t failed = 0;
+
+	for (size_t k = 0; k < jobs.size(); ++k) {
+		const render_options& job = jobs[k];
+		if (jobs.size() > 1)
+			std::cerr << "\nJob " << k + 1 << " of " << jobs.size() << ": " << job.scene << " to "
+					  << (job.output_path.empty() ? "standard output" : job.output_path) << "\n";
+
+		if (job.animated()) {
+			if (!render_animation(job, p)) ++failed;
+			continue;
 		}
-	write_color(*out, pixel_color, samples_per_pixel);
-	}
-}
-int main() {
-	
-	// * IMAGE
-
-	const auto aspect_ratio = 3.0 / 2.0;
-	const int image_width = 1200;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 500;
-	const int max_depth = 10;
-
-	// * WORLD
-
-	// auto world = random_scene();
-	// auto world = scene1();
-	// auto world = scene2();
-	auto world = scene3();
-
-	// * CAMERA
-
-	// camera cam = default_cam(aspect_ratio);
-	// camera cam = cam1(aspect_ratio);
-	// camera cam = cam2(aspect_ratio);
-	camera cam = cam3(aspect_ratio);
-
-	// * RENDER
-
-	std::cerr << "Rendering with " << num_threads << " threads.\n";
-
-	auto start = std::chrono::high_resolution_clock::now();
-	thread_pool p(num_threads);
-	std::vector<std::shared_ptr<std::stringstream>> data;
-
-	std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-	for (int i = image_height - 1; i >= 0; --i) {
-		auto scanline = std::make_shared<std::stringstream>();
-		data.push_back(scanline);
-		p.add(std::bind(
-				renderScanline,
-				i,
-				scanline,
-				image_width,
-				image_height,
-				samples_per_pixel,
-				max_depth,
-				std::ref(cam),
-				std::ref(world)
-		));
-	}
 
-	p.endWhenEmpty();	
+		auto scene = scenes.get(job.scene, error);
+		if (!scene) {
+			std::cerr << "Could not load the scene: " << error << "\n";
+			++failed;
+			continue;
+		}
 
-	for (int i = 0; i < image_height; ++i)
-		std::cout << data[i]->str();
+		camera_settings cam = scene->cam;
+		job.camera.apply(cam);
+		if (!render_job(job, *scene->world, cam.make(job.aspect()), p, &farm))
+			++failed;
+	}
 
-	auto end = std::chrono::high_resolution_clock::now();
+	p.end();
 
-	std::cerr << "\nDone.\n";
-	std::cerr << "Took " 
-			  << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() 
-			  << " seconds to render.\n";
+	if (jobs.size() > 1)
+		std::cerr << "\nRendered " << jobs.size() - failed << " of " << jobs.size() << " jobs.\n";
 
-	return 0;
+	return failed ? 1 : 0;
 }
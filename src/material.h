@@ -1,64 +1,62 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include "hittable.h"
 #include "rtweekend.h"
 
-struct hit_record;
+#include <cstdint>
 
+enum class material_type : uint8_t { lambertian, metal, dielectric };
+
+// Every material is one small tagged struct and scatter() switches on the tag,
+// so there is no virtual call per bounce and the compiler can inline the
+// scattering code into the integrator. lambertian, metal and dielectric only
+// set the tag and parameters in their constructors: scenes still build them
+// with make_shared<lambertian>(...), and they can be copied by value into a
+// flat material table (see sphere_soa).
 class material {
 	public:
-		virtual bool scatter(
+		bool scatter(
 			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-		) const = 0;
-};
+		) const {
+			switch (type) {
+				case material_type::lambertian: return scatter_lambertian(rec, attenuation, scattered);
+				case material_type::metal:      return scatter_metal(r_in, rec, attenuation, scattered);
+				case material_type::dielectric: return scatter_dielectric(r_in, rec, attenuation, scattered);
+			}
+			return false;
+		}
 
-class lambertian : public material {
 	public:
-		lambertian(const color& a) : albedo(a) {}
+		material_type type;
+		color albedo;    // lambertian, metal
+		double fuzz;     // metal
+		double ir;       // dielectric: Index of Refraction
 
-		virtual bool scatter(
-			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-		) const override {
-			auto scatter_direction = rec.normal + random_unit_vector();
+	protected:
+		material(material_type t, const color& a, double f, double index_of_refraction)
+			: type(t), albedo(a), fuzz(f), ir(index_of_refraction) {}
 
-			// Catch degenerate scatter direction
-			if (scatter_direction.near_zero())
-				scatter_direction = rec.normal;
-
-			scattered = ray(rec.p, scatter_direction);
+	private:
+		bool scatter_lambertian(const hit_record& rec, color& attenuation, ray& scattered) const {
+			// Cosine-weighted, as rec.normal + random_unit_vector() is, but never degenerate
+			scattered = spawn_ray(rec, random_cosine_direction(rec.normal));
 			attenuation = albedo;
 			return true;
 		}
 
-	public:
-		color albedo;
-};
-
-class metal : public material {
-	public:
-		metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-
-		virtual bool scatter(
+		bool scatter_metal(
 			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-		) const override {
+		) const {
 			vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-			scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+			scattered = spawn_ray(rec, reflected + fuzz*random_in_unit_sphere());
 			attenuation = albedo;
 			return (dot(scattered.direction(), rec.normal) > 0);
 		}
 
-	public:
-		color albedo;
-		double fuzz;
-};
-
-class dielectric : public material {
-	public:
-		dielectric(double index_of_refraction) : ir(index_of_refraction) {}
-
-		virtual bool scatter(
+		bool scatter_dielectric(
 			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-		) const override {
+		) const {
 			attenuation = color(1.0, 1.0, 1.0);
 			double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
 
@@ -74,14 +72,10 @@ class dielectric : public material {
 			else
 				direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-			scattered = ray(rec.p, direction);
+			scattered = spawn_ray(rec, direction);
 			return true;
 		}
 
-	public:
-		double ir; // Index of Refraction
-
-	private:
 		static double reflectance(double cosine, double ref_idx) {
 			// Use Schlick's approximation for reflectance
 			auto r0 = (1-ref_idx) / (1+ref_idx);
@@ -90,4 +84,24 @@ class dielectric : public material {
 		}
 };
 
+class lambertian : public material {
+	public:
+		lambertian(const color& a) : material(material_type::lambertian, a, 0, 1) {}
+};
+
+class metal : public material {
+	public:
+		metal(const color& a, double f) : material(material_type::metal, a, f < 1 ? f : 1, 1) {}
+};
+
+class dielectric : public material {
+	public:
+		dielectric(double index_of_refraction)
+			: material(material_type::dielectric, color(1, 1, 1), 0, index_of_refraction) {}
+};
+
+// The subclasses add nothing, so copying one into a material loses nothing
+static_assert(sizeof(lambertian) == sizeof(material) && sizeof(metal) == sizeof(material)
+			  && sizeof(dielectric) == sizeof(material), "materials must stay one tagged struct");
+
 #endif
@@ -0,0 +1,89 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include "task.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer multi-consumer queue of tasks (Vyukov).
+//
+// Used for tasks submitted from outside the pool: any thread can enqueue,
+// and idle workers dequeue from it before trying to steal.
+class mpmc_queue {
+	public:
+		mpmc_queue(size_t capacity = 4096) : mask(capacity - 1), cells(new cell[capacity]) {
+			for (size_t i = 0; i < capacity; ++i)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			head.store(0, std::memory_order_relaxed);
+			tail.store(0, std::memory_order_relaxed);
+		}
+
+		~mpmc_queue() {
+			task t;
+			while (deq(t))
+				t.discard();
+		}
+
+		// Returns false if the queue is full
+		bool enq(const task& t) {
+			size_t pos = tail.load(std::memory_order_relaxed);
+			while (true) {
+				cell& c = cells[pos & mask];
+				size_t seq = c.sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+				if (diff == 0) {
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						t.store(c.words);
+						c.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Returns false if the queue is empty
+		bool deq(task& out) {
+			size_t pos = head.load(std::memory_order_relaxed);
+			while (true) {
+				cell& c = cells[pos & mask];
+				size_t seq = c.sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						out = task::load(c.words);
+						c.sequence.store(pos + mask + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool empty() const {
+			return head.load(std::memory_order_relaxed) >= tail.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct cell {
+			std::atomic<size_t> sequence;
+			std::atomic<uint64_t> words[task::words];
+		};
+
+		const size_t mask;
+		std::unique_ptr<cell[]> cells;
+		alignas(64) std::atomic<size_t> head;
+		alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
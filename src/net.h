@@ -0,0 +1,238 @@
+#ifndef NET_H
+#define NET_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Message framing over stream sockets (TCP or Unix), for the coordinator and
+// its workers and for the render daemon and its clients.
+//
+// A message is an 8-byte header, type and payload length as little-endian
+// 32-bit words, followed by the payload. The payload is passed through as is;
+// whoever sends binary payloads decides their byte order. Reads and writes
+// block and retry short transfers; any failure returns false and the
+// connection is treated as lost.
+
+struct net_message {
+	uint32_t type = 0;
+	std::vector<uint8_t> payload;
+};
+
+namespace net_detail {
+
+	inline bool write_full(int fd, const void* data, size_t len) {
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		while (len > 0) {
+			ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			p += n;
+			len -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	inline bool read_full(int fd, void* data, size_t len) {
+		uint8_t* p = static_cast<uint8_t*>(data);
+		while (len > 0) {
+			ssize_t n = ::recv(fd, p, len, 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			len -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	inline void put_le32(uint8_t* p, uint32_t v) {
+		for (int k = 0; k < 4; ++k) p[k] = static_cast<uint8_t>(v >> (8 * k));
+	}
+
+	inline uint32_t get_le32(const uint8_t* p) {
+		return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+	}
+
+	// "host:port", or just "port" for every local address
+	inline bool split_address(const std::string& address, std::string& host, std::string& port) {
+		auto colon = address.rfind(':');
+		host = colon == std::string::npos ? "" : address.substr(0, colon);
+		port = colon == std::string::npos ? address : address.substr(colon + 1);
+		return !port.empty();
+	}
+
+	inline bool unix_address(const std::string& path, sockaddr_un& a, std::string& error) {
+		a = sockaddr_un();
+		a.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(a.sun_path)) {
+			error = "bad socket path '" + path + "'";
+			return false;
+		}
+		std::memcpy(a.sun_path, path.c_str(), path.size() + 1);
+		return true;
+	}
+
+} // namespace net_detail
+
+// Tile requests are small and latency bound
+inline void set_no_delay(int fd) {
+	int on = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+const size_t max_message_payload = size_t(1) << 30;
+
+inline bool send_message(int fd, uint32_t type, const void* payload, size_t len) {
+	uint8_t header[8];
+	net_detail::put_le32(header, type);
+	net_detail::put_le32(header + 4, static_cast<uint32_t>(len));
+	return net_detail::write_full(fd, header, sizeof(header)) && net_detail::write_full(fd, payload, len);
+}
+
+inline bool send_message(int fd, uint32_t type, const std::string& text) {
+	return send_message(fd, type, text.data(), text.size());
+}
+
+inline bool read_message(int fd, net_message& m) {
+	uint8_t header[8];
+	if (!net_detail::read_full(fd, header, sizeof(header))) return false;
+	uint32_t len = net_detail::get_le32(header + 4);
+	if (len > max_message_payload) return false;
+	m.type = net_detail::get_le32(header);
+	m.payload.resize(len);
+	return net_detail::read_full(fd, m.payload.data(), m.payload.size());
+}
+
+// A listening TCP socket on address ("host:port" or "port"), or -1
+inline int listen_tcp(const std::string& address, std::string& error) {
+	std::string host, port;
+	if (!net_detail::split_address(address, host, port)) {
+		error = "bad address '" + address + "'";
+		return -1;
+	}
+
+	addrinfo hints {}, *found = nullptr;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int rc = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+	if (rc != 0) {
+		error = gai_strerror(rc);
+		return -1;
+	}
+
+	int fd = -1, last_error = 0;
+	for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+		fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0) { last_error = errno; continue; }
+		int on = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (::bind(fd, a->ai_addr, a->ai_addrlen) != 0 || ::listen(fd, 64) != 0) {
+			last_error = errno;
+			::close(fd);
+			fd = -1;
+		}
+	}
+	::freeaddrinfo(found);
+	if (fd < 0) error = "cannot listen on " + address + ": " + std::strerror(last_error);
+	return fd;
+}
+
+// A connected TCP socket to address ("host:port"), or -1
+inline int connect_tcp(const std::string& address, std::string& error) {
+	std::string host, port;
+	if (!net_detail::split_address(address, host, port)) {
+		error = "bad address '" + address + "'";
+		return -1;
+	}
+
+	addrinfo hints {}, *found = nullptr;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = ::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &found);
+	if (rc != 0) {
+		error = gai_strerror(rc);
+		return -1;
+	}
+
+	int fd = -1, last_error = 0;
+	for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+		fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+		if (fd < 0) last_error = errno;
+		if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+			last_error = errno;
+			::close(fd);
+			fd = -1;
+		}
+	}
+	::freeaddrinfo(found);
+	if (fd < 0) {
+		error = "cannot connect to " + address + ": " + std::strerror(last_error);
+		return -1;
+	}
+	set_no_delay(fd);
+	return fd;
+}
+
+// A listening Unix socket at path, or -1. A socket file nobody answers on,
+// left by a process that died, is replaced.
+inline int listen_unix(const std::string& path, std::string& error) {
+	sockaddr_un a;
+	if (!net_detail::unix_address(path, a, error)) return -1;
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		error = std::string("cannot create a socket: ") + std::strerror(errno);
+		return -1;
+	}
+	auto stale = [&] {
+		int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool refused = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0
+			&& errno == ECONNREFUSED;
+		if (probe >= 0) ::close(probe);
+		return refused;
+	};
+	bool bound = ::bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0;
+	if (!bound && errno == EADDRINUSE && stale()) {
+		::unlink(path.c_str());
+		bound = ::bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0;
+	}
+	if (!bound) {
+		error = "cannot listen on " + path + ": " + std::strerror(errno);
+		::close(fd);
+		return -1;
+	}
+	if (::listen(fd, 64) != 0) {
+		error = "cannot listen on " + path + ": " + std::strerror(errno);
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// A connected Unix socket to path, or -1
+inline int connect_unix(const std::string& path, std::string& error) {
+	sockaddr_un a;
+	if (!net_detail::unix_address(path, a, error)) return -1;
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0) return fd;
+	error = "cannot connect to " + path + ": " + std::strerror(errno);
+	if (fd >= 0) ::close(fd);
+	return -1;
+}
+
+#endif
@@ -0,0 +1,668 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "rtweekend.h"
+
+#include "adaptive.h"
+#include "image_writer.h"
+#include "integrator.h"
+#include "json.h"
+#include "sampler.h"
+#include "scene_file.h"
+#include "stats.h"
+#include "tiles.h"
+
+#include <cstdlib>
+#include <map>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Render settings, from the command line or a batch file.
+//
+// Every option has one name, used both as --name on the command line and as a
+// key in batch files. The defaults below are what a plain ./program renders.
+
+// Camera settings given explicitly; the rest come from the scene
+struct camera_override {
+	bool lookfrom = false, lookat = false, vup = false, vfov = false, aperture = false, focus_dist = false;
+	camera_settings value;
+
+	void apply(camera_settings& cam) const {
+		if (lookfrom) cam.lookfrom = value.lookfrom;
+		if (lookat) cam.lookat = value.lookat;
+		if (vup) cam.vup = value.vup;
+		if (vfov) cam.vfov = value.vfov;
+		if (aperture) cam.aperture = value.aperture;
+		if (focus_dist) cam.focus_dist = value.focus_dist;
+	}
+};
+
+struct render_options {
+	// * IMAGE
+	int image_width = 1200;
+	int image_height = 0;             // 0 follows from aspect_ratio
+	double aspect_ratio = 3.0 / 2.0;
+	int samples_per_pixel = 500;
+	int max_depth = 10;
+	uint64_t seed = 0;
+	sampler_type sampler = sampler_type::independent; // where the random numbers of a sample come from
+
+	// * WORLD
+	std::string scene = "scene3";     // a built-in scene (scene1-3, random) or a scene file
+	camera_override camera;
+
+	// * INTEGRATOR
+	int roulette_start = 3;           // paths may end by Russian roulette from this bounce on
+
+	// * THREADS AND TILES
+	int threads = static_cast<int>(std::thread::hardware_concurrency());
+	bool packet_mode = false;         // trace 8x8 pixel packets one bounce at a time
+	int packet_size = 8;
+	int tile_width = 32;
+	int tile_height = 32;
+	tile_order order = tile_order::hilbert;
+	bool adaptive_split = true;       // split tiles the pilot pass finds expensive
+	double split_factor = 4.0;        // relative to the median tile cost
+	int min_tile_size = 8;
+	std::string tile_report = "";     // CSV of per-tile render times, if set
+
+	// * DISTRIBUTED (shared by the whole batch, like threads)
+	int workers = 0;                  // local worker processes that render the tiles
+	std::string listen = "";          // [HOST:]PORT where workers started with --worker connect
+
+	// * ANIMATION
+	int frames = 0;                   // render this many frames instead of one image (0: as the animation says)
+	std::string animation_path = "";  // camera path and moving spheres, see animation.h
+	int frames_in_flight = 2;         // frames rendering at once; the next starts while the last drains
+
+	// * RENDER DAEMON
+	int priority = 0;                 // of a job sent with --submit: higher runs first, equal ones share the threads
+
+	// * STATISTICS (builds with -DRT_STATS)
+	bool stats = false;               // print ray, path and thread pool counters
+	std::string trace_path = "";      // Chrome trace JSON of the tile timeline, if set
+
+	// * OUTPUT
+	std::string output_path = "";     // standard output if empty
+	image_format output_format = image_format::ppm; // a file extension overrides it
+	bool stream = false;              // write rows as they finish instead of the whole image at the end
+	int stream_rows = 64;             // rows held for reordering while streaming (at least a tile)
+	std::string tiled_path = "";      // render out of core into this tiled file, resuming its finished tiles
+
+	// * PROGRESSIVE
+	bool progressive = false;         // accumulate passes instead of one all-or-nothing render
+	int pass_samples = 10;            // samples per pixel added by each pass
+	int preview_every_passes = 5;     // write a preview after this many passes
+	double preview_every_seconds = 60; // or after this long, whichever comes first
+	std::string preview_path = "preview.ppm";
+	std::string accumulation_path = "render.acc"; // resumed from if present and compatible
+
+	// * ADAPTIVE SAMPLING
+	// Spends samples_per_pixel * pixels samples where the image is still noisy
+	// rather than evenly. Renders in passes like progressive mode; packet mode is ignored.
+	bool adaptive = false;
+	adaptive_settings adaptive_config {
+		32,    // min_spp
+		4000,  // max_spp
+		32,    // batch
+		0.002  // threshold, about half an 8-bit step
+	};
+	std::string heatmap_path = "samples.ppm"; // samples per pixel as colours, if set
+
+	int height() const {
+		return image_height > 0 ? image_height : static_cast<int>(image_width / aspect_ratio);
+	}
+	double aspect() const { return image_height > 0 ? double(image_width) / image_height : aspect_ratio; }
+	bool animated() const { return frames > 0 || !animation_path.empty(); }
+};
+
+struct option_spec {
+	const char* name;
+	const char* arg; // nullptr for flags, which take no value on the command line
+	const char* help;
+};
+
+const option_spec option_specs[] = {
+	{ "width",       "N",       "image width in pixels" },
+	{ "height",      "N",       "image height, 0 to follow the aspect ratio" },
+	{ "aspect",      "W:H",     "aspect ratio, such as 3:2 or 1.5" },
+	{ "spp",         "N",       "samples per pixel" },
+	{ "depth",       "N",       "maximum bounces per path" },
+	{ "seed",        "N",       "random seed" },
+	{ "sampler",     "NAME",    "independent, sobol, halton or blue-noise" },
+	{ "scene",       "NAME",    "scene1, scene2, scene3, random, or a scene file" },
+	{ "lookfrom",    "X,Y,Z",   "camera position, overriding the scene's" },
+	{ "lookat",      "X,Y,Z",   "point the camera looks at" },
+	{ "vup",         "X,Y,Z",   "camera up direction" },
+	{ "vfov",        "DEG",     "vertical field of view" },
+	{ "aperture",    "A",       "lens aperture, 0 for a pinhole" },
+	{ "focus",       "D",       "focus distance, 0 to focus on lookat" },
+	{ "roulette",    "N|off",   "first bounce that Russian roulette may end" },
+	{ "threads",     "N",       "worker threads" },
+	{ "packet",      nullptr,   "trace 8x8 pixel packets one bounce at a time" },
+	{ "tile",        "W[xH]",   "tile size in pixels" },
+	{ "order",       "NAME",    "tile order: scanline, morton, hilbert, spiral" },
+	{ "split",       "on|off",  "split tiles the pilot pass finds expensive" },
+	{ "tile-report", "PATH",    "CSV of per-tile render times" },
+	{ "workers",     "N",       "render the tiles in N local worker processes" },
+	{ "listen",      "[HOST:]PORT", "accept workers started elsewhere with --worker HOST:PORT" },
+	{ "frames",      "N",       "render N frames, numbered into the output path" },
+	{ "animation",   "PATH",    "camera path and moving spheres of the frames" },
+	{ "frames-in-flight", "N",  "frames rendering at once, 1 to finish each before the next" },
+	{ "priority",    "N",       "daemon jobs: higher runs first, equal ones share the threads" },
+	{ "stats",       nullptr,   "print render statistics (needs -DRT_STATS)" },
+	{ "trace",       "PATH",    "write the tile timeline as Chrome trace JSON (needs -DRT_STATS)" },
+	{ "output",      "PATH",    "image file, standard output if empty" },
+	{ "format",      "NAME",    "ppm, pfm or png, if the output has no extension" },
+	{ "stream",      nullptr,   "write rows as they finish, holding only a window of rows" },
+	{ "stream-rows", "N",       "rows the streamed output holds for reordering" },
+	{ "tiled",       "PATH",    "render out of core into a tiled file, resuming its finished tiles" },
+	{ "progressive", nullptr,   "render in passes, with previews and resumable state" },
+	{ "pass-spp",    "N",       "samples per pixel added by each pass" },
+	{ "preview",     "PATH",    "preview image written between passes" },
+	{ "state",       "PATH",    "accumulation file to resume from" },
+	{ "adaptive",    nullptr,   "spend the samples where the image is still noisy" },
+	{ "min-spp",     "N",       "adaptive: samples every pixel gets" },
+	{ "max-spp",     "N",       "adaptive: samples no pixel exceeds" },
+	{ "batch-spp",   "N",       "adaptive: samples added per pass to a noisy pixel" },
+	{ "threshold",   "E",       "adaptive: target error in output units" },
+	{ "heatmap",     "PATH",    "adaptive: samples per pixel image, empty for none" },
+};
+
+inline const option_spec* find_option(const std::string& name) {
+	for (const auto& spec : option_specs)
+		if (name == spec.name) return &spec;
+	return nullptr;
+}
+
+namespace option_detail {
+
+	inline bool to_int(const std::string& s, int& v, int min) {
+		char* stop;
+		long x = std::strtol(s.c_str(), &stop, 10);
+		if (s.empty() || *stop || x < min || x > 1 << 30) return false;
+		v = static_cast<int>(x);
+		return true;
+	}
+
+	inline bool to_double(const std::string& s, double& v) {
+		char* stop;
+		v = std::strtod(s.c_str(), &stop);
+		return !s.empty() && !*stop;
+	}
+
+	inline bool to_bool(const std::string& s, bool& v) {
+		if (s == "true" || s == "on" || s == "1") v = true;
+		else if (s == "false" || s == "off" || s == "0") v = false;
+		else return false;
+		return true;
+	}
+
+	inline bool to_vec3(const std::string& s, vec3& v) {
+		double e[3];
+		const char* p = s.c_str();
+		for (int k = 0; k < 3; ++k) {
+			char* stop;
+			e[k] = std::strtod(p, &stop);
+			if (stop == p || *stop != (k < 2 ? ',' : '\0')) return false;
+			p = stop + 1;
+		}
+		v = vec3(e[0], e[1], e[2]);
+		return true;
+	}
+
+	// "3:2", "1.5"
+	inline bool to_ratio(const std::string& s, double& v) {
+		auto colon = s.find(':');
+		if (colon == std::string::npos) return to_double(s, v) && v > 0;
+		double w, h;
+		if (!to_double(s.substr(0, colon), w) || !to_double(s.substr(colon + 1), h) || w <= 0 || h <= 0)
+			return false;
+		v = w / h;
+		return true;
+	}
+
+	// "32" or "32x16"
+	inline bool to_size(const std::string& s, int& w, int& h) {
+		auto x = s.find('x');
+		if (x == std::string::npos) return to_int(s, w, 1) && to_int(s, h, 1);
+		return to_int(s.substr(0, x), w, 1) && to_int(s.substr(x + 1), h, 1);
+	}
+
+} // namespace option_detail
+
+// Sets one option from its text; false, with error set, if either is not valid
+inline bool set_option(render_options& o, const std::string& name, const std::string& value,
+					   std::string& error) {
+	using namespace option_detail;
+
+	bool ok = true;
+	if (name == "width") ok = to_int(value, o.image_width, 1);
+	else if (name == "height") ok = to_int(value, o.image_height, 0);
+	else if (name == "aspect") ok = to_ratio(value, o.aspect_ratio);
+	else if (name == "spp") ok = to_int(value, o.samples_per_pixel, 1);
+	else if (name == "depth") ok = to_int(value, o.max_depth, 1);
+	else if (name == "seed") {
+		char* stop;
+		o.seed = std::strtoull(value.c_str(), &stop, 10);
+		ok = !value.empty() && !*stop;
+	}
+	else if (name == "sampler") ok = parse_sampler_type(value, o.sampler);
+	else if (name == "scene") { o.scene = value; ok = !value.empty(); }
+	else if (name == "lookfrom") ok = o.camera.lookfrom = to_vec3(value, o.camera.value.lookfrom);
+	else if (name == "lookat") ok = o.camera.lookat = to_vec3(value, o.camera.value.lookat);
+	else if (name == "vup") ok = o.camera.vup = to_vec3(value, o.camera.value.vup);
+	else if (name == "vfov") ok = o.camera.vfov = to_double(value, o.camera.value.vfov);
+	else if (name == "aperture") ok = o.camera.aperture = to_double(value, o.camera.value.aperture);
+	else if (name == "focus") ok = o.camera.focus_dist = to_double(value, o.camera.value.focus_dist);
+	else if (name == "roulette") {
+		if (value == "off") o.roulette_start = no_roulette;
+		else ok = to_int(value, o.roulette_start, 0);
+	}
+	else if (name == "threads") ok = to_int(value, o.threads, 1);
+	else if (name == "packet") ok = to_bool(value, o.packet_mode);
+	else if (name == "tile") ok = to_size(value, o.tile_width, o.tile_height);
+	else if (name == "order") ok = parse_tile_order(value, o.order);
+	else if (name == "split") ok = to_bool(value, o.adaptive_split);
+	else if (name == "tile-report") o.tile_report = value;
+	else if (name == "workers") ok = to_int(value, o.workers, 0);
+	else if (name == "listen") o.listen = value;
+	else if (name == "frames") ok = to_int(value, o.frames, 0);
+	else if (name == "animation") o.animation_path = value;
+	else if (name == "frames-in-flight") ok = to_int(value, o.frames_in_flight, 1);
+	else if (name == "priority") ok = to_int(value, o.priority, -(1 << 30));
+	else if (name == "stats") ok = to_bool(value, o.stats);
+	else if (name == "trace") o.trace_path = value;
+	else if (name == "output") o.output_path = value;
+	else if (name == "format") ok = parse_image_format(value, o.output_format);
+	else if (name == "stream") ok = to_bool(value, o.stream);
+	else if (name == "stream-rows") ok = to_int(value, o.stream_rows, 1);
+	else if (name == "tiled") o.tiled_path = value;
+	else if (name == "progressive") ok = to_bool(value, o.progressive);
+	else if (name == "pass-spp") ok = to_int(value, o.pass_samples, 1);
+	else if (name == "preview") o.preview_path = value;
+	else if (name == "state") o.accumulation_path = value;
+	else if (name == "adaptive") ok = to_bool(value, o.adaptive);
+	else if (name == "min-spp") ok = to_int(value, o.adaptive_config.min_spp, 1);
+	else if (name == "max-spp") ok = to_int(value, o.adaptive_config.max_spp, 1);
+	else if (name == "batch-spp") ok = to_int(value, o.adaptive_config.batch, 1);
+	else if (name == "threshold") ok = to_double(value, o.adaptive_config.threshold);
+	else if (name == "heatmap") o.heatmap_path = value;
+	else {
+		error = "unknown option '" + name + "'";
+		return false;
+	}
+
+	if (!ok) error = "bad value '" + value + "' for " + name;
+	return ok;
+}
+
+// Checks the options and fills in what follows from them
+inline bool finish_options(render_options& o, std::string& error) {
+	format_from_path(o.output_path, o.output_format);
+	if (!stats_enabled && (o.stats || !o.trace_path.empty())) {
+		error = "statistics need a build with -DRT_STATS";
+		return false;
+	}
+	if ((o.stream || !o.tiled_path.empty()) && (o.progressive || o.adaptive)) {
+		error = "streamed and tiled output need a one-shot render, not progressive or adaptive";
+		return false;
+	}
+	if ((o.workers > 0 || !o.listen.empty()) && (o.progressive || o.adaptive || o.stream || !o.tiled_path.empty())) {
+		error = "workers render one-shot images into memory only, not progressive, adaptive, streamed or tiled";
+		return false;
+	}
+	if (o.animated() && (o.progressive || o.adaptive || o.stream || !o.tiled_path.empty()
+						 || o.workers > 0 || !o.listen.empty())) {
+		error = "animations render one-shot frames in this process, not progressive, adaptive, streamed, tiled or on workers";
+		return false;
+	}
+	if (o.stream && !o.tiled_path.empty()) {
+		error = "tiled output is already written row by row; drop --stream";
+		return false;
+	}
+	if (o.height() < 1) {
+		error = "the image is less than one pixel high";
+		return false;
+	}
+	if (o.adaptive_config.min_spp > o.adaptive_config.max_spp) {
+		error = "min-spp is above max-spp";
+		return false;
+	}
+	if (o.adaptive && o.samples_per_pixel < o.adaptive_config.min_spp) {
+		error = "adaptive sampling gives every pixel min-spp samples; spp is below it";
+		return false;
+	}
+	return true;
+}
+
+// The options a worker needs to render tiles of the same image as o, one
+// "name=value" line each, for set_option() on the other side
+inline std::string job_settings(const render_options& o) {
+	auto vec = [](const vec3& v) { return json_number(v.x()) + "," + json_number(v.y()) + "," + json_number(v.z()); };
+	std::string s;
+	auto line = [&](const char* name, const std::string& value) { s += std::string(name) + "=" + value + "\n"; };
+
+	line("width", std::to_string(o.image_width));
+	line("height", std::to_string(o.image_height));
+	line("aspect", json_number(o.aspect_ratio));
+	line("spp", std::to_string(o.samples_per_pixel));
+	line("depth", std::to_string(o.max_depth));
+	line("seed", std::to_string(o.seed));
+	line("sampler", sampler_type_name(o.sampler));
+	line("scene", o.scene);
+	if (o.camera.lookfrom) line("lookfrom", vec(o.camera.value.lookfrom));
+	if (o.camera.lookat) line("lookat", vec(o.camera.value.lookat));
+	if (o.camera.vup) line("vup", vec(o.camera.value.vup));
+	if (o.camera.vfov) line("vfov", json_number(o.camera.value.vfov));
+	if (o.camera.aperture) line("aperture", json_number(o.camera.value.aperture));
+	if (o.camera.focus_dist) line("focus", json_number(o.camera.value.focus_dist));
+	line("roulette", o.roulette_start == no_roulette ? "off" : std::to_string(o.roulette_start));
+	line("packet", o.packet_mode ? "true" : "false");
+	return s;
+}
+
+// Applies the lines of job_settings()
+inline bool apply_job_settings(const std::string& text, render_options& o, std::string& error) {
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos) end = text.size();
+		std::string line = text.substr(start, end - start);
+		start = end + 1;
+		auto eq = line.find('=');
+		if (eq == std::string::npos) {
+			error = "bad setting '" + line + "'";
+			return false;
+		}
+		if (!set_option(o, line.substr(0, eq), line.substr(eq + 1), error)) return false;
+	}
+	return true;
+}
+
+inline void print_usage(std::ostream& out, const char* program) {
+	auto line = [&](const std::string& flag, const char* help) {
+		out << flag << std::string(flag.size() < 24 ? 24 - flag.size() : 1, ' ') << help << "\n";
+	};
+	out << "Usage: " << program << " [options] [--batch FILE]\n\n";
+	for (const auto& spec : option_specs)
+		line(std::string("  --") + spec.name + (spec.arg ? std::string(" ") + spec.arg : ""), spec.help);
+	line("  --batch FILE", "render every job of a batch file");
+	line("  --worker HOST:PORT", "render tiles for the coordinator listening there");
+	line("  --serve SOCKET", "run a render daemon on this Unix socket");
+	line("  --submit SOCKET", "render on the daemon at this socket instead");
+	line("  --help", "show this text");
+}
+
+// What the command line asks for besides the render options
+struct command_line {
+	std::string batch_path;     // render every job of this batch file
+	std::string worker_address; // render tiles for the coordinator there
+	std::string serve_path;     // run a render daemon on this socket
+	std::string submit_path;    // send the jobs to the daemon on this socket
+	bool help = false;
+};
+
+// Parses the command line. A bare "packet" is accepted for --packet, as before.
+// Flags also take an explicit value: --packet=off.
+inline bool parse_command_line(int argc, char* argv[], render_options& o, command_line& c, std::string& error) {
+	c = command_line();
+	for (int k = 1; k < argc; ++k) {
+		std::string arg = argv[k];
+		if (arg == "packet") arg = "--packet";
+		if (arg == "--help" || arg == "-h") {
+			c.help = true;
+			return true;
+		}
+		if (arg.compare(0, 2, "--") != 0) {
+			error = "unexpected argument '" + arg + "'";
+			return false;
+		}
+
+		std::string name = arg.substr(2), value;
+		bool has_value = false;
+		auto eq = name.find('=');
+		if (eq != std::string::npos) {
+			value = name.substr(eq + 1);
+			name = name.substr(0, eq);
+			has_value = true;
+		}
+
+		std::string* path = name == "batch" ? &c.batch_path : name == "worker" ? &c.worker_address
+			: name == "serve" ? &c.serve_path : name == "submit" ? &c.submit_path : nullptr;
+		if (path) {
+			if (!has_value && k + 1 < argc) value = argv[++k];
+			*path = value;
+			continue;
+		}
+
+		const option_spec* spec = find_option(name);
+		if (!spec) {
+			error = "unknown option --" + name;
+			return false;
+		}
+		if (!has_value) {
+			if (!spec->arg) value = "true";
+			else if (k + 1 < argc) value = argv[++k];
+			else {
+				error = "--" + name + " needs a value";
+				return false;
+			}
+		}
+		if (!set_option(o, name, value, error)) return false;
+	}
+	return finish_options(o, error);
+}
+
+// * BATCH FILES
+//
+//	{
+//		"spp": 100, "width": 600,
+//		"jobs": [
+//			{ "scene": "scenes/scene1.json", "output": "scene1.png" },
+//			{ "scene": ["scene2", "scene3"], "spp": [16, 256], "output": "{scene}_{spp}.png" },
+//			{ "scene": "random", "camera": [{ "vfov": 20 }, { "vfov": 40, "lookfrom": [0, 2, 10] }] }
+//		]
+//	}
+//
+// Keys outside "jobs" apply to every job. In a job, a list of values renders
+// the job once per value, and several lists render every combination. A
+// "camera" object sets the camera options (lookfrom, lookat, vup, vfov,
+// aperture, focus) together. {name} in an output path is replaced by that
+// option's value, a scene by its file name without extension; a job that
+// renders several images without placeholders gets _1, _2, ... appended.
+// {frame} is left for animations to number their frames.
+
+namespace option_detail {
+
+	// One setting of a job: a single option, or all the fields of a camera
+	using assignment = std::vector<std::pair<std::string, std::string>>;
+
+	inline std::string json_value_text(json_reader& r) {
+		switch (r.peek()) {
+			case 'n': return json_number(r.number());
+			case 't': case 'f': return r.boolean() ? "true" : "false";
+			case '[': {
+				// Camera vectors
+				double e[3];
+				if (!r.numbers(e, 3)) return "";
+				return json_number(e[0]) + "," + json_number(e[1]) + "," + json_number(e[2]);
+			}
+			default: return r.string();
+		}
+	}
+
+	inline assignment read_camera_object(json_reader& r) {
+		assignment a;
+		std::string key;
+		if (!r.begin_object()) return a;
+		while (r.next_key(key)) {
+			if (key == "focus_dist") key = "focus";
+			if (key != "lookfrom" && key != "lookat" && key != "vup" && key != "vfov"
+				&& key != "aperture" && key != "focus") {
+				r.fail("unknown camera setting '" + key + "'");
+				break;
+			}
+			a.emplace_back(key, json_value_text(r));
+		}
+		return a;
+	}
+
+	inline assignment read_assignment(json_reader& r, const std::string& key) {
+		if (key == "camera") return read_camera_object(r);
+		return { { key, json_value_text(r) } };
+	}
+
+	// The values of one key: several if the job gives a list
+	inline std::vector<assignment> read_choices(json_reader& r, const std::string& key) {
+		std::vector<assignment> choices;
+		if (r.peek() == '[' && key != "lookfrom" && key != "lookat" && key != "vup") {
+			r.begin_array();
+			while (r.next_item())
+				choices.push_back(read_assignment(r, key));
+			if (r.ok() && choices.empty()) r.fail("empty list for '" + key + "'");
+		} else {
+			choices.push_back(read_assignment(r, key));
+		}
+		return choices;
+	}
+
+	inline std::string file_stem(const std::string& path) {
+		auto slash = path.find_last_of('/');
+		std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+		auto dot = name.rfind('.');
+		return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+	}
+
+	// Replaces {name} in pattern by the value given to name
+	inline bool expand_output(const std::string& pattern, const std::map<std::string, std::string>& values,
+							  std::string& out, std::string& error) {
+		out.clear();
+		for (size_t k = 0; k < pattern.size(); ++k) {
+			if (pattern[k] != '{') {
+				out += pattern[k];
+				continue;
+			}
+			auto close = pattern.find('}', k);
+			std::string name = pattern.substr(k + 1, close == std::string::npos ? close : close - k - 1);
+			if (name == "frame" && close != std::string::npos) {
+				out += "{frame}"; // numbered per frame when the job renders
+				k = close;
+				continue;
+			}
+			auto it = values.find(name);
+			if (close == std::string::npos || it == values.end()) {
+				error = "nothing to put in {" + name + "} of " + pattern;
+				return false;
+			}
+			out += name == "scene" ? file_stem(it->second) : it->second;
+			k = close;
+		}
+		return true;
+	}
+
+	// Options that set up the pool and the workers, made once for a batch
+	inline bool shared_by_batch(const std::string& name) {
+		return name == "threads" || name == "workers" || name == "listen";
+	}
+
+	inline bool apply_all(render_options& o, const assignment& a, std::map<std::string, std::string>& values,
+						  std::string& error) {
+		for (const auto& [name, value] : a) {
+			if (shared_by_batch(name)) {
+				error = name + " is shared by the whole batch; set it at the top level";
+				return false;
+			}
+			if (!set_option(o, name, value, error)) return false;
+			values[name] = value;
+		}
+		return true;
+	}
+
+} // namespace option_detail
+
+// Reads the jobs of a batch file, each starting from base
+inline bool parse_batch(const std::string& text, const render_options& base,
+						std::vector<render_options>& jobs, std::string& error) {
+	using namespace option_detail;
+
+	json_reader r(text);
+	render_options defaults = base;
+	std::map<std::string, std::string> default_values;
+	std::vector<std::vector<std::pair<std::string, std::vector<assignment>>>> job_keys;
+	std::string key;
+
+	if (r.begin_object()) {
+		while (r.next_key(key)) {
+			if (key == "jobs") {
+				if (!r.begin_array()) break;
+				while (r.next_item()) {
+					job_keys.emplace_back();
+					if (!r.begin_object()) break;
+					while (r.next_key(key))
+						job_keys.back().emplace_back(key, read_choices(r, key));
+				}
+			} else if (shared_by_batch(key)) {
+				// Top level only: the pool and the workers are made once for the batch
+				if (!set_option(defaults, key, json_value_text(r), error)) r.fail(error);
+			} else {
+				std::string apply_error;
+				for (const assignment& a : read_choices(r, key)) {
+					if (!r.ok()) break;
+					if (!apply_all(defaults, a, default_values, apply_error)) r.fail(apply_error);
+				}
+			}
+		}
+		if (r.ok() && !r.at_end()) r.fail("text after the jobs");
+	}
+	if (!r.ok()) {
+		error = r.error();
+		return false;
+	}
+	if (job_keys.empty()) {
+		error = "no jobs";
+		return false;
+	}
+
+	jobs.clear();
+	for (size_t j = 0; j < job_keys.size(); ++j) {
+		const auto& keys = job_keys[j];
+		size_t combinations = 1;
+		for (const auto& k : keys) combinations *= k.second.size();
+
+		for (size_t c = 0; c < combinations; ++c) {
+			render_options o = defaults;
+			std::map<std::string, std::string> values = default_values;
+			std::string job_error;
+
+			// Mixed-radix digits of c pick one choice per key
+			size_t rest = c;
+			for (const auto& [name, choices] : keys) {
+				if (!apply_all(o, choices[rest % choices.size()], values, job_error)) {
+					error = "job " + std::to_string(j + 1) + ": " + job_error;
+					return false;
+				}
+				rest /= choices.size();
+			}
+
+			std::string pattern = o.output_path;
+			if (combinations > 1 && pattern.find('{') == std::string::npos && !pattern.empty()) {
+				auto dot = pattern.rfind('.');
+				auto slash = pattern.rfind('/');
+				if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = pattern.size();
+				pattern.insert(dot, "_" + std::to_string(c + 1));
+			}
+			if (!expand_output(pattern, values, o.output_path, job_error) || !finish_options(o, job_error)) {
+				error = "job " + std::to_string(j + 1) + ": " + job_error;
+				return false;
+			}
+			jobs.push_back(o);
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "material.h"
+#include "ray_stream.h"
+#include "render.h"
+#include "sphere_soa.h"
+#include "stats.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Packet / wavefront renderer.
+//
+// Instead of following one path to the end before starting the next, a tile
+// of pixels advances one bounce at a time: all live rays of the tile are
+// intersected together (rays across SIMD lanes when the world is a
+// sphere_soa), then the hits are sorted by material and direction octant and
+// shaded in that order, which also orders the next bounce's stream.
+//
+// This is path_integrator in wavefront form, Russian roulette included. Each
+// path carries its pixel's random generator and sampler state and consumes
+// them exactly as the scalar renderer does, so for a given pixel the two
+// paths differ only by floating-point rounding.
+
+struct packet_path {
+	color throughput;
+	int pixel; // index within the tile
+};
+
+class packet_tracer {
+	public:
+		packet_tracer(const hittable& w, int roulette = no_roulette)
+			: world(w), soa(dynamic_cast<const sphere_soa*>(&w)), roulette_start(roulette) {}
+
+		// Renders the tile [x0, x0+w) x [y0, y0+h) into out, row-major, summed over
+		// samples, on the random streams of the given progressive pass and from
+		// sample index first_sample
+		void render_tile(int x0, int y0, int w, int h, std::vector<color>& out,
+						 int image_width, int image_height, int samples_per_pixel,
+						 int max_depth, const camera& cam, int pass = 0, int first_sample = 0);
+
+		long rays_traced() const { return ray_count; }
+
+	private:
+		const hittable& world;
+		const sphere_soa* soa;
+		int roulette_start;
+		long ray_count = 0;
+
+		std::vector<packet_path> paths, next_paths;
+		std::vector<hit_record> recs;
+		std::vector<uint8_t> did_hit;
+		std::vector<uint64_t> order;
+		ray_stream stream, next_stream;
+
+		void intersect();
+};
+
+void packet_tracer::intersect() {
+	size_t n = stream.size();
+	recs.resize(n);
+	did_hit.resize(n);
+	ray_count += static_cast<long>(n);
+	if (stats_enabled) thread_stats().rays += n;
+
+	if (soa) {
+		soa->intersect_stream(stream, ray_t_min, infinity);
+		for (size_t i = 0; i < n; ++i)
+			did_hit[i] = soa->stream_hit(stream, i, ray_t_min, recs[i]);
+	} else {
+		for (size_t i = 0; i < n; ++i)
+			did_hit[i] = world.hit(stream.get(i), ray_t_min, infinity, recs[i]);
+	}
+}
+
+// Sort key: material type first, so each kind of scattering runs as one batch,
+// then the material itself, then direction octant
+inline uint64_t shading_key(const hit_record& rec, const vec3& dir, size_t index) {
+	uint64_t octant = (dir.x() < 0) | ((dir.y() < 0) << 1) | ((dir.z() < 0) << 2);
+	uint64_t type = static_cast<uint64_t>(rec.mat_ptr->type);
+	uint64_t mat = reinterpret_cast<uintptr_t>(rec.mat_ptr) & 0x3fffffffffULL;
+	return (type << 61) | (mat << 23) | (octant << 20) | index;
+}
+
+void packet_tracer::render_tile(int x0, int y0, int w, int h, std::vector<color>& out,
+								int image_width, int image_height, int samples_per_pixel,
+								int max_depth, const camera& cam, int pass, int first_sample) {
+	const size_t n = static_cast<size_t>(w) * h;
+	out.assign(n, color(0, 0, 0));
+
+	std::vector<rng> pixel_rng(n);
+	std::vector<sampler_state> pixel_sampler(n);
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x)
+			pixel_rng[y*w + x].seed(image_seed(), pixel_stream(x0 + x, y0 + y, image_width, image_height, pass));
+
+	// Puts pixel k's generator and sample in place of the thread's, or back
+	auto swap_pixel = [&](int k) {
+		std::swap(thread_rng(), pixel_rng[k]);
+		std::swap(thread_sampler(), pixel_sampler[k]);
+	};
+
+	for (int s = 0; s < samples_per_pixel; ++s) {
+		// Primary rays for every pixel of the tile
+		paths.resize(n);
+		stream.resize(n);
+		for (int y = 0; y < h; ++y) {
+			for (int x = 0; x < w; ++x) {
+				int k = y*w + x;
+				swap_pixel(k);
+				start_sample(x0 + x, y0 + y, uint32_t(first_sample + s));
+				auto u = (x0 + x + random_double()) / (image_width-1);
+				auto v = (y0 + y + random_double()) / (image_height-1);
+				stream.set(k, cam.get_ray(u, v));
+				swap_pixel(k);
+				paths[k].throughput = color(1, 1, 1);
+				paths[k].pixel = k;
+			}
+		}
+
+		for (int depth = max_depth; depth > 0 && stream.size() > 0; --depth) {
+			intersect();
+
+			// Escaped rays pick up the sky, the rest are queued for shading
+			order.clear();
+			for (size_t i = 0; i < stream.size(); ++i) {
+				if (did_hit[i]) {
+					order.push_back(shading_key(recs[i], vec3(stream.dx[i], stream.dy[i], stream.dz[i]), i));
+				} else {
+					out[paths[i].pixel] += paths[i].throughput * background(stream.get(i));
+					if (stats_enabled) { thread_stats().escaped += 1; thread_stats().end_path(max_depth - depth); }
+				}
+			}
+			std::sort(order.begin(), order.end());
+
+			next_paths.clear();
+			next_stream.resize(order.size());
+			size_t live = 0;
+
+			for (uint64_t key : order) {
+				size_t i = key & 0xfffff;
+				packet_path& p = paths[i];
+				ray scattered;
+				color attenuation;
+
+				swap_pixel(p.pixel);
+				int bounce = max_depth - depth + 1;
+				use_sample_dimension(bounce_dimension(bounce - 1));
+				bool scatters = recs[i].mat_ptr->scatter(stream.get(i), recs[i], attenuation, scattered);
+				if (scatters) {
+					p.throughput = p.throughput * attenuation;
+					// Roulette for the next bounce, if there is one, as path_integrator does
+					if (depth > 1) {
+						use_sample_dimension(bounce_dimension(bounce) + roulette_dimension);
+						scatters = roulette_survives(p.throughput, bounce, roulette_start);
+						if (stats_enabled && !scatters) { thread_stats().roulette += 1; thread_stats().end_path(bounce); }
+					}
+				} else if (stats_enabled) {
+					thread_stats().absorbed[static_cast<int>(recs[i].mat_ptr->type)] += 1;
+					thread_stats().end_path(bounce - 1);
+				}
+				swap_pixel(p.pixel);
+
+				if (scatters) {
+					next_stream.set(live++, scattered);
+					next_paths.push_back(p);
+				}
+			}
+
+			next_stream.resize(live);
+			std::swap(stream, next_stream);
+			std::swap(paths, next_paths);
+		}
+		// Paths still alive here hit the bounce limit and gather no light
+		if (stats_enabled)
+			for (size_t i = 0; i < stream.size(); ++i) {
+				thread_stats().depth_limited += 1;
+				thread_stats().end_path(max_depth);
+			}
+	}
+}
+
+// Packet counterpart of render_tile_samples: renders the tile as packet_size x
+// packet_size packets and hands each pixel's sum to sink(i, j, sum)
+template <typename Sink>
+void render_tile_packet_samples(const tile& t, int pass, int first_sample, int packet_size,
+								int image_width, int image_height, int samples_per_pixel, int max_depth,
+								const camera& cam, const hittable& world, const path_integrator& integ,
+								Sink&& sink) {
+
+	packet_tracer tracer(world, integ.roulette_start);
+	std::vector<color> packet;
+
+	for (int y0 = t.y0; y0 < t.y0 + t.h; y0 += packet_size) {
+		for (int x0 = t.x0; x0 < t.x0 + t.w; x0 += packet_size) {
+			int w = std::min(packet_size, t.x0 + t.w - x0);
+			int h = std::min(packet_size, t.y0 + t.h - y0);
+			tracer.render_tile(x0, y0, w, h, packet, image_width, image_height,
+							   samples_per_pixel, max_depth, cam, pass, first_sample);
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+					sink(x0 + x, y0 + y, packet[y*w + x]);
+		}
+	}
+}
+
+// Packet counterpart of render_tile
+void render_tile_packet(const tile& t, framebuffer& fb, int packet_size,
+						int image_width, int image_height, int samples_per_pixel, int max_depth,
+						const camera& cam, const hittable& world, const path_integrator& integ) {
+	render_tile_packet_samples(t, 0, 0, packet_size, image_width, image_height, samples_per_pixel,
+		max_depth, cam, world, integ,
+		[&](int i, int j, const color& sum) { fb.set(i, j, sum / samples_per_pixel); });
+}
+
+#endif
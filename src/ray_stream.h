@@ -0,0 +1,44 @@
+#ifndef RAY_STREAM_H
+#define RAY_STREAM_H
+
+#include "aligned_vector.h"
+#include "ray.h"
+
+#include <cstdint>
+
+// A batch of rays in structure-of-arrays form, used by the packet renderer so
+// that neighbouring rays can share SIMD lanes. Storage is padded to a multiple
+// of 16 so every kernel can run whole registers past the last ray.
+class ray_stream {
+	public:
+		static const size_t padding = 16;
+
+		void resize(size_t n) {
+			count = n;
+			size_t padded = (n + padding - 1) / padding * padding;
+			ox.resize(padded, 0.0); oy.resize(padded, 0.0); oz.resize(padded, 0.0);
+			dx.resize(padded, 1.0); dy.resize(padded, 0.0); dz.resize(padded, 0.0);
+			t.resize(padded, 0.0);
+			prim.resize(padded, -1);
+		}
+
+		size_t size() const { return count; }
+
+		void set(size_t i, const ray& r) {
+			ox[i] = r.orig.x(); oy[i] = r.orig.y(); oz[i] = r.orig.z();
+			dx[i] = r.dir.x();  dy[i] = r.dir.y();  dz[i] = r.dir.z();
+		}
+
+		ray get(size_t i) const {
+			return ray(point3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+		}
+
+	public:
+		aligned_vector<double> ox, oy, oz;
+		aligned_vector<double> dx, dy, dz;
+		aligned_vector<double> t;      // nearest hit distance, filled in by intersection
+		aligned_vector<int64_t> prim;  // index of the primitive hit, -1 for a miss
+		size_t count = 0;
+};
+
+#endif
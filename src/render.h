@@ -0,0 +1,80 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "tiles.h"
+
+#include <chrono>
+#include <vector>
+
+// Every pixel gets its own random stream so the image does not depend on
+// threading; progressive passes after the first get fresh streams per pass
+inline uint64_t pixel_stream(int i, int j, int image_width, int image_height = 0, int pass = 0) {
+	return (static_cast<uint64_t>(pass) * image_height + j) * image_width + i;
+}
+
+// Camera sample number index through pixel (i, j), jittered within the pixel
+inline color trace_sample(int i, int j, uint32_t index, int image_width, int image_height, int max_depth,
+						  const camera& cam, const hittable& world, const integrator& integ) {
+	start_sample(i, j, index);
+	auto u = (i + random_double()) / (image_width-1);
+	auto v = (j + random_double()) / (image_height-1);
+	ray r = cam.get_ray(u, v);
+	return integ.radiance(r, world, max_depth);
+}
+
+// Traces samples_per_pixel samples for every pixel of a tile, on the random
+// streams of the given pass and from sample index first_sample, and hands each
+// pixel's sum to sink(i, j, sum)
+template <typename Sink>
+void render_tile_samples(const tile& t, int pass, int first_sample, int image_width, int image_height,
+						 int samples_per_pixel, int max_depth, const camera& cam,
+						 const hittable& world, const integrator& integ, Sink&& sink) {
+
+	for (int j = t.y0; j < t.y0 + t.h; ++j) {
+		for (int i = t.x0; i < t.x0 + t.w; ++i) {
+			seed_thread_rng(pixel_stream(i, j, image_width, image_height, pass));
+			color pixel_color(0, 0, 0);
+			for (int s = 0; s < samples_per_pixel; ++s)
+				pixel_color += trace_sample(i, j, uint32_t(first_sample + s),
+											image_width, image_height, max_depth, cam, world, integ);
+			end_sample();
+			sink(i, j, pixel_color);
+		}
+	}
+}
+
+// Renders the pixels of one tile into the framebuffer
+void render_tile(const tile& t, framebuffer& fb, int image_width, int image_height,
+				 int samples_per_pixel, int max_depth, const camera& cam, const hittable& world,
+				 const integrator& integ) {
+	render_tile_samples(t, 0, 0, image_width, image_height, samples_per_pixel, max_depth, cam, world, integ,
+		[&](int i, int j, const color& sum) { fb.set(i, j, sum / samples_per_pixel); });
+}
+
+// Cheap pilot render of a tile: one sample on every stride-th pixel, timed.
+// Only the relative cost between tiles matters.
+double estimate_tile_cost(const tile& t, int image_width, int image_height, int max_depth,
+						  const camera& cam, const hittable& world, const integrator& integ,
+						  int stride = 4) {
+	auto start = std::chrono::steady_clock::now();
+
+	for (int j = t.y0; j < t.y0 + t.h; j += stride) {
+		for (int i = t.x0; i < t.x0 + t.w; i += stride) {
+			// Separate streams from the real render, which reseeds every pixel anyway
+			seed_thread_rng(~pixel_stream(i, j, image_width));
+			trace_sample(i, j, 0, image_width, image_height, max_depth, cam, world, integ);
+			end_sample();
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Image rows that are rendered out of order but must be written in order.
+//
+// Holds a window of capacity rows, starting at the next row to be written.
+// Workers fill any row inside the window and report the pixels they finished;
+// the writer waits for the next row to be complete, writes it and pops it,
+// which moves the window on by one. Rows are numbered in file order, and the
+// producer must not start on a row until it is inside the window, so memory
+// stays at capacity rows however large the image is.
+class row_reorder_buffer {
+	public:
+		row_reorder_buffer(int width, int rows, int capacity)
+			: w(width), h(rows), cap(capacity),
+			  rgb(static_cast<size_t>(width) * capacity * 3), done(capacity, 0) {}
+
+		int capacity() const { return cap; }
+
+		// The next row to be written; rows [next(), next() + capacity()) may be filled.
+		// Only the writer moves it, so the writer may read it without the lock.
+		int next() const { return next_row; }
+		bool in_window(int row) const { return row < next_row + cap; }
+
+		// Storage for a row inside the window, 3 floats per pixel
+		float* row(int r) { return &rgb[static_cast<size_t>(r % cap) * w * 3]; }
+
+		// Marks pixels of row r as written; wakes the writer when that completes the next row
+		void finish(int r, int pixels) {
+			std::lock_guard<std::mutex> l(lock);
+			int& n = done[r % cap];
+			n += pixels;
+			if (r == next_row && n >= w) ready.notify_one();
+		}
+
+		// Blocks until the next row is complete and returns it
+		const float* wait_next() {
+			std::unique_lock<std::mutex> l(lock);
+			ready.wait(l, [this] { return done[next_row % cap] >= w; });
+			return row(next_row);
+		}
+
+		// Frees the next row's slot for row next() + capacity()
+		void pop() {
+			std::lock_guard<std::mutex> l(lock);
+			done[next_row % cap] = 0;
+			++next_row;
+		}
+
+		bool finished() const { return next_row >= h; }
+
+	private:
+		int w, h, cap;
+		std::vector<float> rgb;
+		std::vector<int> done; // pixels finished per slot
+		int next_row = 0;
+
+		std::mutex lock;
+		std::condition_variable ready;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+#include <optional>
+
+// Per-thread random number generation.
+//
+// Every worker owns its own generator, so sampling never touches shared state.
+// Generators are reseeded from (global seed, stream) at the start of each unit
+// of work (a pixel), which makes the rendered image independent of the number
+// of threads and of the order in which tasks are scheduled.
+
+inline uint64_t splitmix64(uint64_t& x) {
+	uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// xoshiro256+ (Blackman & Vigna), good for generating doubles
+class rng {
+	public:
+		rng() { seed(0, 0); }
+		rng(uint64_t seed_value, uint64_t stream) { seed(seed_value, stream); }
+
+		void seed(uint64_t seed_value, uint64_t stream) {
+			uint64_t x = seed_value;
+			x = splitmix64(x) ^ (stream * 0xd1b54a32d192ed03ULL);
+			for (int i = 0; i < 4; ++i)
+				s[i] = splitmix64(x);
+		}
+
+		uint64_t next_u64() {
+			const uint64_t result = s[0] + s[3];
+			const uint64_t t = s[1] << 17;
+
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+
+			return result;
+		}
+
+		double next_double() {
+			// Top 53 bits mapped to [0,1)
+			return (next_u64() >> 11) * 0x1.0p-53;
+		}
+
+	private:
+		uint64_t s[4];
+
+		static uint64_t rotl(const uint64_t x, int k) {
+			return (x << k) | (x >> (64 - k));
+		}
+};
+
+// Global seed shared by every thread; change it to get a different (but still
+// reproducible) image.
+inline uint64_t rng_seed = 0;
+
+// A thread rendering tiles of several jobs at once (the render daemon) sets
+// its job's seed here for each tile instead
+inline thread_local std::optional<uint64_t> job_rng_seed;
+
+inline uint64_t image_seed() { return job_rng_seed ? *job_rng_seed : rng_seed; }
+
+inline rng& thread_rng() {
+	static thread_local rng r;
+	return r;
+}
+
+// Restart the calling thread's generator on the given stream
+inline void seed_thread_rng(uint64_t stream) {
+	thread_rng().seed(image_seed(), stream);
+}
+
+#endif
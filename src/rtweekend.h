@@ -6,12 +6,24 @@
 #include <limits>
 #include <memory>
 
+#include "rng.h"
+#include "sampler.h"
+
 // Usings
 
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Scalar type of vectors, rays, hit records and the camera. Build with
+// -DRT_FLOAT for single precision.
+
+#ifdef RT_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -30,8 +42,11 @@ inline double clamp(double x, double min, double max) {
 }
 
 inline double random_double() {
-	// returns a random real in [0,1)
-	return rand() / (RAND_MAX + 1.0);
+	// returns a random real in [0,1): the next dimension of the current sample,
+	// or from the calling thread's generator when sampling independently
+	sampler_state& s = thread_sampler();
+	if (s.type == sampler_type::independent) return thread_rng().next_double();
+	return s.next();
 }
 
 inline double random_double(double min, double max) {
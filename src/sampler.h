@@ -0,0 +1,312 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Sample sequences for the random numbers of a path.
+//
+// By default every random_double() comes from the pixel's random stream
+// (independent sampling). The other samplers instead return a deterministic
+// value for (pixel, sample index, dimension), where the dimension counts the
+// random numbers used so far in the current sample. Well-spread points in
+// each dimension converge faster than independent ones, so the same noise
+// takes fewer samples per pixel.
+//
+// The render loops call start_sample() before each camera sample and
+// end_sample() after the pixel; integrators move to a fixed dimension block
+// per bounce (bounce_dimension) so that paths which skip roulette or scatter
+// off different materials still use the same dimensions for the same
+// purpose. Since every value is a function of its pixel, sample and
+// dimension, images stay independent of the thread count.
+
+enum class sampler_type : uint8_t {
+	independent, // the pixel's random stream
+	sobol,       // Owen-scrambled Sobol', padded in pairs of dimensions
+	halton,      // Halton with random digit scrambling
+	blue_noise   // one Sobol' sequence per image, rotated per pixel by a blue noise mask
+};
+
+inline const char* sampler_type_name(sampler_type type) {
+	switch (type) {
+		case sampler_type::independent: return "independent";
+		case sampler_type::sobol:       return "sobol";
+		case sampler_type::halton:      return "halton";
+		case sampler_type::blue_noise:  return "blue-noise";
+	}
+	return "?";
+}
+
+inline bool parse_sampler_type(const std::string& name, sampler_type& type) {
+	for (auto t : { sampler_type::independent, sampler_type::sobol, sampler_type::halton, sampler_type::blue_noise }) {
+		if (name == sampler_type_name(t)) {
+			type = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Sampler used by start_sample(); set it with rng_seed before a render
+inline sampler_type render_sampler = sampler_type::independent;
+
+// Per-thread override, like job_rng_seed
+inline thread_local std::optional<sampler_type> job_sampler;
+
+inline sampler_type image_sampler() { return job_sampler ? *job_sampler : render_sampler; }
+
+// Dimensions of one sample: pixel jitter (0, 1), lens (2, 3), then a block
+// per bounce with the scattering (up to 3) and Russian roulette
+const int dimensions_per_bounce = 4;
+const int roulette_dimension = 3; // within a bounce's block
+
+inline uint32_t bounce_dimension(int bounce) {
+	return 4 + static_cast<uint32_t>(bounce) * dimensions_per_bounce;
+}
+
+namespace sampler_detail {
+
+	// Integer hash with good avalanche (Wellons' lowbias32)
+	inline uint32_t hash32(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352dU;
+		x ^= x >> 15;
+		x *= 0x846ca68bU;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+		return hash32(seed ^ (v + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+	}
+
+	inline double to_unit(uint32_t x) {
+		return x * 0x1.0p-32;
+	}
+
+	inline uint32_t reverse_bits(uint32_t x) {
+		x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+		x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+		x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	// Owen scrambling of the bits of x, most significant first (Burley 2020,
+	// "Practical Hash-based Owen Scrambling")
+	inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+		x = reverse_bits(x);
+		x += seed;
+		x ^= x * 0x6c50b47cU;
+		x ^= x * 0xb82f1e52U;
+		x ^= x * 0xc7afe638U;
+		x ^= x * 0x8d22f6e6U;
+		return reverse_bits(x);
+	}
+
+	// The first two Sobol' dimensions: the van der Corput sequence, and the
+	// one whose direction numbers follow v[k] = v[k-1] ^ (v[k-1] >> 1)
+	inline uint32_t sobol_pair(uint32_t index, int dim) {
+		if (dim == 0) return reverse_bits(index);
+		uint32_t x = 0, v = 0x80000000U;
+		for (; index; index >>= 1, v ^= v >> 1)
+			if (index & 1) x ^= v;
+		return x;
+	}
+
+	// Dimension dim of point index: each pair of dimensions is a 2D Sobol'
+	// sequence with its own shuffled order and Owen scrambling, so pairs are
+	// well stratified and uncorrelated with each other
+	inline double sobol_sample(uint32_t index, uint32_t dim, uint32_t seed) {
+		uint32_t pair_seed = hash_combine(seed, dim >> 1);
+		uint32_t shuffled = nested_uniform_scramble(index, pair_seed);
+		uint32_t x = sobol_pair(shuffled, dim & 1);
+		return to_unit(nested_uniform_scramble(x, hash_combine(pair_seed, dim & 1)));
+	}
+
+	const int halton_dimensions = 64;
+	const uint16_t primes[halton_dimensions] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+		137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+		227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+	};
+
+	// Radical inverse of index in the dimension's prime base, each digit
+	// mapped through its own random affine permutation d -> (a d + c) mod base.
+	// That breaks up the correlation between high dimensions of plain Halton;
+	// the leading zeros are scrambled too, down to 2^-32.
+	inline double halton_sample(uint32_t index, uint32_t dim, uint32_t seed) {
+		if (dim >= static_cast<uint32_t>(halton_dimensions))
+			return to_unit(hash_combine(hash_combine(seed, dim), index));
+
+		const uint32_t base = primes[dim];
+		const double inv_base = 1.0 / base;
+		uint32_t dim_seed = hash_combine(seed, dim);
+		double scale = inv_base, result = 0;
+		for (uint32_t level = 0; scale > 0x1.0p-32; ++level, scale *= inv_base) {
+			uint32_t h = hash_combine(dim_seed, level);
+			uint32_t a = 1 + h % (base - 1), c = (h >> 16) % base;
+			result += ((a * (index % base) + c) % base) * scale;
+			index /= base;
+		}
+		return std::min(result, 0x1.fffffffffffffp-1);
+	}
+
+	const int mask_size = 64; // blue noise mask, mask_size x mask_size, toroidal
+
+	// Ranks of a blue noise dither mask by void-and-cluster (Ulichney 1993):
+	// each rank goes to the emptiest spot left by the lower ones, so every
+	// threshold of the mask is an evenly spread set of pixels. Built once.
+	inline std::vector<float> make_blue_noise_mask() {
+		const int n = mask_size, cells = n * n;
+		const double sigma = 1.5;
+
+		// Gaussian energy by toroidal offset
+		std::vector<double> kernel(cells);
+		for (int y = 0; y < n; ++y)
+			for (int x = 0; x < n; ++x) {
+				int dx = std::min(x, n - x), dy = std::min(y, n - y);
+				kernel[y*n + x] = std::exp(-(dx*dx + dy*dy) / (2 * sigma * sigma));
+			}
+
+		std::vector<uint8_t> on(cells, 0);
+		std::vector<double> energy(cells, 0);
+		auto toggle = [&](int c, double sign) {
+			on[c] = sign > 0;
+			int cx = c % n, cy = c / n;
+			for (int y = 0; y < n; ++y)
+				for (int x = 0; x < n; ++x)
+					energy[y*n + x] += sign * kernel[((y - cy + n) % n) * n + (x - cx + n) % n];
+		};
+		// The set pixel in the tightest cluster, or the free pixel in the largest void
+		auto extreme = [&](bool cluster) {
+			int best = -1;
+			for (int c = 0; c < cells; ++c)
+				if (on[c] == cluster && (best < 0 || (cluster ? energy[c] > energy[best] : energy[c] < energy[best])))
+					best = c;
+			return best;
+		};
+
+		// A random tenth of the pixels, relaxed until moving the tightest
+		// cluster's pixel into the largest void puts it back where it was
+		rng r(0x626c7565, 0);
+		int initial = 0;
+		while (initial < cells / 10) {
+			int c = static_cast<int>(r.next_u64() % cells);
+			if (!on[c]) { toggle(c, 1); ++initial; }
+		}
+		for (;;) {
+			int c = extreme(true);
+			toggle(c, -1);
+			int v = extreme(false);
+			toggle(v, 1);
+			if (v == c) break;
+		}
+
+		std::vector<int> rank(cells);
+		std::vector<uint8_t> initial_on = on;
+		std::vector<double> initial_energy = energy;
+
+		// Ranks below the initial pattern: remove the tightest clusters
+		for (int k = initial - 1; k >= 0; --k) {
+			int c = extreme(true);
+			toggle(c, -1);
+			rank[c] = k;
+		}
+
+		// Ranks above it: fill the largest voids. Past half full that is the
+		// same as removing the tightest clusters of the free pixels, as the
+		// free pixels' energy is the total minus the set pixels'.
+		on = initial_on;
+		energy = initial_energy;
+		for (int k = initial; k < cells; ++k) {
+			int v = extreme(false);
+			toggle(v, 1);
+			rank[v] = k;
+		}
+
+		std::vector<float> mask(cells);
+		for (int c = 0; c < cells; ++c)
+			mask[c] = (rank[c] + 0.5f) / cells;
+		return mask;
+	}
+
+	inline const std::vector<float>& blue_noise_mask() {
+		static const std::vector<float> mask = make_blue_noise_mask();
+		return mask;
+	}
+
+	// The image's Sobol' point, shifted mod 1 by the pixel's mask value. Each
+	// dimension reads the mask at its own toroidal offset. Neighbouring pixels
+	// get very different shifts, so their errors are uncorrelated at low
+	// frequencies and the noise looks finer than white noise.
+	inline double blue_noise_sample(uint32_t index, uint32_t dim, uint32_t seed, uint32_t x, uint32_t y) {
+		uint32_t offset = hash_combine(seed ^ 0x5bd1e995U, dim);
+		uint32_t mx = (x + offset) % mask_size, my = (y + (offset >> 8)) % mask_size;
+		double v = sobol_sample(index, dim, seed) + blue_noise_mask()[my * mask_size + mx];
+		return v < 1 ? v : v - 1;
+	}
+
+} // namespace sampler_detail
+
+// Where the calling thread is within a sample
+struct sampler_state {
+	sampler_type type = sampler_type::independent;
+	uint32_t x = 0, y = 0;   // pixel
+	uint32_t seed = 0;       // per pixel, or per image for blue noise
+	uint32_t index = 0;      // sample within the pixel
+	uint32_t dimension = 0;  // next dimension to be drawn
+
+	// The next dimension of the current sample; independent samplers never get here
+	double next() {
+		uint32_t d = dimension++;
+		switch (type) {
+			case sampler_type::sobol:      return sampler_detail::sobol_sample(index, d, seed);
+			case sampler_type::halton:     return sampler_detail::halton_sample(index, d, seed);
+			case sampler_type::blue_noise: return sampler_detail::blue_noise_sample(index, d, seed, x, y);
+			case sampler_type::independent: break;
+		}
+		return thread_rng().next_double();
+	}
+};
+
+inline sampler_state& thread_sampler() {
+	static thread_local sampler_state s;
+	return s;
+}
+
+// Starts sample index of pixel (i, j) on the calling thread with image_sampler().
+// Independent sampling keeps drawing from the thread's generator, which the
+// render loops seed per pixel.
+inline void start_sample(int i, int j, uint32_t index) {
+	sampler_state& s = thread_sampler();
+	s.type = image_sampler();
+	if (s.type == sampler_type::independent) return;
+
+	uint64_t key = image_seed() ^ (s.type == sampler_type::blue_noise ? 0
+		: ((static_cast<uint64_t>(static_cast<uint32_t>(j)) << 32) | static_cast<uint32_t>(i)) + 1);
+	s.x = static_cast<uint32_t>(i);
+	s.y = static_cast<uint32_t>(j);
+	s.seed = static_cast<uint32_t>(splitmix64(key));
+	s.index = index;
+	s.dimension = 0;
+}
+
+// Back to the thread's generator, for everything that is not part of a sample
+inline void end_sample() {
+	thread_sampler().type = sampler_type::independent;
+}
+
+// Continues the current sample at dimension d
+inline void use_sample_dimension(uint32_t d) {
+	thread_sampler().dimension = d;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "sphere_soa.h"
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// The scenes shared by the jobs of a batch or a render daemon.
+
+struct loaded_scene {
+	std::unique_ptr<hittable> world;
+	camera_settings cam;
+};
+
+// Worlds built once and kept for every later job that uses the same scene.
+//
+// Scenes are keyed by content: a built-in one by its name, a scene file by a
+// hash of its text, so an edited file is built again while a copy or a touched
+// file is not. The hash is only recomputed when the file's size or time
+// changes. Safe to share between threads; a scene is built outside the lock,
+// and the least recently used scenes beyond capacity are dropped once no job
+// holds them.
+class scene_cache {
+	public:
+		// Large scenes want the bvh, small ones are fastest as a flat SIMD sphere array
+		static const size_t bvh_threshold = 64;
+
+		explicit scene_cache(size_t capacity = 16) : capacity(capacity) {}
+
+		static bool builtin(const std::string& name) {
+			return name == "random" || name == "scene1" || name == "scene2" || name == "scene3";
+		}
+
+		// The spheres and camera of a built-in scene or a scene file
+		static bool load_data(const std::string& name, scene_data& scene, std::string& error) {
+			if (!builtin(name)) return load_scene(name, scene, error);
+
+			// Built-in scenes draw from a fresh generator in place of the thread's,
+			// so a name gives the same scene whatever the thread rendered before
+			rng scene_rng;
+			sampler_state scene_sampler;
+			std::swap(thread_rng(), scene_rng);
+			std::swap(thread_sampler(), scene_sampler);
+
+			// The cameras of scenes.h
+			if (name == "random")
+				scene = scene_from_list(random_scene(), builtin_camera(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 10));
+			else if (name == "scene1")
+				scene = scene_from_list(scene1(), builtin_camera(point3(13, 0.5, 0), point3(0, 1.5, 0), vec3(0, 1, 0), 13));
+			else if (name == "scene2")
+				scene = scene_from_list(scene2(), builtin_camera(point3(35, 10, 25), point3(0, 1, -12), vec3(0, 1, 0), 50));
+			else
+				scene = scene_from_list(scene3(), builtin_camera(point3(12, 8, -4), point3(1, 0, -1), vec3(-1, 0, 0), 14));
+
+			std::swap(thread_rng(), scene_rng);
+			std::swap(thread_sampler(), scene_sampler);
+			return true;
+		}
+
+		// Built-in scenes keep the world they were tuned with
+		static bool wants_bvh(const std::string& name, const scene_data& scene) {
+			return builtin(name) ? name == "random" : scene.size() > bvh_threshold;
+		}
+
+		// The scene called name: a built-in one or a scene file. Null if it cannot be loaded.
+		std::shared_ptr<const loaded_scene> get(const std::string& name, std::string& error) {
+			uint64_t key;
+			if (!content_key(name, key, error)) return nullptr;
+			{
+				std::lock_guard<std::mutex> l(lock);
+				auto it = scenes.find(key);
+				if (it != scenes.end()) {
+					it->second.used = ++clock;
+					return it->second.scene;
+				}
+			}
+
+			auto s = std::make_shared<loaded_scene>();
+			if (!load(name, *s, error)) return nullptr;
+
+			std::lock_guard<std::mutex> l(lock);
+			auto& e = scenes.emplace(key, entry{ std::move(s), 0 }).first->second; // a racing load may have won
+			e.used = ++clock;
+			std::shared_ptr<const loaded_scene> scene = e.scene; // in use, so evict() keeps it
+			evict();
+			return scene;
+		}
+
+		size_t size() {
+			std::lock_guard<std::mutex> l(lock);
+			return scenes.size();
+		}
+
+	private:
+		struct entry {
+			std::shared_ptr<const loaded_scene> scene;
+			uint64_t used; // clock at the last get()
+		};
+
+		struct file_key {
+			uint64_t stamp; // file_stamp() when hashed
+			uint64_t key;
+		};
+
+		size_t capacity;
+		std::mutex lock;
+		std::map<uint64_t, entry> scenes;
+		std::map<std::string, file_key> files;
+		uint64_t clock = 0;
+
+		// FNV-1a
+		static uint64_t hash(const std::string& bytes, uint64_t h = 14695981039346656037ull) {
+			for (unsigned char c : bytes) {
+				h ^= c;
+				h *= 1099511628211ull;
+			}
+			return h;
+		}
+
+		bool content_key(const std::string& name, uint64_t& key, std::string& error) {
+			if (builtin(name)) {
+				key = hash("builtin:" + name);
+				return true;
+			}
+
+			uint64_t stamp = file_stamp(name);
+			if (stamp == 0) {
+				error = "cannot open " + name;
+				return false;
+			}
+			{
+				std::lock_guard<std::mutex> l(lock);
+				auto it = files.find(name);
+				if (it != files.end() && it->second.stamp == stamp) {
+					key = it->second.key;
+					return true;
+				}
+			}
+
+			std::ifstream in(name, std::ios::binary);
+			std::stringstream text;
+			text << in.rdbuf();
+			if (!in) {
+				error = "cannot read " + name;
+				return false;
+			}
+			key = hash(text.str(), hash("file:"));
+
+			std::lock_guard<std::mutex> l(lock);
+			files[name] = { stamp, key };
+			return true;
+		}
+
+		// Called with the lock held
+		void evict() {
+			while (scenes.size() > capacity) {
+				auto oldest = scenes.end();
+				for (auto it = scenes.begin(); it != scenes.end(); ++it)
+					if (it->second.scene.use_count() == 1 && (oldest == scenes.end() || it->second.used < oldest->second.used))
+						oldest = it;
+				if (oldest == scenes.end()) return; // every scene is in use
+				scenes.erase(oldest);
+			}
+		}
+
+		static camera_settings builtin_camera(point3 lookfrom, point3 lookat, vec3 vup, double focus_dist) {
+			camera_settings c;
+			c.lookfrom = lookfrom;
+			c.lookat = lookat;
+			c.vup = vup;
+			c.vfov = 20;
+			c.aperture = 0.1;
+			c.focus_dist = focus_dist;
+			return c;
+		}
+
+		static bool load(const std::string& name, loaded_scene& s, std::string& error) {
+			scene_data scene;
+			if (!load_data(name, scene, error)) return false;
+			if (wants_bvh(name, scene)) {
+				s.world = std::make_unique<bvh>(scene_objects(scene));
+			} else {
+				auto soa = std::make_unique<sphere_soa>();
+				build_world(scene, *soa);
+				s.world = std::move(soa);
+			}
+			s.cam = scene.cam;
+			return true;
+		}
+};
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "json.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_soa.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Scene files: spheres, their materials and the camera, as JSON text.
+//
+//	{
+//		"camera": { "lookfrom": [13, 2, 3], "lookat": [0, 0, 0], "vup": [0, 1, 0],
+//		            "vfov": 20, "aperture": 0.1, "focus_dist": 10 },
+//		"materials": {
+//			"ground": { "type": "lambertian", "albedo": [0.5, 0.5, 0.5] },
+//			"steel":  { "type": "metal", "albedo": [0.7, 0.6, 0.5], "fuzz": 0.1 },
+//			"glass":  { "type": "dielectric", "ir": 1.5 }
+//		},
+//		"spheres": [
+//			{ "center": [0, -1000, 0], "radius": 1000, "material": "ground" }
+//		]
+//	}
+//
+// Loading a scene also writes a binary cache next to it (path + ".cache"):
+// the same data as flat arrays, which later loads map and copy in bulk instead
+// of parsing text. The cache is keyed on the text file's size and
+// modification time, so editing the scene rebuilds it.
+
+struct camera_settings {
+	point3 lookfrom = point3(13, 2, 3);
+	point3 lookat = point3(0, 0, 0);
+	vec3 vup = vec3(0, 1, 0);
+	double vfov = 20;        // vertical field-of-view in degrees
+	double aperture = 0;
+	double focus_dist = 0;   // 0 focuses on lookat
+
+	camera make(double aspect_ratio) const {
+		double focus = focus_dist > 0 ? focus_dist : (lookfrom - lookat).length();
+		return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus);
+	}
+};
+
+// A scene the way files hold it: spheres as arrays, materials in a table
+struct scene_data {
+	camera_settings cam;
+	std::vector<material> materials;
+	std::vector<double> cx, cy, cz, radius;
+	std::vector<uint32_t> mat;
+
+	size_t size() const { return radius.size(); }
+
+	void add_sphere(const point3& center, double r, uint32_t material_index) {
+		cx.push_back(center.x());
+		cy.push_back(center.y());
+		cz.push_back(center.z());
+		radius.push_back(r);
+		mat.push_back(material_index);
+	}
+};
+
+namespace scene_detail {
+
+	inline const char* material_type_name(material_type t) {
+		switch (t) {
+			case material_type::lambertian: return "lambertian";
+			case material_type::metal:      return "metal";
+			case material_type::dielectric: return "dielectric";
+		}
+		return "?";
+	}
+
+	inline bool read_vec3(json_reader& r, vec3& v) {
+		double e[3];
+		if (!r.numbers(e, 3)) return false;
+		v = vec3(e[0], e[1], e[2]);
+		return true;
+	}
+
+	// Reads the value of key if it is a camera setting; false otherwise, reading nothing
+	inline bool read_camera_field(json_reader& r, const std::string& key, camera_settings& cam) {
+		if (key == "lookfrom") read_vec3(r, cam.lookfrom);
+		else if (key == "lookat") read_vec3(r, cam.lookat);
+		else if (key == "vup") read_vec3(r, cam.vup);
+		else if (key == "vfov") cam.vfov = r.number();
+		else if (key == "aperture") cam.aperture = r.number();
+		else if (key == "focus_dist") cam.focus_dist = r.number();
+		else return false;
+		return true;
+	}
+
+	inline void read_camera(json_reader& r, camera_settings& cam) {
+		std::string key;
+		if (!r.begin_object()) return;
+		while (r.next_key(key))
+			if (!read_camera_field(r, key, cam)) r.skip();
+	}
+
+	inline bool read_material(json_reader& r, material& m) {
+		std::string key, type;
+		color albedo(0.5, 0.5, 0.5);
+		double fuzz = 0, ir = 1.5;
+
+		if (!r.begin_object()) return false;
+		while (r.next_key(key)) {
+			if (key == "type") type = r.string();
+			else if (key == "albedo") read_vec3(r, albedo);
+			else if (key == "fuzz") fuzz = r.number();
+			else if (key == "ir") ir = r.number();
+			else r.skip();
+		}
+		if (!r.ok()) return false;
+
+		if (type == "lambertian") m = lambertian(albedo);
+		else if (type == "metal") m = metal(albedo, fuzz);
+		else if (type == "dielectric") m = dielectric(ir);
+		else {
+			r.fail("unknown material type '" + type + "'");
+			return false;
+		}
+		return true;
+	}
+
+	// Materials are named; spheres may name one before it is defined
+	struct material_names {
+		std::unordered_map<std::string, uint32_t> index;
+		std::vector<bool> defined;
+
+		uint32_t lookup(const std::string& name, scene_data& scene) {
+			auto it = index.find(name);
+			if (it != index.end()) return it->second;
+			uint32_t i = static_cast<uint32_t>(scene.materials.size());
+			scene.materials.push_back(lambertian(color(0, 0, 0)));
+			defined.push_back(false);
+			index.emplace(name, i);
+			return i;
+		}
+	};
+
+	struct cache_header {
+		char magic[8];
+		uint64_t stamp;
+		uint64_t spheres;
+		uint64_t materials;
+		double camera[12];
+	};
+
+	struct cache_material {
+		uint32_t type;
+		uint32_t reserved;
+		double albedo[3];
+		double fuzz, ir;
+	};
+
+	static constexpr char cache_magic[8] = { 'R', 'T', 'S', 'C', 'N', 0, 0, 1 };
+
+	inline size_t align64(size_t n) { return (n + 63) / 64 * 64; }
+
+	// Offsets of the sections of a cache file, each 64-byte aligned
+	struct cache_layout {
+		size_t materials, cx, cy, cz, radius, mat, total;
+
+		cache_layout(uint64_t spheres, uint64_t material_count) {
+			size_t column = align64(spheres * sizeof(double));
+			materials = align64(sizeof(cache_header));
+			cx = align64(materials + material_count * sizeof(cache_material));
+			cy = cx + column;
+			cz = cy + column;
+			radius = cz + column;
+			mat = radius + column;
+			total = mat + spheres * sizeof(uint32_t);
+		}
+	};
+
+} // namespace scene_detail
+
+// Parses scene text into scene. On failure error says what and on which line.
+inline bool parse_scene(const std::string& text, scene_data& scene, std::string& error) {
+	using namespace scene_detail;
+
+	scene = scene_data();
+	material_names names;
+	json_reader r(text);
+	std::string key, sphere_key;
+
+	if (r.begin_object()) {
+		while (r.next_key(key)) {
+			if (key == "camera") {
+				read_camera(r, scene.cam);
+			} else if (key == "materials") {
+				if (!r.begin_object()) break;
+				while (r.next_key(key)) {
+					uint32_t i = names.lookup(key, scene);
+					if (names.defined[i]) r.fail("material '" + key + "' defined twice");
+					read_material(r, scene.materials[i]);
+					names.defined[i] = true;
+				}
+			} else if (key == "spheres") {
+				if (!r.begin_array()) break;
+				while (r.next_item()) {
+					point3 center;
+					double radius = 1;
+					std::string material_name;
+					if (!r.begin_object()) break;
+					while (r.next_key(sphere_key)) {
+						if (sphere_key == "center") read_vec3(r, center);
+						else if (sphere_key == "radius") radius = r.number();
+						else if (sphere_key == "material") material_name = r.string();
+						else r.skip();
+					}
+					if (material_name.empty()) r.fail("sphere without a material");
+					scene.add_sphere(center, radius, names.lookup(material_name, scene));
+				}
+			} else {
+				r.skip();
+			}
+		}
+		if (r.ok() && !r.at_end()) r.fail("text after the scene");
+	}
+
+	for (const auto& [name, i] : names.index)
+		if (r.ok() && !names.defined[i])
+			r.fail("material '" + name + "' is used but not defined");
+
+	error = r.error();
+	return r.ok();
+}
+
+// Writes scene as text that parse_scene reads back; materials are named m0, m1, ...
+inline void write_scene(std::ostream& out, const scene_data& scene) {
+	using namespace scene_detail;
+
+	auto v3 = [&](const vec3& v) {
+		out << '[' << json_number(v.x()) << ", " << json_number(v.y()) << ", " << json_number(v.z()) << ']';
+	};
+
+	const camera_settings& c = scene.cam;
+	out << "{\n\t\"camera\": { \"lookfrom\": "; v3(c.lookfrom);
+	out << ", \"lookat\": "; v3(c.lookat);
+	out << ", \"vup\": "; v3(c.vup);
+	out << ", \"vfov\": " << json_number(c.vfov) << ", \"aperture\": " << json_number(c.aperture)
+		<< ", \"focus_dist\": " << json_number(c.focus_dist) << " },\n";
+
+	out << "\t\"materials\": {\n";
+	for (size_t i = 0; i < scene.materials.size(); ++i) {
+		const material& m = scene.materials[i];
+		out << "\t\t\"m" << i << "\": { \"type\": \"" << material_type_name(m.type) << '"';
+		if (m.type != material_type::dielectric) { out << ", \"albedo\": "; v3(m.albedo); }
+		if (m.type == material_type::metal) out << ", \"fuzz\": " << json_number(m.fuzz);
+		if (m.type == material_type::dielectric) out << ", \"ir\": " << json_number(m.ir);
+		out << (i + 1 < scene.materials.size() ? " },\n" : " }\n");
+	}
+	out << "\t},\n";
+
+	out << "\t\"spheres\": [\n";
+	for (size_t i = 0; i < scene.size(); ++i) {
+		out << "\t\t{ \"center\": [" << json_number(scene.cx[i]) << ", " << json_number(scene.cy[i])
+			<< ", " << json_number(scene.cz[i]) << "], \"radius\": " << json_number(scene.radius[i]) << ", \"material\": \"m" << scene.mat[i] << '"'
+			<< (i + 1 < scene.size() ? " },\n" : " }\n");
+	}
+	out << "\t]\n}\n";
+}
+
+// Size and modification time of a file, 0 if it does not exist
+inline uint64_t file_stamp(const std::string& path) {
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0) return 0;
+	uint64_t x = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + st.st_mtim.tv_nsec;
+	return splitmix64(x) ^ static_cast<uint64_t>(st.st_size) ^ 1;
+}
+
+inline bool write_scene_cache(const std::string& path, const scene_data& scene, uint64_t stamp) {
+	using namespace scene_detail;
+
+	cache_layout layout(scene.size(), scene.materials.size());
+	std::vector<uint8_t> bytes(layout.total, 0);
+
+	cache_header hdr;
+	std::memcpy(hdr.magic, cache_magic, sizeof(hdr.magic));
+	hdr.stamp = stamp;
+	hdr.spheres = scene.size();
+	hdr.materials = scene.materials.size();
+	const camera_settings& c = scene.cam;
+	double cam[12] = { c.lookfrom.x(), c.lookfrom.y(), c.lookfrom.z(), c.lookat.x(), c.lookat.y(), c.lookat.z(),
+					   c.vup.x(), c.vup.y(), c.vup.z(), c.vfov, c.aperture, c.focus_dist };
+	std::memcpy(hdr.camera, cam, sizeof(cam));
+	std::memcpy(bytes.data(), &hdr, sizeof(hdr));
+
+	for (size_t i = 0; i < scene.materials.size(); ++i) {
+		const material& m = scene.materials[i];
+		cache_material cm = { static_cast<uint32_t>(m.type), 0,
+							  { m.albedo.x(), m.albedo.y(), m.albedo.z() }, m.fuzz, m.ir };
+		std::memcpy(bytes.data() + layout.materials + i * sizeof(cm), &cm, sizeof(cm));
+	}
+
+	size_t column = scene.size() * sizeof(double);
+	if (scene.size() > 0) {
+		std::memcpy(bytes.data() + layout.cx, scene.cx.data(), column);
+		std::memcpy(bytes.data() + layout.cy, scene.cy.data(), column);
+		std::memcpy(bytes.data() + layout.cz, scene.cz.data(), column);
+		std::memcpy(bytes.data() + layout.radius, scene.radius.data(), column);
+		std::memcpy(bytes.data() + layout.mat, scene.mat.data(), scene.size() * sizeof(uint32_t));
+	}
+
+	// Written aside and renamed, so a reader never maps a half-written cache
+	std::string tmp = path + ".tmp";
+	std::FILE* f = std::fopen(tmp.c_str(), "wb");
+	if (!f) return false;
+	bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+	ok = (std::fclose(f) == 0) && ok;
+	return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Returns false, leaving scene untouched, unless path is a valid cache made with stamp
+inline bool read_scene_cache(const std::string& path, uint64_t stamp, scene_data& scene) {
+	using namespace scene_detail;
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	bool ok = ::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(cache_header);
+	size_t size = ok ? static_cast<size_t>(st.st_size) : 0;
+	void* map = ok ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	::close(fd);
+	if (map == MAP_FAILED) return false;
+
+	const uint8_t* bytes = static_cast<const uint8_t*>(map);
+	cache_header hdr;
+	std::memcpy(&hdr, bytes, sizeof(hdr));
+	ok = std::memcmp(hdr.magic, cache_magic, sizeof(hdr.magic)) == 0 && hdr.stamp == stamp;
+
+	cache_layout layout(ok ? hdr.spheres : 0, ok ? hdr.materials : 0);
+	ok = ok && layout.total == size;
+
+	if (ok) {
+		scene_data loaded;
+		const double* cam = hdr.camera;
+		loaded.cam.lookfrom = point3(cam[0], cam[1], cam[2]);
+		loaded.cam.lookat = point3(cam[3], cam[4], cam[5]);
+		loaded.cam.vup = vec3(cam[6], cam[7], cam[8]);
+		loaded.cam.vfov = cam[9];
+		loaded.cam.aperture = cam[10];
+		loaded.cam.focus_dist = cam[11];
+
+		for (uint64_t i = 0; i < hdr.materials && ok; ++i) {
+			cache_material cm;
+			std::memcpy(&cm, bytes + layout.materials + i * sizeof(cm), sizeof(cm));
+			color albedo(cm.albedo[0], cm.albedo[1], cm.albedo[2]);
+			switch (static_cast<material_type>(cm.type)) {
+				case material_type::lambertian: loaded.materials.push_back(lambertian(albedo)); break;
+				case material_type::metal:      loaded.materials.push_back(metal(albedo, cm.fuzz)); break;
+				case material_type::dielectric: loaded.materials.push_back(dielectric(cm.ir)); break;
+				default: ok = false;
+			}
+		}
+
+		const double* cx = reinterpret_cast<const double*>(bytes + layout.cx);
+		const double* cy = reinterpret_cast<const double*>(bytes + layout.cy);
+		const double* cz = reinterpret_cast<const double*>(bytes + layout.cz);
+		const double* radius = reinterpret_cast<const double*>(bytes + layout.radius);
+		const uint32_t* mat = reinterpret_cast<const uint32_t*>(bytes + layout.mat);
+		loaded.cx.assign(cx, cx + hdr.spheres);
+		loaded.cy.assign(cy, cy + hdr.spheres);
+		loaded.cz.assign(cz, cz + hdr.spheres);
+		loaded.radius.assign(radius, radius + hdr.spheres);
+		loaded.mat.assign(mat, mat + hdr.spheres);
+
+		for (uint32_t m : loaded.mat)
+			if (m >= loaded.materials.size()) ok = false;
+
+		if (ok) scene = std::move(loaded);
+	}
+
+	::munmap(map, size);
+	return ok;
+}
+
+// Loads a scene file through its cache, refreshing the cache if it is stale
+inline bool load_scene(const std::string& path, scene_data& scene, std::string& error) {
+	uint64_t stamp = file_stamp(path);
+	if (stamp == 0) {
+		error = "cannot open " + path;
+		return false;
+	}
+
+	const std::string cache_path = path + ".cache";
+	if (read_scene_cache(cache_path, stamp, scene))
+		return true;
+
+	std::ifstream in(path, std::ios::binary);
+	std::stringstream text;
+	text << in.rdbuf();
+	if (!parse_scene(text.str(), scene, error)) {
+		error = path + ": " + error;
+		return false;
+	}
+
+	// Not being able to write the cache only costs the next load some time
+	write_scene_cache(cache_path, scene, stamp);
+	return true;
+}
+
+// The scene as objects for the generic hittables (bvh, hittable_list)
+inline hittable_list scene_objects(const scene_data& scene) {
+	std::vector<shared_ptr<material>> mats;
+	for (const material& m : scene.materials)
+		mats.push_back(make_shared<material>(m));
+
+	hittable_list world;
+	world.objects.reserve(scene.size());
+	for (size_t i = 0; i < scene.size(); ++i)
+		world.add(make_shared<sphere>(point3(scene.cx[i], scene.cy[i], scene.cz[i]), scene.radius[i],
+									  mats[scene.mat[i]]));
+	return world;
+}
+
+// Loads the scene straight into a sphere_soa, without any per-sphere objects
+inline void build_world(const scene_data& scene, sphere_soa& world) {
+	world.assign(scene.cx.data(), scene.cy.data(), scene.cz.data(), scene.radius.data(),
+				 scene.mat.data(), scene.size(), scene.materials);
+}
+
+// The spheres of a hittable_list, for saving a scene built in code
+inline scene_data scene_from_list(const hittable_list& list, const camera_settings& cam) {
+	scene_data scene;
+	scene.cam = cam;
+	std::unordered_map<const material*, uint32_t> index;
+
+	for (const auto& object : list.objects) {
+		auto s = std::dynamic_pointer_cast<sphere>(object);
+		if (!s) continue;
+		auto it = index.find(s->mat_ptr.get());
+		if (it == index.end()) {
+			it = index.emplace(s->mat_ptr.get(), static_cast<uint32_t>(scene.materials.size())).first;
+			scene.materials.push_back(*s->mat_ptr);
+		}
+		scene.add_sphere(s->center, s->radius, it->second);
+	}
+	return scene;
+}
+
+#endif
@@ -3,6 +3,51 @@
 
 #include "hittable.h"
 #include "rtweekend.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Nearest intersection of r with a sphere in (t_min, t_max).
+//
+// The textbook half_b*half_b - a*c discriminant loses most of its bits in float
+// when the ray grazes the sphere or the sphere is large next to its distance,
+// like the ground spheres of the scenes. Here the discriminant comes from the
+// distance between the centre and the ray's line, and the roots are taken in
+// the order that avoids subtracting nearly equal values.
+template <typename T>
+inline bool hit_sphere(const vec3_t<T>& center, T radius, const ray_t<T>& r, T t_min, T t_max, T& t) {
+	vec3_t<T> oc = r.origin() - center;
+	vec3_t<T> d = r.direction();
+	T a = d.length_squared();
+	T half_b = dot(oc, d);
+	T c = oc.length_squared() - radius*radius;
+
+	// Centre to the closest point of the line
+	T l = (oc - (half_b / a) * d).length();
+	T discriminant = a * (radius - l) * (radius + l);
+	if (discriminant < 0) return false;
+
+	T q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+	T near = c / q, far = q / a;
+	if (near > far) std::swap(near, far);
+
+	// Find the nearest root that lies in the acceptable range
+	t = near;
+	if (t < t_min || t_max < t) {
+		t = far;
+		if (t < t_min || t_max < t)
+			return false;
+	}
+	return true;
+}
+
+// Rounding error bound of a hit point on a sphere
+template <typename T>
+inline T sphere_hit_error(const vec3_t<T>& center, T radius) {
+	return hit_error<T>(std::max({ std::fabs(center.x()), std::fabs(center.y()), std::fabs(center.z()) }) + radius);
+}
 
 class sphere : public hittable {
 	public:
@@ -14,36 +59,33 @@ class sphere : public hittable {
 		virtual bool hit(
 			const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+		virtual bool bounding_box(aabb& output_box) const override;
+
 	public:
 		point3 center;
-		double radius;
+		real radius;
 		shared_ptr<material> mat_ptr;
 };
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	vec3 oc = r.origin() - center;
-	auto a = r.direction().length_squared();
-	auto half_b = dot(oc, r.direction());
-	auto c = oc.length_squared() - radius*radius;
-
-	auto discriminant = half_b*half_b - a*c;
-	if (discriminant < 0) return false;
-	auto sqrtd = sqrt(discriminant);
-
-	// Find the nearest root that lies in the acceptable range
-	auto root = (-half_b - sqrtd) / a;
-	if (root < t_min || t_max < root) {
-		root = (-half_b + sqrtd) / a;
-		if (root < t_min || t_max < root)
-			return false;
-	}
+	real root;
+	if (stats_enabled) thread_stats().sphere_tests += 1;
+	if (!hit_sphere<real>(center, radius, r, t_min, t_max, root))
+		return false;
 
 	rec.t = root;
 	rec.p = r.at(rec.t);
 	vec3 outward_normal = (rec.p - center) / radius;
 	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mat_ptr;
+	rec.mat_ptr = mat_ptr.get();
+	rec.error = sphere_hit_error<real>(center, radius);
+
+	return true;
+}
 
+bool sphere::bounding_box(aabb& output_box) const {
+	vec3 extent(radius, radius, radius);
+	output_box = aabb(center - extent, center + extent);
 	return true;
 }
 
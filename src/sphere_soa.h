@@ -0,0 +1,462 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "aligned_vector.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "ray_stream.h"
+#include "rtweekend.h"
+#include "sphere.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// All the spheres of a scene in structure-of-arrays form.
+//
+// One ray is tested against a whole register of spheres at a time (8 with
+// AVX-512, 4 with AVX2, 1 without either), keeping the nearest t and its sphere
+// index per lane and reducing them only once at the end. Objects that are not
+// spheres are kept in a regular hittable_list and tested after the spheres.
+class sphere_soa : public hittable {
+	public:
+#if defined(__AVX512F__)
+		static const int lanes = 8;
+#elif defined(__AVX2__)
+		static const int lanes = 4;
+#else
+		static const int lanes = 1;
+#endif
+
+		sphere_soa() {}
+		sphere_soa(const hittable_list& list) { build(list); }
+
+		void build(const hittable_list& list);
+		void add(point3 center, double radius, shared_ptr<material> m);
+
+		// Bulk load from arrays, as kept by a scene file: n spheres, each using
+		// an entry of the material table. Nothing is allocated per sphere.
+		void assign(const double* xs, const double* ys, const double* zs, const double* radii,
+					const uint32_t* mats, size_t n, const std::vector<material>& table);
+
+		size_t size() const { return count; }
+
+		// Moves sphere k, in the order they were added
+		void move_sphere(size_t k, const point3& center) {
+			cx[k] = center.x();
+			cy[k] = center.y();
+			cz[k] = center.z();
+		}
+
+		virtual bool hit(
+			const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+		virtual bool bounding_box(aabb& output_box) const override;
+
+		// Nearest sphere for every ray of a stream, with rays instead of spheres
+		// across the SIMD lanes. Fills rs.t and rs.prim.
+		void intersect_stream(ray_stream& rs, double t_min, double t_max) const;
+
+		// Completes the hit record of ray i after intersect_stream
+		bool stream_hit(const ray_stream& rs, size_t i, double t_min, hit_record& rec) const;
+
+	private:
+		aligned_vector<double> cx, cy, cz, radius;
+		aligned_vector<uint32_t> mat_index;
+		size_t count = 0;
+
+		// Material table: each distinct material copied in once, by value
+		std::vector<material> materials;
+		hittable_list others;
+
+		uint32_t material_index(const shared_ptr<material>& m);
+		void pad();
+
+		// Returns the index of the nearest sphere hit in (t_min, t_max), or -1
+		long nearest(const ray& r, double t_min, double t_max, double& t_hit) const;
+
+		void fill_record(const ray& r, long i, double t, hit_record& rec) const;
+};
+
+void sphere_soa::build(const hittable_list& list) {
+	cx.clear(); cy.clear(); cz.clear(); radius.clear(); mat_index.clear();
+	materials.clear();
+	count = 0;
+	others.clear();
+
+	for (const auto& object : list.objects) {
+		if (auto s = std::dynamic_pointer_cast<sphere>(object))
+			add(s->center, s->radius, s->mat_ptr);
+		else
+			others.add(object);
+	}
+}
+
+void sphere_soa::add(point3 center, double r, shared_ptr<material> m) {
+	// Drop the padding from the previous add before appending
+	cx.resize(count); cy.resize(count); cz.resize(count);
+	radius.resize(count); mat_index.resize(count);
+
+	cx.push_back(center.x());
+	cy.push_back(center.y());
+	cz.push_back(center.z());
+	radius.push_back(r);
+	mat_index.push_back(material_index(m));
+	++count;
+
+	pad();
+}
+
+void sphere_soa::assign(const double* xs, const double* ys, const double* zs, const double* radii,
+						const uint32_t* mats, size_t n, const std::vector<material>& table) {
+	cx.assign(xs, xs + n);
+	cy.assign(ys, ys + n);
+	cz.assign(zs, zs + n);
+	radius.assign(radii, radii + n);
+	mat_index.assign(mats, mats + n);
+	materials = table;
+	count = n;
+	others.clear();
+	pad();
+}
+
+uint32_t sphere_soa::material_index(const shared_ptr<material>& m) {
+	for (uint32_t i = 0; i < materials.size(); ++i) {
+		const material& t = materials[i];
+		if (t.type == m->type && t.fuzz == m->fuzz && t.ir == m->ir && t.albedo.x() == m->albedo.x()
+			&& t.albedo.y() == m->albedo.y() && t.albedo.z() == m->albedo.z())
+			return i;
+	}
+
+	materials.push_back(*m);
+	return static_cast<uint32_t>(materials.size() - 1);
+}
+
+void sphere_soa::pad() {
+	// A NaN radius makes every comparison in the kernel fail, so padding lanes never hit
+	size_t padded = (count + lanes - 1) / lanes * lanes;
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	cx.resize(padded, 0.0); cy.resize(padded, 0.0); cz.resize(padded, 0.0);
+	radius.resize(padded, nan);
+	mat_index.resize(padded, 0);
+}
+
+long sphere_soa::nearest(const ray& r, double t_min, double t_max, double& t_hit) const {
+	// The arrays and kernels are double whatever real is
+	const vec3_t<double> o(r.origin());
+	const vec3_t<double> d(r.direction());
+	const double a = d.length_squared();
+	if (stats_enabled) thread_stats().sphere_tests += count;
+
+#if defined(__AVX512F__)
+	const size_t padded = radius.size();
+	const __m512d ox = _mm512_set1_pd(o.x()), oy = _mm512_set1_pd(o.y()), oz = _mm512_set1_pd(o.z());
+	const __m512d dx = _mm512_set1_pd(d.x()), dy = _mm512_set1_pd(d.y()), dz = _mm512_set1_pd(d.z());
+	const __m512d va = _mm512_set1_pd(a);
+	const __m512d vt_min = _mm512_set1_pd(t_min);
+	const __m512d zero = _mm512_setzero_pd();
+
+	__m512d best_t = _mm512_set1_pd(t_max);
+	__m512i best_i = _mm512_set1_epi64(-1);
+	__m512i idx = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m512i step = _mm512_set1_epi64(lanes);
+
+	for (size_t i = 0; i < padded; i += lanes) {
+		__m512d ocx = _mm512_sub_pd(ox, _mm512_load_pd(&cx[i]));
+		__m512d ocy = _mm512_sub_pd(oy, _mm512_load_pd(&cy[i]));
+		__m512d ocz = _mm512_sub_pd(oz, _mm512_load_pd(&cz[i]));
+		__m512d rad = _mm512_load_pd(&radius[i]);
+
+		__m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)),
+			_mm512_mul_pd(ocz, dz));
+		__m512d oc_len2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)),
+			_mm512_mul_pd(ocz, ocz));
+		__m512d c = _mm512_sub_pd(oc_len2, _mm512_mul_pd(rad, rad));
+		__m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(va, c));
+		__mmask8 m = _mm512_cmp_pd_mask(disc, zero, _CMP_GE_OQ);
+		if (!m) { idx = _mm512_add_epi64(idx, step); continue; }
+
+		__m512d sqrtd = _mm512_sqrt_pd(_mm512_max_pd(disc, zero));
+		__m512d neg_b = _mm512_sub_pd(zero, half_b);
+		__m512d root1 = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), va);
+		__m512d root2 = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), va);
+
+		__mmask8 ok1 = m & _mm512_cmp_pd_mask(root1, vt_min, _CMP_GE_OQ)
+		                 & _mm512_cmp_pd_mask(root1, best_t, _CMP_LE_OQ);
+		__mmask8 ok2 = m & ~ok1 & _mm512_cmp_pd_mask(root2, vt_min, _CMP_GE_OQ)
+		                 & _mm512_cmp_pd_mask(root2, best_t, _CMP_LE_OQ);
+
+		__m512d root = _mm512_mask_blend_pd(ok1, root2, root1);
+		__mmask8 closer = (ok1 | ok2) & _mm512_cmp_pd_mask(root, best_t, _CMP_LT_OQ);
+
+		best_t = _mm512_mask_blend_pd(closer, best_t, root);
+		best_i = _mm512_mask_blend_epi64(closer, best_i, idx);
+		idx = _mm512_add_epi64(idx, step);
+	}
+
+	alignas(64) double lane_t[lanes];
+	alignas(64) int64_t lane_i[lanes];
+	_mm512_store_pd(lane_t, best_t);
+	_mm512_store_si512(lane_i, best_i);
+#elif defined(__AVX2__)
+	const size_t padded = radius.size();
+	const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+	const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+	const __m256d va = _mm256_set1_pd(a);
+	const __m256d vt_min = _mm256_set1_pd(t_min);
+	const __m256d zero = _mm256_setzero_pd();
+
+	__m256d best_t = _mm256_set1_pd(t_max);
+	__m256d best_i = _mm256_set1_pd(-1.0);
+	__m256d idx = _mm256_setr_pd(0, 1, 2, 3);
+	const __m256d step = _mm256_set1_pd(lanes);
+
+	for (size_t i = 0; i < padded; i += lanes) {
+		__m256d ocx = _mm256_sub_pd(ox, _mm256_load_pd(&cx[i]));
+		__m256d ocy = _mm256_sub_pd(oy, _mm256_load_pd(&cy[i]));
+		__m256d ocz = _mm256_sub_pd(oz, _mm256_load_pd(&cz[i]));
+		__m256d rad = _mm256_load_pd(&radius[i]);
+
+		__m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+			_mm256_mul_pd(ocz, dz));
+		__m256d oc_len2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+			_mm256_mul_pd(ocz, ocz));
+		__m256d c = _mm256_sub_pd(oc_len2, _mm256_mul_pd(rad, rad));
+		__m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+		__m256d m = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+		if (_mm256_movemask_pd(m) == 0) { idx = _mm256_add_pd(idx, step); continue; }
+
+		__m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+		__m256d neg_b = _mm256_sub_pd(zero, half_b);
+		__m256d root1 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), va);
+		__m256d root2 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), va);
+
+		__m256d ok1 = _mm256_and_pd(m, _mm256_and_pd(
+			_mm256_cmp_pd(root1, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root1, best_t, _CMP_LE_OQ)));
+		__m256d ok2 = _mm256_andnot_pd(ok1, _mm256_and_pd(m, _mm256_and_pd(
+			_mm256_cmp_pd(root2, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root2, best_t, _CMP_LE_OQ))));
+
+		__m256d root = _mm256_blendv_pd(root2, root1, ok1);
+		__m256d closer = _mm256_and_pd(_mm256_or_pd(ok1, ok2), _mm256_cmp_pd(root, best_t, _CMP_LT_OQ));
+
+		best_t = _mm256_blendv_pd(best_t, root, closer);
+		best_i = _mm256_blendv_pd(best_i, idx, closer);
+		idx = _mm256_add_pd(idx, step);
+	}
+
+	// Sphere indices are carried as doubles, exact for any realistic scene size
+	alignas(32) double lane_t[lanes];
+	alignas(32) double lane_i[lanes];
+	_mm256_store_pd(lane_t, best_t);
+	_mm256_store_pd(lane_i, best_i);
+#else
+	double lane_t[1] = { t_max };
+	long lane_i[1] = { -1 };
+
+	for (size_t i = 0; i < count; ++i) {
+		vec3_t<double> oc = o - vec3_t<double>(cx[i], cy[i], cz[i]);
+		auto half_b = dot(oc, d);
+		auto c = oc.length_squared() - radius[i]*radius[i];
+
+		auto discriminant = half_b*half_b - a*c;
+		if (discriminant < 0) continue;
+		auto sqrtd = sqrt(discriminant);
+
+		auto root = (-half_b - sqrtd) / a;
+		if (root < t_min || lane_t[0] < root) {
+			root = (-half_b + sqrtd) / a;
+			if (root < t_min || lane_t[0] < root)
+				continue;
+		}
+
+		if (root < lane_t[0]) {
+			lane_t[0] = root;
+			lane_i[0] = static_cast<long>(i);
+		}
+	}
+#endif
+
+	long best = -1;
+	t_hit = t_max;
+	for (int l = 0; l < lanes; ++l) {
+		if (lane_i[l] >= 0 && lane_t[l] < t_hit) {
+			t_hit = lane_t[l];
+			best = static_cast<long>(lane_i[l]);
+		}
+	}
+
+	return best;
+}
+
+void sphere_soa::fill_record(const ray& r, long i, double t, hit_record& rec) const {
+	point3 center(cx[i], cy[i], cz[i]);
+	rec.t = t;
+	rec.p = r.at(t);
+	vec3 outward_normal = (rec.p - center) / radius[i];
+	rec.set_face_normal(r, outward_normal);
+	rec.mat_ptr = &materials[mat_index[i]];
+	rec.error = sphere_hit_error<real>(center, radius[i]);
+}
+
+bool sphere_soa::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	double t;
+	long i = nearest(r, t_min, t_max, t);
+
+	if (i >= 0) {
+		fill_record(r, i, t, rec);
+		t_max = t;
+	}
+
+	if (!others.objects.empty() && others.hit(r, t_min, t_max, rec))
+		return true;
+
+	return i >= 0;
+}
+
+void sphere_soa::intersect_stream(ray_stream& rs, double t_min, double t_max) const {
+#if defined(__AVX512F__) || defined(__AVX2__)
+	// The scalar fallback counts its tests in nearest()
+	if (stats_enabled) thread_stats().sphere_tests += count * rs.size();
+#endif
+
+#if defined(__AVX512F__)
+	const __m512d vt_min = _mm512_set1_pd(t_min);
+	const __m512d zero = _mm512_setzero_pd();
+
+	for (size_t j = 0; j < rs.size(); j += lanes) {
+		const __m512d ox = _mm512_load_pd(&rs.ox[j]), oy = _mm512_load_pd(&rs.oy[j]), oz = _mm512_load_pd(&rs.oz[j]);
+		const __m512d dx = _mm512_load_pd(&rs.dx[j]), dy = _mm512_load_pd(&rs.dy[j]), dz = _mm512_load_pd(&rs.dz[j]);
+		const __m512d va = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+			_mm512_mul_pd(dz, dz));
+
+		__m512d best_t = _mm512_set1_pd(t_max);
+		__m512i best_i = _mm512_set1_epi64(-1);
+
+		for (size_t i = 0; i < count; ++i) {
+			__m512d ocx = _mm512_sub_pd(ox, _mm512_set1_pd(cx[i]));
+			__m512d ocy = _mm512_sub_pd(oy, _mm512_set1_pd(cy[i]));
+			__m512d ocz = _mm512_sub_pd(oz, _mm512_set1_pd(cz[i]));
+			__m512d rad = _mm512_set1_pd(radius[i]);
+
+			__m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)),
+				_mm512_mul_pd(ocz, dz));
+			__m512d oc_len2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)),
+				_mm512_mul_pd(ocz, ocz));
+			__m512d c = _mm512_sub_pd(oc_len2, _mm512_mul_pd(rad, rad));
+			__m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(va, c));
+			__mmask8 m = _mm512_cmp_pd_mask(disc, zero, _CMP_GE_OQ);
+			if (!m) continue;
+
+			__m512d sqrtd = _mm512_sqrt_pd(_mm512_max_pd(disc, zero));
+			__m512d neg_b = _mm512_sub_pd(zero, half_b);
+			__m512d root1 = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), va);
+			__m512d root2 = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), va);
+
+			__mmask8 ok1 = m & _mm512_cmp_pd_mask(root1, vt_min, _CMP_GE_OQ)
+			                 & _mm512_cmp_pd_mask(root1, best_t, _CMP_LE_OQ);
+			__mmask8 ok2 = m & ~ok1 & _mm512_cmp_pd_mask(root2, vt_min, _CMP_GE_OQ)
+			                 & _mm512_cmp_pd_mask(root2, best_t, _CMP_LE_OQ);
+
+			__m512d root = _mm512_mask_blend_pd(ok1, root2, root1);
+			__mmask8 closer = (ok1 | ok2) & _mm512_cmp_pd_mask(root, best_t, _CMP_LT_OQ);
+
+			best_t = _mm512_mask_blend_pd(closer, best_t, root);
+			best_i = _mm512_mask_blend_epi64(closer, best_i, _mm512_set1_epi64(static_cast<int64_t>(i)));
+		}
+
+		_mm512_store_pd(&rs.t[j], best_t);
+		_mm512_store_si512(&rs.prim[j], best_i);
+	}
+#elif defined(__AVX2__)
+	const __m256d vt_min = _mm256_set1_pd(t_min);
+	const __m256d zero = _mm256_setzero_pd();
+
+	for (size_t j = 0; j < rs.size(); j += lanes) {
+		const __m256d ox = _mm256_load_pd(&rs.ox[j]), oy = _mm256_load_pd(&rs.oy[j]), oz = _mm256_load_pd(&rs.oz[j]);
+		const __m256d dx = _mm256_load_pd(&rs.dx[j]), dy = _mm256_load_pd(&rs.dy[j]), dz = _mm256_load_pd(&rs.dz[j]);
+		const __m256d va = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+			_mm256_mul_pd(dz, dz));
+
+		__m256d best_t = _mm256_set1_pd(t_max);
+		__m256d best_i = _mm256_set1_pd(-1.0);
+
+		for (size_t i = 0; i < count; ++i) {
+			__m256d ocx = _mm256_sub_pd(ox, _mm256_set1_pd(cx[i]));
+			__m256d ocy = _mm256_sub_pd(oy, _mm256_set1_pd(cy[i]));
+			__m256d ocz = _mm256_sub_pd(oz, _mm256_set1_pd(cz[i]));
+			__m256d rad = _mm256_set1_pd(radius[i]);
+
+			__m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+				_mm256_mul_pd(ocz, dz));
+			__m256d oc_len2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+				_mm256_mul_pd(ocz, ocz));
+			__m256d c = _mm256_sub_pd(oc_len2, _mm256_mul_pd(rad, rad));
+			__m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+			__m256d m = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+			if (_mm256_movemask_pd(m) == 0) continue;
+
+			__m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+			__m256d neg_b = _mm256_sub_pd(zero, half_b);
+			__m256d root1 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), va);
+			__m256d root2 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), va);
+
+			__m256d ok1 = _mm256_and_pd(m, _mm256_and_pd(
+				_mm256_cmp_pd(root1, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root1, best_t, _CMP_LE_OQ)));
+			__m256d ok2 = _mm256_andnot_pd(ok1, _mm256_and_pd(m, _mm256_and_pd(
+				_mm256_cmp_pd(root2, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root2, best_t, _CMP_LE_OQ))));
+
+			__m256d root = _mm256_blendv_pd(root2, root1, ok1);
+			__m256d closer = _mm256_and_pd(_mm256_or_pd(ok1, ok2), _mm256_cmp_pd(root, best_t, _CMP_LT_OQ));
+
+			best_t = _mm256_blendv_pd(best_t, root, closer);
+			best_i = _mm256_blendv_pd(best_i, _mm256_set1_pd(static_cast<double>(i)), closer);
+		}
+
+		alignas(32) double lane_i[lanes];
+		_mm256_store_pd(&rs.t[j], best_t);
+		_mm256_store_pd(lane_i, best_i);
+		for (int l = 0; l < lanes; ++l)
+			rs.prim[j + l] = static_cast<int64_t>(lane_i[l]);
+	}
+#else
+	for (size_t j = 0; j < rs.size(); ++j)
+		rs.prim[j] = nearest(rs.get(j), t_min, t_max, rs.t[j]);
+#endif
+}
+
+bool sphere_soa::stream_hit(const ray_stream& rs, size_t i, double t_min, hit_record& rec) const {
+	ray r = rs.get(i);
+	bool hit_sphere = rs.prim[i] >= 0;
+
+	if (hit_sphere)
+		fill_record(r, static_cast<long>(rs.prim[i]), rs.t[i], rec);
+
+	if (!others.objects.empty() && others.hit(r, t_min, rs.t[i], rec))
+		return true;
+
+	return hit_sphere;
+}
+
+bool sphere_soa::bounding_box(aabb& output_box) const {
+	output_box = aabb();
+	for (size_t i = 0; i < count; ++i) {
+		vec3 extent(radius[i], radius[i], radius[i]);
+		point3 center(cx[i], cy[i], cz[i]);
+		output_box.expand(aabb(center - extent, center + extent));
+	}
+
+	if (others.objects.empty())
+		return count > 0;
+
+	aabb box;
+	if (!others.bounding_box(box)) return false;
+	output_box.expand(box);
+	return true;
+}
+
+#endif
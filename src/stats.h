@@ -0,0 +1,263 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Render statistics and task timelines.
+//
+// Compiled in only with -DRT_STATS. Every counting site is written as
+//
+//	if (stats_enabled) thread_stats().rays += 1;
+//
+// so without the flag the condition is a constant false and the code
+// disappears. With it, each thread bumps its own counters without atomic
+// read-modify-writes or locks; collect_stats() merges them after a render.
+
+#ifdef RT_STATS
+const bool stats_enabled = true;
+#else
+const bool stats_enabled = false;
+#endif
+
+// A counter written by one thread and read by others between renders. Relaxed
+// loads and stores are plain moves, but keep the reads from being data races.
+class stat_counter {
+	public:
+		stat_counter() {}
+		stat_counter(const stat_counter& o) : v(o.get()) {}
+		stat_counter& operator=(const stat_counter& o) { set(o.get()); return *this; }
+
+		void operator+=(uint64_t n) { set(get() + n); }
+		uint64_t get() const { return v.load(std::memory_order_relaxed); }
+		void set(uint64_t n) { v.store(n, std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint64_t> v {0};
+};
+
+struct render_stats {
+	static const int max_bounces = 16; // path_length's last bin counts longer paths too
+
+	stat_counter rays;           // rays cast into the world
+	stat_counter sphere_tests;   // ray-sphere intersection tests
+	stat_counter box_tests;      // ray-box tests in the bvh
+	stat_counter paths;
+	stat_counter path_length[max_bounces + 1]; // paths by the number of bounces they took
+	stat_counter escaped;        // paths that left the scene
+	stat_counter depth_limited;  // paths cut off at max_depth
+	stat_counter roulette;       // paths ended by Russian roulette
+	stat_counter absorbed[3];    // paths whose scatter failed, by material_type
+
+	stat_counter tasks;          // thread pool tasks run
+	stat_counter task_run_ns;    // time inside tasks
+	stat_counter task_wait_ns;   // time tasks spent queued before they started
+	stat_counter idle_ns;        // time a worker looked for work or slept
+
+	void add(const render_stats& o) {
+		rays += o.rays.get();
+		sphere_tests += o.sphere_tests.get();
+		box_tests += o.box_tests.get();
+		paths += o.paths.get();
+		for (int k = 0; k <= max_bounces; ++k) path_length[k] += o.path_length[k].get();
+		escaped += o.escaped.get();
+		depth_limited += o.depth_limited.get();
+		roulette += o.roulette.get();
+		for (int k = 0; k < 3; ++k) absorbed[k] += o.absorbed[k].get();
+		tasks += o.tasks.get();
+		task_run_ns += o.task_run_ns.get();
+		task_wait_ns += o.task_wait_ns.get();
+		idle_ns += o.idle_ns.get();
+	}
+
+	// Records a finished path of the given number of bounces
+	void end_path(int bounces) {
+		paths += 1;
+		path_length[std::min(bounces, max_bounces)] += 1;
+	}
+};
+
+// One span of a timeline, as Chrome's trace viewer and Perfetto show them
+struct trace_event {
+	const char* name;
+	int64_t start_ns, duration_ns;
+	int x, y, w, h; // the tile, for tile spans
+};
+
+inline int64_t stats_clock_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace stats_detail {
+
+	struct thread_slot {
+		int id;
+		render_stats stats;
+		std::vector<trace_event> events;
+		std::mutex events_lock; // only contended when the trace is collected
+	};
+
+	// Slots live as long as the program, so counts survive their threads
+	struct registry {
+		std::mutex lock;
+		std::vector<std::unique_ptr<thread_slot>> slots;
+		std::atomic<bool> tracing {false};
+	};
+
+	inline registry& global() {
+		static registry r;
+		return r;
+	}
+
+	inline thread_slot& slot() {
+		static thread_local thread_slot* s = [] {
+			registry& r = global();
+			std::lock_guard<std::mutex> l(r.lock);
+			r.slots.emplace_back(new thread_slot());
+			r.slots.back()->id = static_cast<int>(r.slots.size()) - 1;
+			return r.slots.back().get();
+		}();
+		return *s;
+	}
+
+} // namespace stats_detail
+
+inline render_stats& thread_stats() {
+	return stats_detail::slot().stats;
+}
+
+// Records task timelines from now on, for write_chrome_trace()
+inline void enable_tracing(bool on) {
+	stats_detail::global().tracing.store(on, std::memory_order_relaxed);
+}
+
+// Times the enclosing scope as one span of the calling thread's timeline
+class trace_span {
+	public:
+		trace_span(const char* name, int x = 0, int y = 0, int w = 0, int h = 0) {
+			if (stats_enabled && stats_detail::global().tracing.load(std::memory_order_relaxed))
+				e = { name, stats_clock_ns(), 0, x, y, w, h };
+		}
+
+		~trace_span() {
+			if (!stats_enabled || !e.name) return;
+			e.duration_ns = stats_clock_ns() - e.start_ns;
+			stats_detail::thread_slot& s = stats_detail::slot();
+			std::lock_guard<std::mutex> l(s.events_lock);
+			s.events.push_back(e);
+		}
+
+	private:
+		trace_event e = { nullptr, 0, 0, 0, 0, 0, 0 };
+};
+
+// Counters of every thread that has counted anything, in the order they started
+inline std::vector<render_stats> collect_stats() {
+	stats_detail::registry& r = stats_detail::global();
+	std::lock_guard<std::mutex> l(r.lock);
+	std::vector<render_stats> all(r.slots.size());
+	for (size_t k = 0; k < r.slots.size(); ++k)
+		all[k] = r.slots[k]->stats;
+	return all;
+}
+
+// Zeroes every thread's counters and timeline; call while no render is running
+inline void reset_stats() {
+	stats_detail::registry& r = stats_detail::global();
+	std::lock_guard<std::mutex> l(r.lock);
+	for (auto& s : r.slots) {
+		s->stats = render_stats();
+		std::lock_guard<std::mutex> el(s->events_lock);
+		s->events.clear();
+	}
+}
+
+inline void report_stats(std::ostream& out, const std::vector<render_stats>& per_thread) {
+	render_stats total;
+	for (const auto& s : per_thread) total.add(s);
+
+	char line[160];
+	auto ratio = [](uint64_t a, uint64_t b) { return b ? double(a) / b : 0.0; };
+	auto percent = [&](uint64_t a) { return 100 * ratio(a, total.paths.get()); };
+
+	out << "Statistics\n";
+	std::snprintf(line, sizeof(line), "  rays %llu, %.2f sphere tests and %.2f box tests per ray\n",
+		(unsigned long long)total.rays.get(), ratio(total.sphere_tests.get(), total.rays.get()),
+		ratio(total.box_tests.get(), total.rays.get()));
+	out << line;
+
+	uint64_t bounces = 0;
+	for (int k = 0; k <= render_stats::max_bounces; ++k) bounces += k * total.path_length[k].get();
+	std::snprintf(line, sizeof(line), "  paths %llu, %.2f bounces on average\n",
+		(unsigned long long)total.paths.get(), ratio(bounces, total.paths.get()));
+	out << line;
+	std::snprintf(line, sizeof(line),
+		"  ended by: escaping %.1f%%, depth limit %.1f%%, roulette %.1f%%, absorption "
+		"(lambertian %.1f%%, metal %.1f%%, dielectric %.1f%%)\n",
+		percent(total.escaped.get()), percent(total.depth_limited.get()), percent(total.roulette.get()),
+		percent(total.absorbed[0].get()), percent(total.absorbed[1].get()), percent(total.absorbed[2].get()));
+	out << line;
+
+	out << "  bounces:";
+	for (int k = 0; k <= render_stats::max_bounces; ++k)
+		if (total.path_length[k].get())
+			out << ' ' << k << (k == render_stats::max_bounces ? "+" : "") << ':'
+				<< total.path_length[k].get();
+	out << "\n";
+
+	out << "  thread     tasks    run (s)   wait (s)   idle (s)        rays\n";
+	for (size_t k = 0; k < per_thread.size(); ++k) {
+		const render_stats& s = per_thread[k];
+		if (!s.tasks.get() && !s.rays.get() && !s.idle_ns.get()) continue;
+		std::snprintf(line, sizeof(line), "  %6zu %9llu %10.3f %10.3f %10.3f %11llu\n",
+			k, (unsigned long long)s.tasks.get(), s.task_run_ns.get() * 1e-9, s.task_wait_ns.get() * 1e-9,
+			s.idle_ns.get() * 1e-9, (unsigned long long)s.rays.get());
+		out << line;
+	}
+}
+
+// Writes every recorded span as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+inline void write_chrome_trace(std::ostream& out) {
+	stats_detail::registry& r = stats_detail::global();
+	std::lock_guard<std::mutex> l(r.lock);
+
+	int64_t origin = INT64_MAX;
+	for (auto& s : r.slots) {
+		std::lock_guard<std::mutex> el(s->events_lock);
+		for (const auto& e : s->events) origin = std::min(origin, e.start_ns);
+	}
+
+	char buf[256];
+	bool first = true;
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	for (auto& s : r.slots) {
+		std::lock_guard<std::mutex> el(s->events_lock);
+		if (s->events.empty()) continue;
+
+		std::snprintf(buf, sizeof(buf),
+			"%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+			first ? "" : ",\n", s->id, s->id);
+		out << buf;
+		first = false;
+
+		for (const auto& e : s->events) {
+			std::snprintf(buf, sizeof(buf),
+				",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+				"\"args\": {\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d}}",
+				e.name, s->id, (e.start_ns - origin) * 1e-3, e.duration_ns * 1e-3, e.x, e.y, e.w, e.h);
+			out << buf;
+		}
+	}
+	out << "\n]}\n";
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A type-erased void() callable stored inline in 64 bytes.
+//
+// Callables that are trivially copyable and small enough (lambdas capturing a
+// few references or ints) live directly in the task, so submitting one never
+// allocates. Anything else is moved to the heap and the task holds a pointer.
+// Because a task is plain bytes it can be copied through atomic words, which
+// is how the work-stealing deques move tasks between threads without races.
+class task {
+	public:
+		static const size_t words = 8;
+		static const size_t capacity = words * sizeof(uint64_t) - sizeof(void (*)(void*, bool));
+
+		task() : invoke(nullptr) {}
+
+		template <typename F, typename = typename std::enable_if<
+			!std::is_same<typename std::decay<F>::type, task>::value>::type>
+		task(F&& f) {
+			using fn = typename std::decay<F>::type;
+			std::memset(storage, 0, sizeof(storage));
+
+			if constexpr (std::is_trivially_copyable<fn>::value && sizeof(fn) <= capacity
+				&& alignof(fn) <= alignof(uint64_t)) {
+				new (storage) fn(std::forward<F>(f));
+				invoke = &call_inline<fn>;
+			} else {
+				fn* boxed = new fn(std::forward<F>(f));
+				std::memcpy(storage, &boxed, sizeof(boxed));
+				invoke = &call_boxed<fn>;
+			}
+		}
+
+		explicit operator bool() const { return invoke != nullptr; }
+
+		// Runs the callable; a task must be run exactly once
+		void operator()() { invoke(storage, true); }
+
+		// Releases a task that will never run (only boxed callables own anything)
+		void discard() { if (invoke) invoke(storage, false); invoke = nullptr; }
+
+		void store(std::atomic<uint64_t>* dst) const {
+			uint64_t raw[words];
+			std::memcpy(raw, this, sizeof(raw));
+			for (size_t i = 0; i < words; ++i)
+				dst[i].store(raw[i], std::memory_order_relaxed);
+		}
+
+		static task load(const std::atomic<uint64_t>* src) {
+			uint64_t raw[words];
+			for (size_t i = 0; i < words; ++i)
+				raw[i] = src[i].load(std::memory_order_relaxed);
+			task t;
+			std::memcpy(static_cast<void*>(&t), raw, sizeof(raw));
+			return t;
+		}
+
+	private:
+		void (*invoke)(void*, bool);
+		alignas(uint64_t) unsigned char storage[capacity];
+
+		template <typename fn>
+		static void call_inline(void* p, bool run) {
+			if (run) (*static_cast<fn*>(p))();
+		}
+
+		template <typename fn>
+		static void call_boxed(void* p, bool run) {
+			fn* boxed;
+			std::memcpy(&boxed, p, sizeof(boxed));
+			if (run) (*boxed)();
+			delete boxed;
+		}
+};
+
+static_assert(sizeof(task) == task::words * sizeof(uint64_t), "task must fill its atomic words exactly");
+static_assert(std::is_trivially_copyable<task>::value, "task is copied as raw words");
+
+#endif
@@ -1,18 +1,48 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include <functional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <thread>
-#include "concurrent_queue.h"
+#include <vector>
 
+#include "mpmc_queue.h"
+#include "stats.h"
+#include "task.h"
+#include "work_stealing_deque.h"
+
+// Work-stealing thread pool.
+//
+// Each worker owns a Chase-Lev deque: tasks added from inside a task go to the
+// adding worker's own deque, tasks added from outside the pool go through a
+// lock-free injection queue. A worker with nothing to do takes from the
+// injection queue, then steals from a random victim, and only after a short
+// spin goes to sleep. Tasks are stored inline (see task.h), so adding one does
+// not allocate.
 class thread_pool {
 
 	public:
 
+		struct worker_stats {
+			uint64_t executed;      // tasks run by this worker
+			uint64_t stolen;        // of those, taken from another worker's deque
+			uint64_t failed_steals; // steals lost to another thief or the owner
+			double idle_seconds;    // time spent looking for work or asleep
+		};
+
 		thread_pool(int n) {
+			n = n > 0 ? n : 1;
+			workers.reserve(n);
+			for (int i = 0; i < n; ++i)
+				workers.emplace_back(new worker(i + 1));
+
 			threads.reserve(n);
 			for (int i = 0; i < n; ++i)
-				threads.emplace_back(std::bind(&thread_pool::work, this, i));
+				threads.emplace_back(&thread_pool::work, this, i);
 			ended = false;
 		};
 
@@ -20,44 +50,265 @@ class thread_pool {
 			end();
 		}
 
-		void add(std::function<void()> task)
+		template <typename F>
+		void add(F&& f)
+		{
+			if constexpr (stats_enabled) {
+				// Stamped with the time it was queued, for the wait statistics
+				int64_t queued = stats_clock_ns();
+				submit(task([f = std::forward<F>(f), queued]() mutable {
+					thread_stats().task_wait_ns += stats_clock_ns() - queued;
+					f();
+				}));
+			} else {
+				submit(task(std::forward<F>(f)));
+			}
+		}
+
+		// Blocks until every task added so far, and every task those added, has
+		// finished. Must be called from outside the pool.
+		void wait()
 		{
-			task_queue.enq(task);
+			std::unique_lock<std::mutex> l (done_lock);
+			done.wait(l, [this] { return pending.load(std::memory_order_acquire) == 0; });
+		}
+
+		// Runs body(i) for i in [begin, end) in chunks of grain and returns when all
+		// are done. The caller runs tasks while it waits, so this is safe to call
+		// from inside a task as well.
+		template <typename F>
+		void parallel_for(int begin, int end, F&& body, int grain = 1)
+		{
+			if (end <= begin) return;
+			grain = grain > 0 ? grain : 1;
+
+			std::atomic<int> remaining ((end - begin + grain - 1) / grain);
+
+			for (int lo = begin; lo < end; lo += grain) {
+				int hi = lo + grain < end ? lo + grain : end;
+				add([&body, &remaining, lo, hi] {
+					for (int i = lo; i < hi; ++i)
+						body(i);
+					remaining.fetch_sub(1, std::memory_order_release);
+				});
+			}
+
+			worker* self = current_pool == this ? workers[current_index].get() : nullptr;
+			task t;
+			while (remaining.load(std::memory_order_acquire) > 0) {
+				if (find_task(self, t))
+					run(t, self);
+				else
+					std::this_thread::yield();
+			}
 		}
 
 		void endWhenEmpty()
-		{	
-			task_queue.waitUntilEmpty();
+		{
+			wait();
 			end();
-		} 
+		}
 
 		void end()
 		{
 			if (ended) return;
 
 			ended = true;
-			task_queue.end();
+			stopping.store(true, std::memory_order_release);
+			{
+				std::lock_guard<std::mutex> l (sleep_lock);
+				wake.notify_all();
+			}
 
 			for (auto& t : threads)
 				t.join();
 		}
-		
+
+		int size() const { return static_cast<int>(workers.size()); }
+
+		std::vector<worker_stats> stats() const
+		{
+			std::vector<worker_stats> s;
+			for (const auto& w : workers) {
+				s.push_back({
+					w->executed.load(std::memory_order_relaxed),
+					w->stolen.load(std::memory_order_relaxed),
+					w->failed_steals.load(std::memory_order_relaxed),
+					w->idle_ns.load(std::memory_order_relaxed) * 1e-9
+				});
+			}
+			return s;
+		}
+
 	private:
+		struct alignas(64) worker {
+			work_stealing_deque deque;
+			std::atomic<uint64_t> executed {0};
+			std::atomic<uint64_t> stolen {0};
+			std::atomic<uint64_t> failed_steals {0};
+			std::atomic<uint64_t> idle_ns {0};
+			uint64_t victim_state; // xorshift state for picking steal victims
+
+			worker(uint64_t seed) : victim_state(seed * 0x9e3779b97f4a7c15ULL) {}
+		};
+
+		std::vector<std::unique_ptr<worker>> workers;
 		std::vector<std::thread> threads;
-		concurrent_queue<std::function<void()>> task_queue;
+		mpmc_queue injected;
+
+		alignas(64) std::atomic<int64_t> pending {0};
+		alignas(64) std::atomic<int> sleeping {0};
+		std::atomic<bool> stopping {false};
+
+		std::mutex sleep_lock;
+		std::condition_variable wake;
+		std::mutex done_lock;
+		std::condition_variable done;
 		bool ended;
 
+		static const int spin_limit = 64;
+
+		// Which pool and worker the calling thread belongs to, if any
+		static inline thread_local thread_pool* current_pool = nullptr;
+		static inline thread_local int current_index = -1;
+
+		void submit(const task& t)
+		{
+			pending.fetch_add(1, std::memory_order_relaxed);
+
+			if (current_pool == this) {
+				workers[current_index]->deque.push(t);
+			} else {
+				// Queue full: help drain it rather than block
+				while (!injected.enq(t)) {
+					task other;
+					if (injected.deq(other))
+						run(other, nullptr);
+					else
+						std::this_thread::yield();
+				}
+			}
+
+			// Pairs with the fence in work() so a worker about to sleep sees this task
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (sleeping.load(std::memory_order_relaxed) > 0) {
+				std::lock_guard<std::mutex> l (sleep_lock);
+				wake.notify_one();
+			}
+		}
+
+		void run(task& t, worker* self)
+		{
+			if (stats_enabled) {
+				int64_t start = stats_clock_ns();
+				t();
+				thread_stats().tasks += 1;
+				thread_stats().task_run_ns += stats_clock_ns() - start;
+			} else {
+				t();
+			}
+			if (self) self->executed.fetch_add(1, std::memory_order_relaxed);
+
+			if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				std::lock_guard<std::mutex> l (done_lock);
+				done.notify_all();
+			}
+		}
+
+		bool find_task(worker* self, task& out)
+		{
+			if (self && self->deque.pop(out))
+				return true;
+
+			if (injected.deq(out))
+				return true;
+
+			size_t n = workers.size();
+			size_t start = self ? next_victim(self) % n : 0;
+
+			for (size_t k = 0; k < n; ++k) {
+				worker* victim = workers[(start + k) % n].get();
+				if (victim == self) continue;
+
+				if (victim->deque.steal(out)) {
+					if (self) self->stolen.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+				if (self && !victim->deque.empty())
+					self->failed_steals.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			return false;
+		}
+
+		bool has_work() const
+		{
+			if (!injected.empty()) return true;
+			for (const auto& w : workers)
+				if (!w->deque.empty()) return true;
+			return false;
+		}
+
+		static uint64_t next_victim(worker* self)
+		{
+			uint64_t x = self->victim_state;
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			self->victim_state = x;
+			return x;
+		}
+
+		static void add_idle(worker* self, std::chrono::steady_clock::time_point idle_start)
+		{
+			auto idle = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - idle_start).count();
+			self->idle_ns.fetch_add(idle, std::memory_order_relaxed);
+			if (stats_enabled) thread_stats().idle_ns += idle;
+		}
+
 		void work(int i)
 		{
-			std::function<void()> task;
+			current_pool = this;
+			current_index = i;
+			worker* self = workers[i].get();
 
-			while(true)
+			task t;
+			int spins = 0;
+			auto idle_start = std::chrono::steady_clock::now();
+
+			while (true)
 			{
-				task = task_queue.deq();
-				if (task == NULL)
-					return;
-				task();
+				if (find_task(self, t)) {
+					if (spins > 0)
+						add_idle(self, idle_start);
+					spins = 0;
+					run(t, self);
+					continue;
+				}
+
+				if (stopping.load(std::memory_order_acquire))
+					break;
+
+				if (spins++ == 0)
+					idle_start = std::chrono::steady_clock::now();
+
+				if (spins < spin_limit) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> l (sleep_lock);
+				sleeping.fetch_add(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				// The timeout only bounds the damage of a missed wakeup
+				if (!has_work() && !stopping.load(std::memory_order_acquire))
+					wake.wait_for(l, std::chrono::milliseconds(5));
+				sleeping.fetch_sub(1, std::memory_order_relaxed);
 			}
+
+			if (spins > 0)
+				add_idle(self, idle_start);
 		}
 };
 
@@ -0,0 +1,199 @@
+#ifndef TILED_FRAMEBUFFER_H
+#define TILED_FRAMEBUFFER_H
+
+#include "color.h"
+#include "image_writer.h"
+#include "rtweekend.h"
+#include "tiles.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A framebuffer kept in a file instead of memory, for frames larger than RAM.
+//
+// The file holds the image as fixed-size tiles on the same grid as
+// make_tiles(), each in its own page-aligned slot, after a header and one
+// "done" byte per tile:
+//
+//	header (magic, size, tiling, fingerprint) | done flags | tile 0 | tile 1 | ...
+//
+// The whole file is mapped. A worker writes its tile's pixels straight into
+// the mapping and calls finish_tile(), which starts the write-back, drops the
+// tile's pages from the process and only then marks the tile done. Resident
+// memory is therefore a few tiles per thread however large the image is, and
+// a render killed at any point can be reopened with every finished tile
+// intact. (The done flags order against the pixels for a crash of the
+// process; surviving a power cut as well would need a sync per tile.)
+class tiled_framebuffer {
+	public:
+		tiled_framebuffer() {}
+		~tiled_framebuffer() { close(); }
+
+		tiled_framebuffer(const tiled_framebuffer&) = delete;
+		tiled_framebuffer& operator=(const tiled_framebuffer&) = delete;
+
+		// Opens or creates path for a width x height image in tile_w x tile_h
+		// tiles. A file from the same render (same size, tiling and fingerprint)
+		// keeps its finished tiles and sets resumed; any other file is replaced.
+		bool open(const std::string& path, int width, int height, int tile_w, int tile_h,
+				  uint64_t fingerprint, bool& resumed) {
+			close();
+			resumed = false;
+			w = width;
+			h = height;
+			tw = std::max(1, std::min(tile_w, width));
+			th = std::max(1, std::min(tile_h, height));
+			cols = (w + tw - 1) / tw;
+			rows = (h + th - 1) / th;
+
+			const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+			slot_bytes = round_up(static_cast<size_t>(tw) * th * 3 * sizeof(float), page);
+			data_offset = round_up(sizeof(file_header) + tile_count(), page);
+			size = data_offset + slot_bytes * tile_count();
+
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+			if (fd < 0) return false;
+
+			file_header hdr;
+			std::memcpy(hdr.magic, file_magic, sizeof(hdr.magic));
+			hdr.width = w;
+			hdr.height = h;
+			hdr.tile_width = tw;
+			hdr.tile_height = th;
+			hdr.fingerprint = fingerprint;
+			hdr.slot_bytes = slot_bytes;
+
+			file_header old;
+			struct stat st;
+			resumed = ::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size
+				&& ::pread(fd, &old, sizeof(old), 0) == static_cast<ssize_t>(sizeof(old))
+				&& std::memcmp(&old, &hdr, sizeof(hdr)) == 0;
+
+			// A new file is sparse: tiles take disk space as they are written
+			if (!resumed && (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0
+							 || ::pwrite(fd, &hdr, sizeof(hdr), 0) != static_cast<ssize_t>(sizeof(hdr)))) {
+				close();
+				return false;
+			}
+
+			void* m = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (m == MAP_FAILED) {
+				close();
+				return false;
+			}
+			map = static_cast<uint8_t*>(m);
+			return true;
+		}
+
+		// Flushes the file and unmaps it
+		bool close() {
+			bool ok = true;
+			if (map) {
+				ok = ::msync(map, size, MS_SYNC) == 0;
+				ok = ::munmap(map, size) == 0 && ok;
+				map = nullptr;
+			}
+			if (fd >= 0) {
+				ok = ::close(fd) == 0 && ok;
+				fd = -1;
+			}
+			return ok;
+		}
+
+		int width() const { return w; }
+		int height() const { return h; }
+		int tile_count() const { return cols * rows; }
+
+		// The grid tile of make_tiles() with the same tile size
+		int tile_index(const tile& t) const { return (h - t.y0 - t.h) / th * cols + t.x0 / tw; }
+
+		bool tile_done(int k) const { return done_flags()[k] != 0; }
+
+		int tiles_done() const {
+			return static_cast<int>(std::count_if(done_flags(), done_flags() + tile_count(),
+												  [](uint8_t d) { return d != 0; }));
+		}
+
+		// Called by the tile that owns pixel (i, j)
+		void set(int i, int j, const color& c) {
+			float* p = pixel(i, j);
+			p[0] = static_cast<float>(c.x());
+			p[1] = static_cast<float>(c.y());
+			p[2] = static_cast<float>(c.z());
+		}
+
+		// Every pixel of tile k has been set
+		void finish_tile(int k) {
+			uint8_t* s = slot(k);
+			::msync(s, slot_bytes, MS_ASYNC);
+			::madvise(s, slot_bytes, MADV_DONTNEED); // the pages stay in the page cache, dirty
+			done_flags()[k] = 1;
+		}
+
+		// Writes the finished image row by row, one band of tiles in memory at a time
+		bool write(image_stream& out) {
+			int band = -1;
+			for (int r = 0; r < h; ++r) {
+				int j = out.bottom_up() ? r : h - 1 - r;
+				int b = (h - 1 - j) / th;
+				if (b != band) {
+					release_band(band);
+					band = b;
+				}
+				row_buffer.resize(3 * static_cast<size_t>(w));
+				for (int c = 0; c < cols; ++c) {
+					int x0 = c * tw;
+					int n = std::min(tw, w - x0);
+					std::memcpy(&row_buffer[3 * static_cast<size_t>(x0)], pixel(x0, j), 3 * n * sizeof(float));
+				}
+				if (!out.write_row(row_buffer.data())) return false;
+			}
+			release_band(band);
+			return true;
+		}
+
+	private:
+		struct file_header {
+			char magic[8];
+			int32_t width, height;
+			int32_t tile_width, tile_height;
+			uint64_t fingerprint;
+			uint64_t slot_bytes;
+		};
+
+		static constexpr char file_magic[8] = { 'R', 'T', 'T', 'I', 'L', 'E', 0, 1 };
+
+		int w = 0, h = 0, tw = 1, th = 1, cols = 0, rows = 0;
+		size_t slot_bytes = 0, data_offset = 0, size = 0;
+		int fd = -1;
+		uint8_t* map = nullptr;
+		std::vector<float> row_buffer;
+
+		static size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+		uint8_t* done_flags() const { return map + sizeof(file_header); }
+		uint8_t* slot(int k) const { return map + data_offset + slot_bytes * static_cast<size_t>(k); }
+
+		// Tiles store their rows top first, like framebuffer
+		float* pixel(int i, int j) const {
+			int from_top = h - 1 - j;
+			int r = from_top / th, c = i / tw;
+			size_t local = static_cast<size_t>(from_top - r * th) * tw + (i - c * tw);
+			return reinterpret_cast<float*>(slot(r * cols + c)) + 3 * local;
+		}
+
+		void release_band(int band) {
+			if (band >= 0)
+				::madvise(slot(band * cols), slot_bytes * cols, MADV_DONTNEED);
+		}
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Splitting the image into tiles and choosing the order they are rendered in.
+//
+// Pixel rows count up from the bottom of the image (j = 0 is the last line
+// written), matching the camera's v coordinate.
+
+struct tile {
+	int x0, y0; // bottom-left pixel
+	int w, h;
+};
+
+enum class tile_order {
+	scanline, // top to bottom, left to right
+	morton,   // Z-order curve over the tile grid
+	hilbert,  // Hilbert curve over the tile grid
+	spiral    // outward from the centre of the image
+};
+
+inline const char* tile_order_name(tile_order order) {
+	switch (order) {
+		case tile_order::scanline: return "scanline";
+		case tile_order::morton:   return "morton";
+		case tile_order::hilbert:  return "hilbert";
+		case tile_order::spiral:   return "spiral";
+	}
+	return "?";
+}
+
+inline bool parse_tile_order(const std::string& name, tile_order& order) {
+	for (auto o : { tile_order::scanline, tile_order::morton, tile_order::hilbert, tile_order::spiral }) {
+		if (name == tile_order_name(o)) {
+			order = o;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Interleaves the bits of x and y
+inline uint64_t morton_index(uint32_t x, uint32_t y) {
+	uint64_t key = 0;
+	for (int b = 0; b < 32; ++b) {
+		key |= static_cast<uint64_t>((x >> b) & 1) << (2*b);
+		key |= static_cast<uint64_t>((y >> b) & 1) << (2*b + 1);
+	}
+	return key;
+}
+
+// Distance along a Hilbert curve filling an n x n grid, n a power of two
+inline uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+	uint64_t d = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant so the curve stays continuous
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+// Cuts the image into tile_w x tile_h tiles (smaller at the right and bottom
+// edges) and sorts them into the requested order.
+inline std::vector<tile> make_tiles(int image_width, int image_height, int tile_w, int tile_h,
+									tile_order order) {
+	tile_w = std::max(1, std::min(tile_w, image_width));
+	tile_h = std::max(1, std::min(tile_h, image_height));
+
+	int cols = (image_width + tile_w - 1) / tile_w;
+	int rows = (image_height + tile_h - 1) / tile_h;
+
+	// Grid row 0 is the top of the image
+	std::vector<tile> tiles;
+	std::vector<uint64_t> keys;
+	tiles.reserve(static_cast<size_t>(cols) * rows);
+
+	uint32_t n = 1;
+	while (n < static_cast<uint32_t>(std::max(cols, rows))) n *= 2;
+
+	for (int r = 0; r < rows; ++r) {
+		for (int c = 0; c < cols; ++c) {
+			int top = image_height - r * tile_h;
+			int h = std::min(tile_h, top);
+			int w = std::min(tile_w, image_width - c * tile_w);
+			tiles.push_back({ c * tile_w, top - h, w, h });
+
+			uint64_t key = 0;
+			switch (order) {
+				case tile_order::scanline:
+					key = static_cast<uint64_t>(r) * cols + c;
+					break;
+				case tile_order::morton:
+					key = morton_index(c, r);
+					break;
+				case tile_order::hilbert:
+					key = hilbert_index(n, c, r);
+					break;
+				case tile_order::spiral: {
+					// Ring around the centre first, then angle within the ring
+					double dx = c + 0.5 - cols / 2.0;
+					double dy = r + 0.5 - rows / 2.0;
+					uint64_t ring = static_cast<uint64_t>(std::max(std::fabs(dx), std::fabs(dy)));
+					uint64_t angle = static_cast<uint64_t>((std::atan2(dy, dx) + 4.0) * 1e6);
+					key = (ring << 32) | angle;
+					break;
+				}
+			}
+			keys.push_back(key);
+		}
+	}
+
+	std::vector<size_t> idx(tiles.size());
+	std::iota(idx.begin(), idx.end(), 0);
+	std::stable_sort(idx.begin(), idx.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+	std::vector<tile> sorted;
+	sorted.reserve(tiles.size());
+	for (size_t i : idx)
+		sorted.push_back(tiles[i]);
+	return sorted;
+}
+
+// Replaces every tile whose estimated cost is more than factor times the median
+// by its four quadrants, recursively, keeping the overall order. Costs of the
+// children are taken as a quarter of the parent's.
+inline std::vector<tile> split_expensive_tiles(const std::vector<tile>& tiles,
+											   const std::vector<double>& cost,
+											   double factor, int min_size) {
+	if (tiles.empty()) return tiles;
+
+	std::vector<double> sorted_cost = cost;
+	std::nth_element(sorted_cost.begin(), sorted_cost.begin() + sorted_cost.size() / 2, sorted_cost.end());
+	double limit = factor * sorted_cost[sorted_cost.size() / 2];
+
+	std::vector<tile> out;
+	std::vector<std::pair<tile, double>> stack;
+
+	for (size_t i = 0; i < tiles.size(); ++i) {
+		stack.push_back({ tiles[i], cost[i] });
+		while (!stack.empty()) {
+			auto [t, c] = stack.back();
+			stack.pop_back();
+
+			if (c <= limit || t.w < 2*min_size || t.h < 2*min_size) {
+				out.push_back(t);
+				continue;
+			}
+
+			int hw = t.w / 2, hh = t.h / 2;
+			tile top_left     { t.x0,      t.y0 + hh, hw,       t.h - hh };
+			tile top_right    { t.x0 + hw, t.y0 + hh, t.w - hw, t.h - hh };
+			tile bottom_left  { t.x0,      t.y0,      hw,       hh };
+			tile bottom_right { t.x0 + hw, t.y0,      t.w - hw, hh };
+
+			// Pushed in reverse so they come out top-left first
+			stack.push_back({ bottom_right, c / 4 });
+			stack.push_back({ bottom_left,  c / 4 });
+			stack.push_back({ top_right,    c / 4 });
+			stack.push_back({ top_left,     c / 4 });
+		}
+	}
+
+	return out;
+}
+
+// Wall time spent rendering each tile, for choosing tile settings per scene
+struct tile_timing {
+	tile t;
+	double seconds;
+};
+
+inline void report_tile_timings(std::ostream& out, const std::vector<tile_timing>& timings) {
+	if (timings.empty()) return;
+
+	double total = 0, lo = timings[0].seconds, hi = timings[0].seconds;
+	for (const auto& tt : timings) {
+		total += tt.seconds;
+		lo = std::min(lo, tt.seconds);
+		hi = std::max(hi, tt.seconds);
+	}
+	double mean = total / timings.size();
+
+	out << "Tiles: " << timings.size()
+		<< ", mean " << mean * 1e3 << " ms"
+		<< ", min " << lo * 1e3 << " ms"
+		<< ", max " << hi * 1e3 << " ms"
+		<< ", max/mean " << (mean > 0 ? hi / mean : 0) << "\n";
+}
+
+inline void write_tile_timings_csv(std::ostream& out, const std::vector<tile_timing>& timings) {
+	out << "x0,y0,w,h,ms\n";
+	for (const auto& tt : timings)
+		out << tt.t.x0 << ',' << tt.t.y0 << ',' << tt.t.w << ',' << tt.t.h << ','
+			<< tt.seconds * 1e3 << '\n';
+}
+
+#endif
@@ -1,57 +1,71 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 using std::fabs;
 
-class vec3 {
+// Three-component vector over a scalar type T, float or double. The renderer
+// uses vec3, which is vec3_t<real> (see rtweekend.h).
+//
+// The arithmetic operators are friends defined in the class, so they are not
+// templates: a double scalar converts to T implicitly, and code written with
+// double constants works unchanged for either precision.
+template <typename T>
+class vec3_t {
 	public:
-		vec3() : e{0, 0, 0} {}
-		vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+		using value_type = T;
 
-		double x() const { return e[0]; }
-		double y() const { return e[1]; }
-		double z() const { return e[2]; }
+		vec3_t() : e{0, 0, 0} {}
+		vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-		vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-		double operator[](int i) const { return e[i]; }
-		double& operator[](int i) { return e[i]; }
+		// Between precisions only on request
+		template <typename U>
+		explicit vec3_t(const vec3_t<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-		vec3& operator+=(const vec3 &v) {
+		T x() const { return e[0]; }
+		T y() const { return e[1]; }
+		T z() const { return e[2]; }
+
+		vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+		T operator[](int i) const { return e[i]; }
+		T& operator[](int i) { return e[i]; }
+
+		vec3_t& operator+=(const vec3_t &v) {
 			e[0] += v.e[0];
 			e[1] += v.e[1];
 			e[2] += v.e[2];
 			return *this;
 		}
 
-		vec3& operator*=(const double t) {
+		vec3_t& operator*=(const T t) {
 			e[0] *= t;
 			e[1] *= t;
 			e[2] *= t;
 			return *this;
 		}
 
-		vec3& operator/=(const double t) {
+		vec3_t& operator/=(const T t) {
 			return *this *= 1/t;
 		}
 
-		double length() const {
+		T length() const {
 			return sqrt(length_squared());
 		}
 
-		double length_squared() const {
+		T length_squared() const {
 			return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
 		}
 
-		inline static vec3 random() {
-			return vec3(random_double(), random_double(), random_double());
+		inline static vec3_t random() {
+			return vec3_t(random_double(), random_double(), random_double());
 		}
 
-		inline static vec3 random(double min, double max) {
-			return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+		inline static vec3_t random(double min, double max) {
+			return vec3_t(random_double(min,max), random_double(min,max), random_double(min,max));
 		}
 
 		bool near_zero() const {
@@ -60,99 +74,159 @@ class vec3 {
 			return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
 		}
 
-	public:
-		double e[3];
-};
-
-
-// Type aliases for vec3
-using point3 = vec3;   // 3D point
-using color = vec3;    // RGB color
-
-
-// vec3 Utility Functions
+		// vec3 Utility Functions
 
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
-	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+		friend std::ostream& operator<<(std::ostream &out, const vec3_t &v) {
+			return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+		}
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+		friend vec3_t operator+(const vec3_t &u, const vec3_t &v) {
+			return vec3_t(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+		}
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+		friend vec3_t operator-(const vec3_t &u, const vec3_t &v) {
+			return vec3_t(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+		}
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+		friend vec3_t operator*(const vec3_t &u, const vec3_t &v) {
+			return vec3_t(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+		}
 
-inline vec3 operator*(double t, const vec3 &v) {
-	return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
-}
+		friend vec3_t operator*(T t, const vec3_t &v) {
+			return vec3_t(t*v.e[0], t*v.e[1], t*v.e[2]);
+		}
 
-inline vec3 operator*(const vec3 &v, double t) {
-	return t * v;
-}
+		friend vec3_t operator*(const vec3_t &v, T t) {
+			return t * v;
+		}
 
-inline vec3 operator/(vec3 v, double t) {
-	return (1/t) * v;
-}
+		friend vec3_t operator/(vec3_t v, T t) {
+			return (1/t) * v;
+		}
 
-inline double dot(const vec3 &u, const vec3 &v) {
-	return u.e[0] * v.e[0]
-	     + u.e[1] * v.e[1]
-         + u.e[2] * v.e[2];
-}
+		friend T dot(const vec3_t &u, const vec3_t &v) {
+			return u.e[0] * v.e[0]
+			     + u.e[1] * v.e[1]
+			     + u.e[2] * v.e[2];
+		}
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-				u.e[2] * v.e[0] - u.e[0] * v.e[2],
-				u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+		friend vec3_t cross(const vec3_t &u, const vec3_t &v) {
+			return vec3_t(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+						  u.e[2] * v.e[0] - u.e[0] * v.e[2],
+						  u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+		}
 
-inline vec3 unit_vector(vec3 v) {
-	return v / v.length();
-}
+		friend vec3_t unit_vector(vec3_t v) {
+			return v / v.length();
+		}
 
-inline vec3 random_in_unit_disk() {
-	while (true) {
-		auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-		if (p.length_squared() >= 1) continue;
-		return p;
-	}
-}
+		friend vec3_t reflect(const vec3_t& v, const vec3_t& n) {
+			return v - 2*dot(v,n)*n;
+		}
 
-inline vec3 random_in_unit_sphere() {
-	while (true) {
-		auto p = vec3::random(-1,1);
-		if (p.length_squared() >= 1) continue;
-		return p;
-	}
-}
+		friend vec3_t refract(const vec3_t& uv, const vec3_t& n, T etai_over_etat) {
+			auto cos_theta = fmin(dot(-uv, n), T(1));
+			vec3_t r_out_perp = etai_over_etat * (uv + cos_theta*n);
+			vec3_t r_out_parallel = -sqrt(fabs(1 - r_out_perp.length_squared())) * n;
+			return r_out_perp + r_out_parallel;
+		}
 
-inline vec3 random_unit_vector() {
-	return unit_vector(random_in_unit_sphere());
-}
+	public:
+		T e[3];
+};
 
-inline vec3 random_in_hemisphere(const vec3& normal) {
-	vec3 in_unit_sphere = random_in_unit_sphere();
-	if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
+// Closed-form sample mappings: each turns a fixed number of uniform numbers in
+// [0, 1) into a sample, with no rejection loop and no data-dependent branch
+// (the selects compile to blends), so every path or SIMD lane draws the same
+// number of random numbers. bench/sampling.cc checks them against the
+// rejection samplers they replaced.
+
+// Uniform on the unit disk (z = 0), by Shirley and Chiu's concentric mapping
+template <typename T>
+inline vec3_t<T> sample_concentric_disk(T u1, T u2) {
+	T a = 2*u1 - 1, b = 2*u2 - 1;
+	bool major_a = fabs(a) > fabs(b);
+	T r = major_a ? a : b;
+	T ratio = major_a ? b / (a != 0 ? a : T(1)) : a / (b != 0 ? b : T(1));
+	T phi = major_a ? T(pi/4) * ratio : T(pi/2) - T(pi/4) * ratio;
+	return vec3_t<T>(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+// Uniform on the unit sphere
+template <typename T>
+inline vec3_t<T> sample_uniform_sphere(T u1, T u2) {
+	T z = 1 - 2*u1;
+	T r = sqrt(std::max(T(0), 1 - z*z));
+	T phi = T(2*pi) * u2;
+	return vec3_t<T>(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Uniform in the unit ball
+template <typename T>
+inline vec3_t<T> sample_uniform_ball(T u1, T u2, T u3) {
+	return std::cbrt(u3) * sample_uniform_sphere(u1, u2);
+}
+
+// Cosine-weighted on the hemisphere around +z: a uniform disk sample lifted
+// onto the hemisphere (Malley's method)
+template <typename T>
+inline vec3_t<T> sample_cosine_hemisphere(T u1, T u2) {
+	vec3_t<T> d = sample_concentric_disk(u1, u2);
+	return vec3_t<T>(d.x(), d.y(), sqrt(std::max(T(0), 1 - d.x()*d.x() - d.y()*d.y())));
+}
+
+// Two unit vectors completing the unit vector n to an orthonormal basis,
+// without branches (Duff et al. 2017)
+template <typename T>
+inline void orthonormal_basis(const vec3_t<T>& n, vec3_t<T>& b1, vec3_t<T>& b2) {
+	T sign = std::copysign(T(1), n.z());
+	T a = -1 / (sign + n.z());
+	T b = n.x() * n.y() * a;
+	b1 = vec3_t<T>(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+	b2 = vec3_t<T>(b, sign + n.y() * n.y() * a, -n.y());
+}
+
+template <typename T = real>
+inline vec3_t<T> random_in_unit_disk() {
+	T u1 = random_double(), u2 = random_double();
+	return sample_concentric_disk(u1, u2);
+}
+
+template <typename T = real>
+inline vec3_t<T> random_in_unit_sphere() {
+	T u1 = random_double(), u2 = random_double(), u3 = random_double();
+	return sample_uniform_ball(u1, u2, u3);
+}
+
+template <typename T = real>
+inline vec3_t<T> random_unit_vector() {
+	T u1 = random_double(), u2 = random_double();
+	return sample_uniform_sphere(u1, u2);
+}
+
+// Cosine-weighted direction around the unit normal n
+template <typename T>
+inline vec3_t<T> random_cosine_direction(const vec3_t<T>& n) {
+	T u1 = random_double(), u2 = random_double();
+	vec3_t<T> d = sample_cosine_hemisphere(u1, u2);
+	vec3_t<T> b1, b2;
+	orthonormal_basis(n, b1, b2);
+	return d.x()*b1 + d.y()*b2 + d.z()*n;
+}
+
+template <typename T>
+inline vec3_t<T> random_in_hemisphere(const vec3_t<T>& normal) {
+	vec3_t<T> in_unit_sphere = random_in_unit_sphere<T>();
+	if (dot(in_unit_sphere, normal) > 0) // In the same hemisphere as the normal
 		return in_unit_sphere;
 	else
 		return -in_unit_sphere;
 }
 
-inline vec3 reflect(const vec3& v, const vec3& n) {
-	return v - 2*dot(v,n)*n;
-}
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-	auto cos_theta = fmin(dot(-uv, n), 1.0);
-	vec3 r_out_perp = etai_over_etat * (uv + cos_theta*n);
-	vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
-	return r_out_perp + r_out_parallel;
-}
+// Type aliases for vec3
+using vec3 = vec3_t<real>;
+using point3 = vec3;   // 3D point
+using color = vec3;    // RGB color
 
 #endif
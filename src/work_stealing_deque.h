@@ -0,0 +1,121 @@
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include "task.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev work-stealing deque of tasks (Le, Pop, Cohen & Zappa Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models", 2013).
+//
+// The owning worker pushes and pops at the bottom; any other thread may steal
+// from the top. The ring grows when full. Old rings are kept until the deque
+// is destroyed, since a thief may still be reading one.
+class work_stealing_deque {
+	public:
+		work_stealing_deque(int64_t initial_capacity = 256) : top(0), bottom(0) {
+			rings.emplace_back(new ring(initial_capacity));
+			buffer.store(rings.back().get(), std::memory_order_relaxed);
+		}
+
+		work_stealing_deque(const work_stealing_deque&) = delete;
+		work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+		~work_stealing_deque() {
+			task t;
+			while (pop(t))
+				t.discard();
+		}
+
+		// Owner only
+		void push(const task& t) {
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t tp = top.load(std::memory_order_acquire);
+			ring* r = buffer.load(std::memory_order_relaxed);
+
+			if (b - tp > r->capacity - 1)
+				r = grow(r, tp, b);
+
+			t.store(r->slot(b));
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		// Owner only
+		bool pop(task& out) {
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			ring* r = buffer.load(std::memory_order_relaxed);
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t tp = top.load(std::memory_order_relaxed);
+
+			if (tp > b) {
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+
+			out = task::load(r->slot(b));
+			if (tp == b) {
+				// Last element, race the thieves for it
+				bool won = top.compare_exchange_strong(
+					tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return won;
+			}
+
+			return true;
+		}
+
+		// Any thread
+		bool steal(task& out) {
+			int64_t tp = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+
+			if (tp >= b) return false;
+
+			ring* r = buffer.load(std::memory_order_acquire);
+			task t = task::load(r->slot(tp));
+			if (!top.compare_exchange_strong(
+					tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return false;
+
+			out = t;
+			return true;
+		}
+
+		bool empty() const {
+			return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct ring {
+			int64_t capacity;
+			std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+			ring(int64_t c) : capacity(c), words(new std::atomic<uint64_t>[c * task::words]) {}
+
+			std::atomic<uint64_t>* slot(int64_t i) {
+				return &words[(i & (capacity - 1)) * task::words];
+			}
+		};
+
+		alignas(64) std::atomic<int64_t> top;
+		alignas(64) std::atomic<int64_t> bottom;
+		alignas(64) std::atomic<ring*> buffer;
+		std::vector<std::unique_ptr<ring>> rings;
+
+		ring* grow(ring* old, int64_t tp, int64_t b) {
+			rings.emplace_back(new ring(old->capacity * 2));
+			ring* r = rings.back().get();
+			for (int64_t i = tp; i < b; ++i)
+				task::load(old->slot(i)).store(r->slot(i));
+			buffer.store(r, std::memory_order_release);
+			return r;
+		}
+};
+
+#endif